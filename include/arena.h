@@ -0,0 +1,46 @@
+/*
+ * arena.h -- bump allocator for short-lived, same-lifetime allocations.
+ *
+ * Allocations are carved out of a chain of large blocks and never freed
+ * individually; arena_reset() recycles every block in O(1) and
+ * arena_free() returns them to malloc.
+ */
+#ifndef MYSHELL_ARENA_H
+#define MYSHELL_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (16 * 1024)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;            /* usable bytes in data[] */
+    size_t used;
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    size_t block_size;      /* 0 means ARENA_BLOCK_SIZE */
+    arena_block_t *first;
+    arena_block_t *cur;
+    void *last;             /* most recent allocation, may grow in place */
+    size_t nallocs;         /* allocations since the last reset */
+    size_t bytes;           /* bytes handed out since the last reset */
+    size_t peak_bytes;
+    size_t total_allocs;    /* allocations over the arena's lifetime */
+    size_t nblocks;
+    size_t resets;
+} arena_t;
+
+void *arena_alloc(arena_t *a, size_t n);
+void *arena_calloc(arena_t *a, size_t n, size_t sz);
+/* Grow OLD (of OLDN bytes) to NEWN; extends in place when OLD is the most
+ * recent allocation, otherwise copies.  OLD may be NULL. */
+void *arena_realloc(arena_t *a, void *old, size_t oldn, size_t newn);
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+char *arena_strdup(arena_t *a, const char *s);
+
+void arena_reset(arena_t *a);
+void arena_free(arena_t *a);
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * complete.h -- Tab completion of commands and paths for the line editor.
+ *
+ * The word under the cursor is completed as a command when it is the
+ * first word of a pipeline stage (after nothing, or | ; & && || and the
+ * `time` keyword) and contains no '/': candidates are the registered
+ * builtins plus the $PATH executables from pathcache's trie.  Anything
+ * else completes as a path, from a per-directory listing cache that is
+ * re-read only when the directory's mtime changes; in command position
+ * only directories and executables are offered.
+ *
+ * Candidates are full replacements for the word (shell metacharacters
+ * backslash-escaped, directories ending in '/'), sorted and unique.
+ */
+#ifndef MYSHELL_COMPLETE_H
+#define MYSHELL_COMPLETE_H
+
+#include <stddef.h>
+
+/* Offer NAME as a command; the string must stay valid. */
+void complete_add_command(const char *name);
+
+/* Complete the word ending at byte CURSOR of LINE.  Sets *START to the
+ * word's first byte and *CANDS to the candidates (owned by this module,
+ * valid until the next call); returns how many there are. */
+size_t complete_line(const char *line, size_t cursor, size_t *start, const char *const **cands);
+
+void complete_free(void);
+
+#endif
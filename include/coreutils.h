@@ -0,0 +1,35 @@
+/*
+ * coreutils.h -- echo, printf, test/[, cat, true and false, run inside the
+ * shell process.
+ *
+ * These are the commands scripts run most; as builtins they cost a
+ * function call instead of a fork+exec of the /usr/bin binary.  Each takes
+ * a NULL-terminated argv (argv[0] is the command name), writes to the
+ * current stdout/stderr through stdio and returns the exit status.  The
+ * caller owns file-descriptor redirection and flushing.
+ *
+ * Behaviour follows the GNU/bash versions for the common forms:
+ *   echo [-neE] args...      -e enables \a \b \c \e \f \n \r \t \v \\
+ *                            \0nnn \xHH
+ *   printf FORMAT [args...]  %d %i %o %u %x %X %c %s %b %e %E %f %g %G %%
+ *                            with flags, width and precision (also '*');
+ *                            the format is reused until the args run out
+ *   test EXPR / [ EXPR ]     file, string and integer primaries, ! -a -o
+ *                            and parentheses; status 2 on a syntax error
+ *   cat [-u] [file|-]...     straight to fd 1, copied in the kernel where
+ *                            possible; for other options use the real cat
+ */
+#ifndef MYSHELL_COREUTILS_H
+#define MYSHELL_COREUTILS_H
+
+int coreutils_echo(char **argv);
+int coreutils_printf(char **argv);
+int coreutils_test(char **argv);     /* "test" and "[" */
+int coreutils_cat(char **argv);
+
+/* Nonzero if ARGV takes only what coreutils_cat handles. */
+int coreutils_cat_plain(char **argv);
+int coreutils_true(char **argv);
+int coreutils_false(char **argv);
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * history.h -- command history shared by the myshell front ends.
+ *
+ * A fixed-capacity ring of entries whose text lives in one contiguous,
+ * periodically compacted string pool: appends are O(1) amortized and the
+ * whole store is two allocations no matter how many lines it holds.
+ */
+#ifndef MYSHELL_HISTORY_H
+#define MYSHELL_HISTORY_H
+
+#include <stddef.h>
+
+#define HISTORY_MAX 50000
+
+/* Set the capacity (entries kept); older entries are dropped first. */
+void history_init(size_t capacity);
+void history_free(void);
+
+void history_add(const char *line);
+
+/* Number of entries held; index 0 is the oldest. */
+size_t history_len(void);
+/* Entry I, valid until the next history_add() or history_get*() call. */
+const char *history_get(size_t i);
+/* K-th newest entry (0 = newest) without indexing the whole file. */
+const char *history_get_recent(size_t k);
+/* History number of entry 0 (1-based, counts dropped entries too). */
+unsigned long history_first_number(void);
+
+/* Put a history file in front of the store; its lines are read in,
+ * indexed and copied out lazily, newest first, as entries are asked for. */
+void history_load(const char *path);
+
+/*
+ * History file writer.  One O_APPEND descriptor stays open for the session
+ * and lines are collected in a small buffer, written out when it fills,
+ * HISTORY_FLUSH_SECS after the first unwritten line (SIGALRM timer), at
+ * exit and on fatal signals.  MYSHELL_HISTORY_SYNC=fsync switches to a
+ * write + fdatasync per command instead.
+ */
+#define HISTORY_BUF_SIZE 4096
+#define HISTORY_FLUSH_SECS 2
+
+int history_open(const char *path);
+void history_save(const char *line);     /* queue LINE for the file */
+void history_flush(void);
+void history_close(void);
+
+/*
+ * Compaction: rewrite the file with only the newest copy of each line,
+ * at most KEEP lines (0 = HISTORY_MAX), and rename it into place while
+ * holding PATH.lock exclusively.  Lines other sessions append meanwhile
+ * are carried over, and their writers move to the new file.
+ * history_compact_bg() does it in a detached child, and only once the
+ * file has reached HISTORY_COMPACT_BYTES and half as much again as it
+ * was left at by the last compaction (recorded in PATH.lock).
+ */
+#define HISTORY_COMPACT_BYTES (1 << 20)
+
+int history_compact(const char *path, size_t keep);
+void history_compact_bg(const char *path, size_t keep);
+
+#endif
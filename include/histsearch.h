@@ -0,0 +1,29 @@
+/*
+ * histsearch.h -- substring index over the history store for incremental
+ * reverse search (Ctrl-R).
+ *
+ * Each distinct history line is a document; repeated lines collapse onto
+ * their most recent use.  Trigram posting lists narrow a query down to a
+ * few candidates, which are then checked with a plain substring match;
+ * queries shorter than three bytes scan the lines directly.  Document ids
+ * grow with recency, so walking a posting list backwards yields matches
+ * newest first.
+ */
+#ifndef MYSHELL_HISTSEARCH_H
+#define MYSHELL_HISTSEARCH_H
+
+#include <stddef.h>
+
+/* Index a line added after the index was built (no-op until then). */
+void histsearch_add(const char *line);
+
+/* Newest document with id < BEFORE containing QUERY, or -1.  Pass a large
+ * BEFORE (e.g. LONG_MAX) to start from the newest entry.  The index is
+ * built from the history store on first use. */
+long histsearch_find(const char *query, long before);
+/* Text of document ID, valid until the next histsearch_add(). */
+const char *histsearch_text(long id);
+
+void histsearch_free(void);
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ * lineedit.h -- interactive line editor for a terminal in raw mode.
+ *
+ * The line lives in a growable gap buffer, so it has no length limit and
+ * edits at the cursor are O(1).  Input is read in blocks; all keys already
+ * buffered are applied before the screen is touched, and the difference
+ * between what the terminal shows and the new line goes out as one run of
+ * escape sequences in a single write().  Bracketed paste is enabled while
+ * a line is being read, so pasted text is inserted as one block.
+ *
+ * Keys: Left/Right, Backspace, Delete, Up/Down (history), Ctrl-R (reverse
+ * search, see histsearch.h), Tab (completion, see complete.h), Ctrl-D on
+ * an empty line (end of input), Enter.
+ */
+#ifndef MYSHELL_LINEEDIT_H
+#define MYSHELL_LINEEDIT_H
+
+/* Read one line; the prompt must already be on screen.  Returns the line
+ * without its newline, owned by the editor and valid until the next call,
+ * or NULL at end of input. */
+char *lineedit_read(void);
+
+/* Nonzero if keys are already buffered, so reading them will not block. */
+int lineedit_pending(void);
+
+void lineedit_free(void);
+
+#endif
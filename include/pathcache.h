@@ -0,0 +1,58 @@
+/*
+ * pathcache.h -- resolved-command hash table and stat cache shared by the
+ * myshell front ends.
+ *
+ * Command names are resolved against $PATH once and the result (including
+ * "not found") is remembered, so repeated commands skip the PATH walk and go
+ * straight to execve().  The table is dropped whenever $PATH changes.
+ *
+ * Completion lists command names from a trie of every executable in the
+ * $PATH directories, refreshed when a directory's mtime changes; while it
+ * is fresh, lookups of new names are answered from it too.
+ */
+#ifndef MYSHELL_PATHCACHE_H
+#define MYSHELL_PATHCACHE_H
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/* Seconds a cached miss or stat() result is trusted before re-probing. */
+#define PATHCACHE_NEG_TTL 5
+/* Cached stat() results kept before the table is dropped and refilled. */
+#define PATHCACHE_STAT_MAX 4096
+
+/* Resolve NAME the way execvp() would.  Returns a path owned by the cache,
+ * or NULL if NAME is not found.  Names containing '/' are returned as-is. */
+const char *pathcache_lookup(const char *name);
+
+/* Resolve NAME against PATH (a $PATH-style list) instead, for a
+ * `PATH=... cmd` prefix; not cached.  The result is valid until the next
+ * call. */
+const char *pathcache_lookup_in(const char *name, const char *path);
+
+/* Cached stat(); returns 0 and fills *st, or -1 with errno set. */
+int pathcache_stat(const char *path, struct stat *st);
+/* Uncached: autocd must see a directory made or removed a moment ago. */
+int pathcache_is_directory(const char *path);
+
+/* execve() the resolved path, falling back to execvp() if the cached entry
+ * went stale, and running it with /bin/sh if it is a script without #!
+ * (ENOEXEC), as execvp() does.  A NULL path fails with ENOENT without
+ * touching $PATH.  Only returns on failure. */
+void pathcache_exec(const char *path, char **argv);
+
+/* Call FN for each executable on $PATH whose name starts with PREFIX, in
+ * byte order, until it returns nonzero.  Returns the number of names
+ * passed to FN. */
+size_t pathcache_complete(const char *prefix, int (*fn)(const char *name, void *arg), void *arg);
+
+/* Drop a single name, everything (hash -r, trie included), or cwd-relative
+ * state (cd). */
+void pathcache_forget(const char *name);
+void pathcache_clear(void);
+void pathcache_invalidate_cwd(void);
+
+/* The `hash` builtin shared by both front ends. */
+int pathcache_builtin(char **argv, FILE *out);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * pathglob.h -- pathname expansion (*, ?, [...]) for the expansion stage.
+ *
+ * Patterns use backslash escapes for characters that must match
+ * literally; the shell escapes quoted text that way, so a plain unquoted
+ * slice from the parse is already a valid pattern.  Matching follows
+ * POSIX in the C locale: '*' and '?' never match '/' or a leading '.',
+ * brackets take ranges, '!' or '^' negation and [:class:] names, and "."
+ * and ".." are never produced.  Results are sorted in byte order; a
+ * pattern that matches nothing yields no results, and the caller keeps
+ * the word as it was.
+ *
+ * Directories are read with getdents64 into a cache that lives in the
+ * caller's arena, so a directory visited by several patterns, or by
+ * several wildcard components of one pattern, is read once.  Reset the
+ * cache wherever the filesystem may have changed, e.g. before each
+ * pipeline of a command list.
+ */
+#ifndef MYSHELL_PATHGLOB_H
+#define MYSHELL_PATHGLOB_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+#define PATHGLOB_BUCKETS 64
+
+typedef struct pathglob_dir pathglob_dir_t;
+
+typedef struct {
+    arena_t *a;             /* listings and results are allocated here */
+    pathglob_dir_t *buckets[PATHGLOB_BUCKETS];
+} pathglob_cache_t;
+
+/* Nonzero if PATTERN has an unescaped '*', '?' or a complete [...]. */
+int pathglob_has_meta(const char *pattern);
+
+/* Expand PATTERN; *OUT gets a sorted array of arena strings.  Returns the
+ * number of matches. */
+size_t pathglob_expand(pathglob_cache_t *c, const char *pattern, char ***out);
+
+/* Forget cached listings (their memory goes with the arena). */
+void pathglob_cache_reset(pathglob_cache_t *c);
+
+/* Copy of PATTERN with the escaping backslashes removed. */
+char *pathglob_unescape(arena_t *a, const char *pattern);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * place.h -- spawn-time placement of a job: CPU affinity, niceness, I/O
+ * priority and a cgroup v2 group with optional memory and CPU limits.
+ *
+ *   place [-c CPULIST] [-n INC] [-i CLASS[:LEVEL]] [-g CGROUP]
+ *         [-m BYTES] [-q PERCENT] pipeline
+ *
+ *   -c  CPUs the job may run on, e.g. 0-3,8
+ *   -n  added to the shell's niceness, as nice(1) does
+ *   -i  I/O class idle, be or rt, with level 0-7 for be and rt
+ *   -g  cgroup under the cgroup v2 mount (created if missing); the job's
+ *       processes join it before exec
+ *   -m  memory.max of that cgroup (K/M/G suffixes, or "max")
+ *   -q  cpu.max of that cgroup as a percentage of one CPU
+ *
+ * place_parse() runs in the shell: it checks the options, creates the
+ * cgroup and writes its limits once per job.  place_apply() runs in
+ * each forked stage between fork and exec, so no helper process
+ * (taskset, nice, ionice, systemd-run) sits between the shell and the
+ * command.
+ */
+#ifndef MYSHELL_PLACE_H
+#define MYSHELL_PLACE_H
+
+#include <sched.h>             /* cpu_set_t: needs _GNU_SOURCE */
+
+typedef struct {
+    int have_cpus;
+    cpu_set_t cpus;
+    int have_nice, nice;
+    int ioprio;             /* ioprio_set() value, or -1 to leave it */
+    int cg_fd;              /* the cgroup's cgroup.procs, or -1 */
+    char *desc;             /* e.g. "cpus=0-3 nice=+10", for `jobs` */
+} place_t;
+
+/* Parse the options of ARGV (argv[0] is "place") into P and prepare the
+ * cgroup.  Returns the index of the first word of the command, or -1
+ * after a message on stderr. */
+int place_parse(char **argv, place_t *p);
+
+/* Apply P to the calling process; -1 after a message on stderr. */
+int place_apply(const place_t *p);
+
+void place_release(place_t *p);
+
+#endif
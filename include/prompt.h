@@ -0,0 +1,39 @@
+/*
+ * prompt.h -- cached, template-driven prompt shared by the myshell front
+ * ends.
+ *
+ * User, host and home are looked up once; the cwd only when the shell
+ * says it changed.  The rendered prompt is kept and rebuilt only when one
+ * of its inputs does, then sent with a single write().
+ *
+ * Templates ($MYSHELL_PS1, or the front end's default) take PS1-style
+ * escapes:
+ *   \u user       \h host up to the first '.'   \H full host
+ *   \w cwd, with $HOME shown as ~                \W last cwd component
+ *   \$ '#' for root, else '$'   \n newline   \e ESC   \\ backslash
+ *   \[ \] accepted and ignored (non-printing markers)
+ *   $(cmd)  output of CMD, computed asynchronously: the prompt shows the
+ *           last finished result and a refresh starts in the background,
+ *           so a slow command never holds up input.  It is rerun when the
+ *           cwd changes, or when its result is PROMPT_SEG_TTL seconds old
+ *           for what the shell cannot see change (files, the clock).
+ */
+#ifndef MYSHELL_PROMPT_H
+#define MYSHELL_PROMPT_H
+
+/* Seconds a $(cmd) result stands before it is rerun anyway. */
+#define PROMPT_SEG_TTL 5
+
+/* Runs CMD in a forked child with stdout on the segment's pipe; must not
+ * return.  The default runs it with /bin/sh -c. */
+typedef void (*prompt_runner_t)(const char *cmd);
+
+void prompt_init(const char *default_template, prompt_runner_t runner);
+void prompt_cwd_changed(void);
+
+/* Render (if anything changed) and write the prompt to stdout. */
+void prompt_show(void);
+
+void prompt_free(void);
+
+#endif
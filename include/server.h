@@ -0,0 +1,36 @@
+/*
+ * server.h -- `myshell --server`: a warm shell that runs commands for thin
+ * clients over a unix stream socket.
+ *
+ * The server initialises once and keeps a small pool of idle workers
+ * forked from that state, each blocked in accept() on the socket.  A
+ * client sends its argv, cwd and environment in one message with its
+ * fds 0-2 attached (SCM_RIGHTS).  The worker that takes the connection
+ * tells the server, which forks a replacement.  The worker then adopts
+ * the client's fds and cwd and runs the command.  It replies with its pid,
+ * then with the exit status when it is done, and exits; every request
+ * starts from the same warm state.
+ *
+ * Workers lead their own process group, and the client forwards SIGINT,
+ * SIGTERM, SIGHUP and SIGQUIT to it.  The socket is created mode 0600 and
+ * only peers with the server's uid are served.
+ */
+#ifndef MYSHELL_SERVER_H
+#define MYSHELL_SERVER_H
+
+/* Runs one request in a worker: ARGV as the shell's own argv (argv[0] is
+ * "myshell"), ENVP as the client's environment.  Returns the exit status;
+ * it may also exit() directly. */
+typedef int (*server_run_t)(int argc, char **argv, char **envp);
+
+/* Serve on PATH with WORKERS idle workers until SIGTERM or SIGINT.  WARM,
+ * if set, refreshes what workers forked later inherit; it runs in the
+ * server after every quiet second, never while requests are arriving.
+ * Returns an exit status only on failure or after such a signal. */
+int server_main(const char *path, int workers, server_run_t run, void (*warm)(void));
+
+/* Run ARGV through the server at PATH and return its exit status, or -1
+ * if no server accepted the request (nothing was run). */
+int server_client(const char *path, int argc, char **argv);
+
+#endif
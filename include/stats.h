@@ -0,0 +1,81 @@
+/*
+ * stats.h -- hot-path counters and latency histograms shared by the
+ * myshell modules.
+ *
+ * Counters are plain uint64_t slots bumped with STATS_INC(); latencies are
+ * monotonic-clock nanoseconds folded into per-phase log2 histograms
+ * (bucket k holds samples in [2^k, 2^(k+1)) ns) with count, sum, min and
+ * max.  Recording is a vDSO clock read, a bit scan and a few adds; nothing
+ * ever allocates or takes a lock.
+ *
+ * A snapshot can be printed as text or JSON (the `shellstats` builtin) and
+ * optionally written every few seconds to a file (replaced atomically) or
+ * sent to a unix stream socket, for scraping.
+ */
+#ifndef MYSHELL_STATS_H
+#define MYSHELL_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    STAT_READ,          /* read() of command input */
+    STAT_PARSE,         /* line -> parse tree (cache hits included) */
+    STAT_EXPAND,        /* parse tree -> argv, substitutions included */
+    STAT_SUBST,         /* one $(...) / `...` capture */
+    STAT_LAUNCH,        /* fork or posix_spawn of one stage */
+    STAT_LOOKUP,        /* PATH resolution of one command name */
+    STAT_WAIT,          /* blocking wait for a foreground job */
+    STAT_HISTORY,       /* history file load and appends */
+    STAT_NPHASES
+} stat_phase_t;
+
+typedef enum {
+    STAT_COMMANDS,      /* pipelines run */
+    STAT_FORKS,
+    STAT_SPAWNS,
+    STAT_INPROC,        /* builtins run inside the shell */
+    STAT_PATH_PROBES,   /* candidate paths stat()ed while walking $PATH */
+    STAT_PATH_HITS,     /* name lookups answered by the hash */
+    STAT_PATH_MISSES,
+    STAT_STAT_HITS,     /* stat() results served from the cache */
+    STAT_STAT_MISSES,
+    STAT_PARSE_HITS,    /* lines found in the parse cache */
+    STAT_PARSE_MISSES,
+    STAT_ARENA_ALLOCS,
+    STAT_ARENA_BLOCKS,  /* arena blocks taken from malloc */
+    STAT_GLOB_READS,    /* directories listed for pathname expansion */
+    STAT_GLOB_HITS,     /* listings reused within a command */
+    STAT_NCOUNTERS
+} stat_counter_t;
+
+#define STATS_BUCKETS 40
+
+extern uint64_t stats_counters[STAT_NCOUNTERS];
+
+#define STATS_INC(c) (stats_counters[(c)]++)
+
+/* Monotonic nanoseconds, for pairing with stats_since(). */
+uint64_t stats_now(void);
+void stats_record(stat_phase_t phase, uint64_t ns);
+/* Record the time elapsed since START (a stats_now() value). */
+void stats_since(stat_phase_t phase, uint64_t start);
+
+void stats_reset(void);
+/* Snapshot as aligned text or as one JSON object followed by a newline. */
+void stats_print(FILE *out, int json);
+
+/* Dump a JSON snapshot to TARGET ("unix:/path" for a socket, otherwise a
+ * file) every INTERVAL seconds; a NULL target stops dumping.  Returns -1
+ * with errno set if TARGET is unusable. */
+int stats_dump_config(const char *target, unsigned interval);
+/* Milliseconds until the next dump is due (0 if overdue), or -1 if
+ * dumping is off: a poll() timeout for the input loop. */
+int stats_dump_timeout(void);
+/* Dump now if one is due. */
+void stats_tick(void);
+
+/* shellstats [-j] [-r] [-d target [seconds] | -d off]; returns its status. */
+int stats_builtin(char **argv, FILE *out);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * vars.h -- the shell's variable store: local and exported variables.
+ *
+ * Variables live in a chained hash table keyed by name.  Lookups take a
+ * (pointer, length) slice, so names parsed out of a command line are used
+ * in place and never copied.  Each variable is kept as one "NAME=value"
+ * string, which goes into the environment array as it is when the
+ * variable is exported.
+ *
+ * That array is rebuilt only on the first request after an exported
+ * variable changed (set, unset, export or export -n); local assignments
+ * never touch it.  A rebuilt array is also installed as `environ`, so
+ * getenv() in the other modules and the exec*p() fallbacks see the same
+ * environment as the commands the shell starts.  Strings replaced in the
+ * meantime stay allocated until then, so the old array never dangles.
+ */
+#ifndef MYSHELL_VARS_H
+#define MYSHELL_VARS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "arena.h"
+
+#define VAR_EXPORT 1
+
+/* Import ENVP ("NAME=value" strings) as exported variables. */
+void vars_init(char **envp);
+
+/* Value of the LEN-byte NAME, or NULL if it is unset. */
+const char *vars_get(const char *name, size_t len);
+
+/* [A-Za-z_][A-Za-z0-9_]* */
+int vars_valid_name(const char *name, size_t len);
+
+/* Set NAME to VALUE.  VAR_EXPORT in FLAGS exports it; a variable that is
+ * already exported stays exported either way.  Returns -1 for an invalid
+ * name. */
+int vars_set(const char *name, size_t len, const char *value, int flags);
+
+/* Apply a "NAME=value" string; -1 if it is not one. */
+int vars_assign(const char *assignment, int flags);
+
+int vars_unset(const char *name, size_t len);
+
+/* The environment for execve(): every exported variable with a value. */
+char **vars_environ(void);
+
+/* The environment with ASSIGNS ("NAME=value", N of them) laid over it,
+ * allocated in A, for a `NAME=value cmd` prefix.  The shell's variables
+ * are not changed. */
+char **vars_environ_with(char *const *assigns, int n, arena_t *a);
+
+/* export [-n] [-p] [NAME[=value]...] and unset [-v] NAME...; return their
+ * exit status. */
+int vars_export_builtin(char **argv, FILE *out);
+int vars_unset_builtin(char **argv);
+
+void vars_free(void);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * arena.c -- bump allocator; see arena.h.
+ *
+ * Blocks are kept after a reset and reused front to back, so a steady
+ * workload stops calling malloc once the chain is large enough.
+ */
+#include "arena.h"
+#include "stats.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+static size_t round_up(size_t n) { return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1); }
+
+static arena_block_t *new_block(arena_t *a, size_t need) {
+    size_t bs = a->block_size ? a->block_size : ARENA_BLOCK_SIZE;
+    size_t size = need > bs ? round_up(need) : bs;
+    arena_block_t *b = malloc(sizeof(*b) + size);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    a->nblocks++;
+    STATS_INC(STAT_ARENA_BLOCKS);
+    return b;
+}
+
+void *arena_alloc(arena_t *a, size_t n) {
+    n = round_up(n ? n : 1);
+    arena_block_t *b = a->cur;
+    if (b && b->size - b->used < n) {
+        /* move on to a recycled block, or splice in a fresh one big enough */
+        arena_block_t *next = b->next;
+        if (next && next->size >= n) {
+            next->used = 0;
+            b = next;
+        } else {
+            arena_block_t *nb = new_block(a, n);
+            if (!nb) return NULL;
+            nb->next = next;
+            b->next = nb;
+            b = nb;
+        }
+    } else if (!b) {
+        b = new_block(a, n);
+        if (!b) return NULL;
+        a->first = b;
+    }
+    a->cur = b;
+    void *p = b->data + b->used;
+    b->used += n;
+    a->last = p;
+    a->nallocs++;
+    a->total_allocs++;
+    STATS_INC(STAT_ARENA_ALLOCS);
+    a->bytes += n;
+    if (a->bytes > a->peak_bytes) a->peak_bytes = a->bytes;
+    return p;
+}
+
+void *arena_calloc(arena_t *a, size_t n, size_t sz) {
+    void *p = arena_alloc(a, n * sz);
+    if (p) memset(p, 0, n * sz);
+    return p;
+}
+
+void *arena_realloc(arena_t *a, void *old, size_t oldn, size_t newn) {
+    if (old && newn <= oldn) return old;
+    if (old && old == a->last) {
+        arena_block_t *b = a->cur;
+        size_t off = (size_t)((char *)old - b->data);
+        size_t want = round_up(newn);
+        if (off + want <= b->size) {
+            a->bytes += (off + want) - b->used;
+            if (a->bytes > a->peak_bytes) a->peak_bytes = a->bytes;
+            b->used = off + want;
+            return old;
+        }
+    }
+    void *p = arena_alloc(a, newn);
+    if (p && old) memcpy(p, old, oldn < newn ? oldn : newn);
+    return p;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n) {
+    char *p = arena_alloc(a, n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+void arena_reset(arena_t *a) {
+    if (a->first) a->first->used = 0;
+    a->cur = a->first;
+    a->last = NULL;
+    a->nallocs = 0;
+    a->bytes = 0;
+    a->resets++;
+}
+
+void arena_free(arena_t *a) {
+    arena_block_t *b = a->first;
+    while (b) { arena_block_t *n = b->next; free(b); b = n; }
+    size_t bs = a->block_size;
+    memset(a, 0, sizeof(*a));
+    a->block_size = bs;
+}
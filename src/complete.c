@@ -0,0 +1,380 @@
+/*
+ * complete.c -- command and path completion.
+ *
+ * The line up to the cursor is scanned once with the shell's quoting
+ * rules to find where the current word starts, whether it is in command
+ * position and, for paths, its directory part.  That part is kept exactly
+ * as typed (quotes and all); only the completed name is escaped for the
+ * quoting in effect where it starts, so `"my dir/f` completes inside the
+ * quotes and `my\ dir/f` outside them.
+ *
+ * Directory listings are cached by path in a small chained hash table,
+ * each one sorted once so a prefix is a binary search plus a scan.  A
+ * listing is trusted while the directory's mtime and inode are unchanged;
+ * a stat() per Tab is all it then costs.  Past CP_MAX_DIRS listings the
+ * whole table is dropped and refilled.
+ */
+#define _GNU_SOURCE
+#include "complete.h"
+#include "pathcache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CP_BUCKETS  64
+#define CP_MAX_DIRS 256
+
+typedef struct {
+    const char *name;       /* into the listing's name block */
+    int isdir;              /* a directory, or a symlink to one */
+} cp_ent_t;
+
+typedef struct cp_dir {
+    char *path;
+    int64_t mtime;
+    dev_t dev;
+    ino_t ino;
+    char *block;
+    cp_ent_t *ents;
+    size_t n;
+    uint32_t hash;
+    struct cp_dir *next;
+} cp_dir_t;
+
+typedef struct { char *s; size_t len, cap; } cp_str_t;
+
+static cp_dir_t *listings[CP_BUCKETS];
+static size_t nlistings;
+
+static const char **commands;
+static size_t ncommands, commands_cap;
+
+static char **cands;
+static size_t ncands, cands_cap;
+
+static uint32_t cp_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static int str_put(cp_str_t *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t nc = b->cap ? b->cap : 64;
+        while (nc < b->len + n + 1) nc *= 2;
+        char *ns = realloc(b->s, nc);
+        if (!ns) return -1;
+        b->s = ns;
+        b->cap = nc;
+    }
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+    return 0;
+}
+
+void complete_add_command(const char *name) {
+    if (ncommands == commands_cap) {
+        size_t nc = commands_cap ? commands_cap * 2 : 32;
+        const char **n = realloc(commands, nc * sizeof(*n));
+        if (!n) return;
+        commands = n;
+        commands_cap = nc;
+    }
+    commands[ncommands++] = name;
+}
+
+/* --- Directory listings --- */
+
+static void listing_free(cp_dir_t *d) {
+    free(d->path);
+    free(d->block);
+    free(d->ents);
+    free(d);
+}
+
+static void listings_clear(void) {
+    for (size_t b = 0; b < CP_BUCKETS; ++b) {
+        cp_dir_t *d = listings[b];
+        while (d) { cp_dir_t *n = d->next; listing_free(d); d = n; }
+        listings[b] = NULL;
+    }
+    nlistings = 0;
+}
+
+static int ent_cmp(const void *a, const void *b) {
+    return strcmp(((const cp_ent_t *)a)->name, ((const cp_ent_t *)b)->name);
+}
+
+/* Read DIR into D; names go into one block, then are sorted. */
+static int listing_read(cp_dir_t *d, const char *dir) {
+    DIR *dp = opendir(dir);
+    if (!dp) return -1;
+    int dfd = dirfd(dp);
+    cp_str_t block = {0};
+    size_t n = 0, cap = 0;
+    size_t *offs = NULL;
+    unsigned char *isdir = NULL;
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        const char *nm = de->d_name;
+        if (nm[0] == '.' && (!nm[1] || (nm[1] == '.' && !nm[2]))) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            size_t *no = realloc(offs, cap * sizeof(*no));
+            if (no) offs = no;
+            unsigned char *ni = realloc(isdir, cap);
+            if (ni) isdir = ni;
+            if (!no || !ni) break;
+        }
+        int dirp = de->d_type == DT_DIR;
+        if (de->d_type == DT_LNK || de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            dirp = fstatat(dfd, nm, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        offs[n] = block.len;
+        isdir[n] = (unsigned char)dirp;
+        if (str_put(&block, nm, strlen(nm) + 1) < 0) break;
+        n++;
+    }
+    closedir(dp);
+    d->ents = n ? malloc(n * sizeof(*d->ents)) : NULL;
+    if (n && !d->ents) n = 0;
+    for (size_t i = 0; i < n; ++i) d->ents[i] = (cp_ent_t){ block.s + offs[i], isdir[i] };
+    qsort(d->ents, n, sizeof(*d->ents), ent_cmp);
+    d->block = block.s;
+    d->n = n;
+    free(offs);
+    free(isdir);
+    return 0;
+}
+
+/* The cached listing of DIR, re-read if the directory changed. */
+static cp_dir_t *listing_get(const char *dir) {
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+    int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    uint32_t h = cp_hash(dir);
+    cp_dir_t **pp = &listings[h & (CP_BUCKETS - 1)];
+    for (; *pp; pp = &(*pp)->next) {
+        cp_dir_t *d = *pp;
+        if (d->hash != h || strcmp(d->path, dir) != 0) continue;
+        if (d->mtime == mtime && d->dev == st.st_dev && d->ino == st.st_ino) return d;
+        *pp = d->next;
+        listing_free(d);
+        nlistings--;
+        break;
+    }
+    if (nlistings >= CP_MAX_DIRS) listings_clear();
+    cp_dir_t *d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    d->path = strdup(dir);
+    if (!d->path || listing_read(d, dir) < 0) { listing_free(d); return NULL; }
+    d->mtime = mtime;
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    d->hash = h;
+    d->next = listings[h & (CP_BUCKETS - 1)];
+    listings[h & (CP_BUCKETS - 1)] = d;
+    nlistings++;
+    return d;
+}
+
+/* --- Candidates --- */
+
+static void cands_clear(void) {
+    for (size_t i = 0; i < ncands; ++i) free(cands[i]);
+    ncands = 0;
+}
+
+static void cand_add(char *s) {
+    if (!s) return;
+    if (ncands == cands_cap) {
+        size_t nc = cands_cap ? cands_cap * 2 : 64;
+        char **n = realloc(cands, nc * sizeof(*n));
+        if (!n) { free(s); return; }
+        cands = n;
+        cands_cap = nc;
+    }
+    cands[ncands++] = s;
+}
+
+/* NAME quoted for quote state Q ('\'', '"' or 0); AT_START escapes a
+ * leading '~'. */
+static void put_quoted(cp_str_t *b, const char *name, char q, int at_start) {
+    for (const char *p = name; *p; ++p) {
+        if (q == '\'') {
+            if (*p == '\'') str_put(b, "'\\''", 4);
+            else str_put(b, p, 1);
+        } else if (q == '"') {
+            if (strchr("$`\"\\", *p)) str_put(b, "\\", 1);
+            str_put(b, p, 1);
+        } else {
+            if (strchr(" \t\n\\'\"|&;<>()$`*?[]#!{}", *p) || (*p == '~' && p == name && at_start))
+                str_put(b, "\\", 1);
+            str_put(b, p, 1);
+        }
+    }
+}
+
+/* RAW (kept as typed) + NAME quoted for Q, then '/' for a directory or the
+ * closing quote for anything else. */
+static char *make_cand(const char *raw, size_t rawlen, const char *name, char q, int isdir) {
+    cp_str_t b = {0};
+    str_put(&b, raw, rawlen);
+    put_quoted(&b, name, q, rawlen == 0);
+    if (isdir) str_put(&b, "/", 1);
+    else if (q) str_put(&b, &q, 1);
+    return b.s;
+}
+
+static int cand_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void cands_sort_unique(void) {
+    qsort(cands, ncands, sizeof(*cands), cand_cmp);
+    size_t k = 0;
+    for (size_t i = 0; i < ncands; ++i) {
+        if (k && strcmp(cands[k - 1], cands[i]) == 0) { free(cands[i]); continue; }
+        cands[k++] = cands[i];
+    }
+    ncands = k;
+}
+
+typedef struct { const char *raw; size_t rawlen; char q; } cmd_ctx_t;
+
+static int add_path_command(const char *name, void *arg) {
+    cmd_ctx_t *c = arg;
+    cand_add(make_cand(c->raw, c->rawlen, name, c->q, 0));
+    return 0;
+}
+
+/* --- Word scanning --- */
+
+static int is_time_word(const char *s, size_t n) {
+    return n == 4 && memcmp(s, "time", 4) == 0;
+}
+
+size_t complete_line(const char *line, size_t cursor, size_t *start, const char *const **out) {
+    cands_clear();
+
+    /* where the word starts, and whether it names a command */
+    size_t ws = 0;
+    int cmdpos = 1;
+    char q = 0;
+    for (size_t i = 0; i < cursor; ++i) {
+        char c = line[i];
+        if (q) {
+            if (c == q) q = 0;
+            else if (q == '"' && c == '\\' && i + 1 < cursor) i++;
+            continue;
+        }
+        if (c == '\\') { if (i + 1 < cursor) i++; continue; }
+        if (c == '\'' || c == '"') { q = c; continue; }
+        if (c == ' ' || c == '\t') {
+            if (i > ws) cmdpos = cmdpos && is_time_word(line + ws, i - ws);
+            ws = i + 1;
+        } else if (c == '|' || c == ';' || c == '&' || c == '(') {
+            cmdpos = 1;
+            ws = i + 1;
+        } else if (c == '<' || c == '>') {
+            cmdpos = 0;
+            ws = i + 1;
+        }
+    }
+    *start = ws;
+
+    /* unquote it, noting the raw and unquoted ends of the directory part
+     * and the quoting in effect there */
+    cp_str_t word = {0};
+    size_t cut_raw = 0, cut_word = 0;
+    char cut_q = 0;
+    str_put(&word, "", 0);
+    q = 0;
+    for (size_t i = ws; i < cursor; ++i) {
+        char c = line[i];
+        if (q == '\'') { if (c == '\'') q = 0; else str_put(&word, &c, 1); }
+        else if (q == '"') {
+            if (c == '"') q = 0;
+            else {
+                if (c == '\\' && i + 1 < cursor && strchr("$`\"\\", line[i + 1])) c = line[++i];
+                str_put(&word, &c, 1);
+            }
+        } else if (c == '\'' || c == '"') q = c;
+        else {
+            if (c == '\\' && i + 1 < cursor) c = line[++i];
+            str_put(&word, &c, 1);
+        }
+        if (c == '/' && line[i] == '/') { cut_raw = i + 1 - ws; cut_word = word.len; cut_q = q; }
+    }
+    if (!word.s) return 0;
+    if (cut_raw == 0 && cursor > ws && (line[ws] == '"' || line[ws] == '\'')) {
+        cut_raw = 1;                    /* stay inside a quote the word opened */
+        cut_q = line[ws];
+    }
+
+    if (cmdpos && cut_word == 0) {
+        cmd_ctx_t ctx = { line + ws, 0, 0 };
+        size_t wl = word.len;
+        for (size_t i = 0; i < ncommands; ++i)
+            if (strncmp(commands[i], word.s, wl) == 0) add_path_command(commands[i], &ctx);
+        pathcache_complete(word.s, add_path_command, &ctx);
+    } else {
+        /* the directory to list: the unquoted part up to the last '/',
+         * with a leading ~/ taken from $HOME */
+        cp_str_t dir = {0};
+        const char *home = getenv("HOME");
+        if (cut_word == 0) str_put(&dir, ".", 1);
+        else if (word.s[0] == '~' && word.s[1] == '/' && line[ws] == '~' && home) {
+            str_put(&dir, home, strlen(home));
+            str_put(&dir, word.s + 1, cut_word - 1);
+        } else str_put(&dir, word.s, cut_word);
+        const char *base = word.s + cut_word;
+        size_t bl = strlen(base);
+        cp_dir_t *d = dir.s ? listing_get(dir.s) : NULL;
+        if (d) {
+            size_t lo = 0, hi = d->n;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (strcmp(d->ents[mid].name, base) < 0) lo = mid + 1; else hi = mid;
+            }
+            cp_str_t full = {0};
+            for (size_t i = lo; i < d->n && strncmp(d->ents[i].name, base, bl) == 0; ++i) {
+                const cp_ent_t *e = &d->ents[i];
+                if (e->name[0] == '.' && base[0] != '.') continue;
+                if (cmdpos && !e->isdir) {
+                    full.len = 0;
+                    str_put(&full, dir.s, dir.len);
+                    str_put(&full, "/", 1);
+                    str_put(&full, e->name, strlen(e->name));
+                    if (!full.s || access(full.s, X_OK) != 0) continue;
+                }
+                cand_add(make_cand(line + ws, cut_raw, e->name, cut_q, e->isdir));
+            }
+            free(full.s);
+        }
+        free(dir.s);
+    }
+    free(word.s);
+
+    cands_sort_unique();
+    *out = (const char *const *)cands;
+    return ncands;
+}
+
+void complete_free(void) {
+    cands_clear();
+    free(cands);
+    cands = NULL;
+    cands_cap = 0;
+    listings_clear();
+    free(commands);
+    commands = NULL;
+    ncommands = commands_cap = 0;
+}
@@ -0,0 +1,514 @@
+/*
+ * coreutils.c -- in-process echo, printf, test/[, cat, true and false.
+ *
+ * Output goes through stdout's stdio buffer, so an echo or printf is a
+ * handful of copies and no syscall until the caller flushes.  printf builds
+ * one C conversion spec per directive and hands it to fprintf(); test
+ * applies the POSIX argument-count rules for up to four arguments and a
+ * small recursive-descent parser (-o below -a below !) beyond that.
+ * File tests use plain stat(), not the shell's stat cache: scripts test
+ * files they have just created or removed.  cat moves data in the kernel:
+ * copy_file_range between regular files, splice when either end is a
+ * pipe, sendfile from a regular file to anything else, and a 128 KiB
+ * read/write loop otherwise or whenever the kernel call is refused.
+ */
+#define _GNU_SOURCE
+#include "coreutils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* --- Escapes --- */
+
+enum { ESC_ECHO, ESC_FORMAT, ESC_B };
+
+/* Write S to OUT with backslash escapes expanded.  ESC_ECHO takes
+ * octal as \0nnn, ESC_FORMAT as \nnn, ESC_B (printf %b) either.  Returns
+ * 1 if a \c asked for output to stop. */
+static int put_escaped(FILE *out, const char *s, int mode) {
+    for (; *s; ++s) {
+        if (*s != '\\' || !s[1]) { putc(*s, out); continue; }
+        int c = *++s, v = 0, n = 0;
+        switch (c) {
+        case 'a': putc('\a', out); break;
+        case 'b': putc('\b', out); break;
+        case 'e': case 'E': putc('\033', out); break;
+        case 'f': putc('\f', out); break;
+        case 'n': putc('\n', out); break;
+        case 'r': putc('\r', out); break;
+        case 't': putc('\t', out); break;
+        case 'v': putc('\v', out); break;
+        case '\\': putc('\\', out); break;
+        case 'c': return 1;
+        case 'x':
+            while (n < 2 && s[1] && strchr("0123456789abcdefABCDEF", s[1])) {
+                c = *++s;
+                v = v * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+                n++;
+            }
+            if (n) putc(v, out); else fputs("\\x", out);
+            break;
+        default:
+            if (c >= '0' && c <= '7' && (mode != ESC_ECHO || c == '0')) {
+                /* \0nnn for echo and %b, \nnn for formats and %b */
+                int max = c == '0' && mode != ESC_FORMAT ? 3 : 2;
+                v = c - '0';
+                while (n < max && s[1] >= '0' && s[1] <= '7') { v = v * 8 + (*++s - '0'); n++; }
+                putc(v & 0xff, out);
+                break;
+            }
+            if (mode == ESC_FORMAT && (c == '"' || c == '\'' || c == '?')) { putc(c, out); break; }
+            putc('\\', out);
+            putc(c, out);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* --- echo --- */
+
+int coreutils_echo(char **argv) {
+    int newline = 1, escapes = 0, i = 1;
+    /* options stop at the first word that is not all of -[neE] */
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        const char *p = argv[i] + 1;
+        if (p[strspn(p, "neE")]) break;
+        for (; *p; ++p) {
+            if (*p == 'n') newline = 0;
+            else if (*p == 'e') escapes = 1;
+            else escapes = 0;
+        }
+    }
+    for (int first = 1; argv[i]; ++i, first = 0) {
+        if (!first) putchar(' ');
+        if (!escapes) fputs(argv[i], stdout);
+        else if (put_escaped(stdout, argv[i], ESC_ECHO)) return 0;
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+/* --- printf --- */
+
+static int printf_status;
+
+/* Integer argument: a number in C syntax, or 'c / "c for a character's
+ * value.  Bad numbers are reported and their valid prefix is used. */
+static long long arg_int(const char *s) {
+    if (!s || !*s) return 0;
+    if (*s == '\'' || *s == '"') return (unsigned char)s[1];
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 0);
+    if (end == s || *end || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", s);
+        printf_status = 1;
+    }
+    return v;
+}
+
+static double arg_double(const char *s) {
+    if (!s || !*s) return 0;
+    if (*s == '\'' || *s == '"') return (unsigned char)s[1];
+    char *end;
+    errno = 0;
+    double v = strtod(s, &end);
+    if (end == s || *end || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", s);
+        printf_status = 1;
+    }
+    return v;
+}
+
+/* Run FMT once, taking arguments from *ARGS.  Returns 1 when output must
+ * stop (a \c escape, or a bad directive). */
+static int printf_once(const char *fmt, char ***args) {
+    for (const char *p = fmt; *p; ) {
+        if (*p == '\\') {
+            char esc[6] = { '\\', 0 };
+            size_t n = 1;
+            /* hand one escape at a time to put_escaped */
+            esc[n++] = *++p;
+            if (*p >= '0' && *p <= '7')
+                for (int k = 0; k < 2 && p[1] >= '0' && p[1] <= '7'; ++k) esc[n++] = *++p;
+            else if (*p == 'x')
+                for (int k = 0; k < 2 && p[1] && strchr("0123456789abcdefABCDEF", p[1]); ++k) esc[n++] = *++p;
+            if (*p) p++;
+            if (put_escaped(stdout, esc, ESC_FORMAT)) return 1;
+            continue;
+        }
+        if (*p != '%') { putchar(*p++); continue; }
+        if (p[1] == '%') { putchar('%'); p += 2; continue; }
+
+        /* "%" flags width .precision, with '*' taken from the arguments */
+        char spec[64];
+        size_t n = 0;
+        const char *start = p++;
+        spec[n++] = '%';
+        while (*p && strchr("-+ #0", *p) && n < 8) spec[n++] = *p++;
+        for (int part = 0; part < 2; ++part) {
+            if (part == 1) {
+                if (*p != '.') break;
+                spec[n++] = *p++;
+            }
+            if (*p == '*') {
+                n += (size_t)snprintf(spec + n, sizeof(spec) - n - 4, "%d", (int)arg_int(**args));
+                if (**args) (*args)++;
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9' && n < 40) spec[n++] = *p++;
+            }
+        }
+        while (*p && strchr("hlLqjzt", *p)) p++;
+        int conv = *p;
+        if (!conv) { fputs(start, stdout); return 0; }
+        p++;
+        const char *arg = **args;
+        if (arg) (*args)++;
+
+        switch (conv) {
+        case 'd': case 'i':
+            memcpy(spec + n, "lld", 4);
+            printf(spec, arg_int(arg));
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            spec[n++] = 'l'; spec[n++] = 'l'; spec[n++] = (char)conv; spec[n] = '\0';
+            printf(spec, (unsigned long long)arg_int(arg));
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            spec[n++] = (char)conv; spec[n] = '\0';
+            printf(spec, arg_double(arg));
+            break;
+        case 'c':
+            memcpy(spec + n, "c", 2);
+            if (arg && *arg) printf(spec, *arg);
+            break;
+        case 's':
+            memcpy(spec + n, "s", 2);
+            printf(spec, arg ? arg : "");
+            break;
+        case 'b': {
+            /* expand into a buffer first so width and precision apply */
+            char *tmp = NULL;
+            size_t len = 0;
+            FILE *mem = open_memstream(&tmp, &len);
+            if (!mem) { perror("printf"); printf_status = 1; return 1; }
+            int stop = put_escaped(mem, arg ? arg : "", ESC_B);
+            fclose(mem);
+            memcpy(spec + n, "s", 2);
+            printf(spec, tmp);
+            free(tmp);
+            if (stop) return 1;
+            break;
+        }
+        default:
+            fprintf(stderr, "printf: %c: invalid format character\n", conv);
+            printf_status = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int coreutils_printf(char **argv) {
+    if (!argv[1]) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    printf_status = 0;
+    char **args = argv + 2;
+    while (1) {
+        char **before = args;
+        if (printf_once(argv[1], &args)) break;
+        /* reuse the format while it keeps consuming arguments */
+        if (!*args || args == before) break;
+    }
+    return printf_status;
+}
+
+/* --- test / [ --- */
+
+static char **targ;
+static int tpos, tend, terr;
+static const char *tname;
+
+static int test_error(const char *what, const char *arg) {
+    if (!terr) {
+        if (arg) fprintf(stderr, "%s: %s: %s\n", tname, arg, what);
+        else fprintf(stderr, "%s: %s\n", tname, what);
+    }
+    terr = 1;
+    return 0;
+}
+
+static int is_unary(const char *s) {
+    return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghknprstuwxzGLOS", s[1]);
+}
+
+static int is_binary(const char *s) {
+    static const char *const ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef", NULL
+    };
+    for (int i = 0; ops[i]; ++i) if (strcmp(s, ops[i]) == 0) return 1;
+    return 0;
+}
+
+static long long test_int(const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t') end++;
+    if (end == s || *end || errno) test_error("integer expression expected", s);
+    return v;
+}
+
+static int test_unary(const char *op, const char *arg) {
+    struct stat st;
+    int c = op[1];
+    if (c == 'z') return *arg == '\0';
+    if (c == 'n') return *arg != '\0';
+    if (c == 't') return isatty((int)test_int(arg));
+    if (c == 'h' || c == 'L') return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    if (c == 'r') return access(arg, R_OK) == 0;
+    if (c == 'w') return access(arg, W_OK) == 0;
+    if (c == 'x') return access(arg, X_OK) == 0;
+    if (stat(arg, &st) != 0) return 0;
+    switch (c) {
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    }
+    return 0;
+}
+
+static int mtime_cmp(const struct stat *a, const struct stat *b) {
+    if (a->st_mtim.tv_sec != b->st_mtim.tv_sec) return a->st_mtim.tv_sec < b->st_mtim.tv_sec ? -1 : 1;
+    if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec) return a->st_mtim.tv_nsec < b->st_mtim.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static int test_binary(const char *l, const char *op, const char *r) {
+    if (op[0] != '-') {
+        int c = strcmp(l, r);
+        if (op[0] == '=') return c == 0;
+        if (op[0] == '!') return c != 0;
+        return op[0] == '<' ? c < 0 : c > 0;
+    }
+    if (op[1] == 'n' && op[2] == 't') {
+        struct stat a, b;
+        if (stat(l, &a) != 0) return 0;
+        return stat(r, &b) != 0 || mtime_cmp(&a, &b) > 0;
+    }
+    if (op[1] == 'o' && op[2] == 't') {
+        struct stat a, b;
+        if (stat(r, &b) != 0) return 0;
+        return stat(l, &a) != 0 || mtime_cmp(&a, &b) < 0;
+    }
+    if (op[1] == 'e' && op[2] == 'f') {
+        struct stat a, b;
+        return stat(l, &a) == 0 && stat(r, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    }
+    long long a = test_int(l), b = test_int(r);
+    if (strcmp(op, "-eq") == 0) return a == b;
+    if (strcmp(op, "-ne") == 0) return a != b;
+    if (strcmp(op, "-lt") == 0) return a < b;
+    if (strcmp(op, "-le") == 0) return a <= b;
+    if (strcmp(op, "-gt") == 0) return a > b;
+    return a >= b;
+}
+
+static int test_or(void);
+
+static int test_primary(void) {
+    if (tpos >= tend) return test_error("argument expected", NULL);
+    const char *a = targ[tpos];
+    if (strcmp(a, "(") == 0) {
+        tpos++;
+        int v = test_or();
+        if (tpos >= tend || strcmp(targ[tpos], ")") != 0) return test_error("`)' expected", NULL);
+        tpos++;
+        return v;
+    }
+    if (tpos + 2 < tend && is_binary(targ[tpos + 1])) {
+        tpos += 3;
+        return test_binary(a, targ[tpos - 2], targ[tpos - 1]);
+    }
+    if (is_unary(a) && tpos + 1 < tend) {
+        tpos += 2;
+        return test_unary(a, targ[tpos - 1]);
+    }
+    tpos++;
+    return *a != '\0';
+}
+
+static int test_not(void) {
+    if (tpos < tend && strcmp(targ[tpos], "!") == 0) { tpos++; return !test_not(); }
+    return test_primary();
+}
+
+static int test_and(void) {
+    int v = test_not();
+    while (tpos < tend && strcmp(targ[tpos], "-a") == 0) { tpos++; v = test_not() && v; }
+    return v;
+}
+
+static int test_or(void) {
+    int v = test_and();
+    while (tpos < tend && strcmp(targ[tpos], "-o") == 0) { tpos++; v = test_and() || v; }
+    return v;
+}
+
+/* POSIX gives fixed meanings to 0-4 arguments, which settles cases like
+ * `test -n` or `test ! = x` that a grammar would misread. */
+static int test_count(int n) {
+    char **a = targ + tpos;
+    switch (n) {
+    case 0: return 0;
+    case 1: tpos++; return *a[0] != '\0';
+    case 2:
+        if (strcmp(a[0], "!") == 0) { tpos += 2; return *a[1] == '\0'; }
+        if (is_unary(a[0])) { tpos += 2; return test_unary(a[0], a[1]); }
+        break;
+    case 3:
+        if (is_binary(a[1])) { tpos += 3; return test_binary(a[0], a[1], a[2]); }
+        if (strcmp(a[0], "!") == 0) { tpos++; return !test_count(2); }
+        if (strcmp(a[0], "(") == 0 && strcmp(a[2], ")") == 0) { tpos += 3; return *a[1] != '\0'; }
+        break;
+    case 4:
+        if (strcmp(a[0], "!") == 0) { tpos++; return !test_count(3); }
+        if (strcmp(a[0], "(") == 0 && strcmp(a[3], ")") == 0) {
+            tpos++;
+            int v = test_count(2);
+            tpos++;
+            return v;
+        }
+        break;
+    }
+    return test_or();
+}
+
+int coreutils_test(char **argv) {
+    int n = 0;
+    while (argv[n]) n++;
+    tname = argv[0];
+    if (strcmp(argv[0], "[") == 0) {
+        if (n < 2 || strcmp(argv[n - 1], "]") != 0) {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        n--;
+    }
+    targ = argv;
+    tpos = 1;
+    tend = n;
+    terr = 0;
+    int v = test_count(n - 1);
+    if (!terr && tpos < tend) test_error("too many arguments", NULL);
+    return terr ? 2 : !v;
+}
+
+/* --- cat --- */
+
+#define CAT_CHUNK ((size_t)1 << 30)     /* per kernel call; the kernel may move less */
+
+/* Copy with one kernel mechanism until EOF.  Returns 0 at EOF, -1 on an
+ * error, or 1 if the call is not supported for this pair of files before
+ * anything moved (the caller then tries the next one). */
+static int cat_kernel(int in, int out, int how) {
+    for (int moved = 0; ; moved = 1) {
+        ssize_t n;
+        if (how == 0) n = copy_file_range(in, NULL, out, NULL, CAT_CHUNK, 0);
+        else if (how == 1) n = splice(in, NULL, out, NULL, CAT_CHUNK, SPLICE_F_MOVE);
+        else n = sendfile(out, in, NULL, CAT_CHUNK);
+        if (n > 0) continue;
+        if (n == 0) return 0;
+        if (errno == EINTR || errno == EAGAIN) continue;
+        if (!moved && (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+            return 1;
+        return -1;
+    }
+}
+
+static int cat_copy(int in, int out, const struct stat *si, const struct stat *so) {
+    int r = 1;
+    if (S_ISREG(si->st_mode) && S_ISREG(so->st_mode)) r = cat_kernel(in, out, 0);
+    if (r == 1 && (S_ISFIFO(si->st_mode) || S_ISFIFO(so->st_mode))) r = cat_kernel(in, out, 1);
+    if (r == 1 && S_ISREG(si->st_mode)) r = cat_kernel(in, out, 2);
+    if (r != 1) return r;
+
+    static char buf[128 * 1024];
+    while (1) {
+        ssize_t n = read(in, buf, sizeof(buf));
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        if (n == 0) return 0;
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = write(out, buf + off, (size_t)(n - off));
+            if (w < 0) { if (errno == EINTR) continue; return -1; }
+            off += w;
+        }
+    }
+}
+
+int coreutils_cat_plain(char **argv) {
+    for (int i = 1; argv[i]; ++i) {
+        if (strcmp(argv[i], "--") == 0) return 1;
+        if (argv[i][0] == '-' && argv[i][1] && strcmp(argv[i], "-u") != 0) return 0;
+    }
+    return 1;
+}
+
+int coreutils_cat(char **argv) {
+    int st = 0, i = 1, any = 0, opts = 1;
+    struct stat so;
+    fflush(stdout);
+    if (fstat(STDOUT_FILENO, &so) < 0) { perror("cat: stdout"); return 1; }
+    for (; argv[i] || !any; ++i) {
+        const char *name = argv[i] ? argv[i] : "-";
+        if (opts && argv[i] && strcmp(name, "--") == 0) { opts = 0; continue; }
+        if (opts && argv[i] && strcmp(name, "-u") == 0) continue;
+        any = 1;
+        int in = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+        struct stat si;
+        if (in < 0 || fstat(in, &si) < 0) {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            st = 1;
+        } else if (S_ISDIR(si.st_mode)) {
+            fprintf(stderr, "cat: %s: Is a directory\n", name);
+            st = 1;
+        } else if (S_ISREG(si.st_mode) && si.st_dev == so.st_dev && si.st_ino == so.st_ino && si.st_size > 0) {
+            fprintf(stderr, "cat: %s: input file is output file\n", name);
+            st = 1;
+        } else if (cat_copy(in, STDOUT_FILENO, &si, &so) < 0) {
+            int e = errno;
+            if (e == EPIPE) { if (in > STDIN_FILENO) close(in); return 1; }
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(e));
+            st = 1;
+        }
+        if (in > STDIN_FILENO) close(in);
+        if (!argv[i]) break;
+    }
+    return st;
+}
+
+/* --- true / false --- */
+
+int coreutils_true(char **argv) { (void)argv; return 0; }
+int coreutils_false(char **argv) { (void)argv; return 1; }
@@ -2,18 +2,52 @@
  * myshell_no_readline.c -- Advanced POSIX-style shell (NO READLINE)
  *
  * Converted from a readline-based version to use getline().
- * - Persistent history file (~/.myshell_history) via simple append.
+ * - Persistent history file (~/.myshell_history) via simple append; a background
+ *   child dedupes and trims it once it passes 1 MiB (src/history.c).
+ * - Command lists: `;`, `&`, `&&` and `||` with short-circuit evaluation.
+ * - Hot paths feed counters and latency histograms (src/stats.c), shown by
+ *   `shellstats` and optionally dumped periodically ($MYSHELL_STATS_DUMP).
+ * - `time pipeline` reports per-stage wall/CPU/RSS/context switches (wait4) and
+ *   the shell's own parse/expand/spawn time.
  * - Keeps variable expansion, command substitution, pipes, redirection,
- *   job control, builtins (cd, exit, pwd, mkdir, touch, history, jobs, fg, bg, kill).
+ *   job control, builtins (cd, exit, pwd, mkdir, touch, history, jobs, fg, bg, kill, wait, hash,
+ *   launcher, memstats, parallel, shellstats, export, unset, coproc, cowrite, coread;
+ *   echo, printf, test/[, cat, true, false from src/coreutils.c).
+ * - An in-shell `cat` copies with copy_file_range/splice/sendfile, so
+ *   `cat big > copy` or `cmd < in | cat > out` costs no fork and no user-space copy.
+ * - Here-documents (<<, <<-) and here-strings (<<<) reach the command's stdin
+ *   through a pipe or memfd, never a temp file; unquoted bodies are expanded.
+ * - Shell variables live in a hash table (src/vars.c): NAME=value, `export`,
+ *   `unset`, $? and $$; `NAME=value cmd` sets NAME for cmd alone.
+ * - `place -c CPUS -n INC -i CLASS -g CGROUP -m MEM -q PCT pipeline` sets affinity,
+ *   niceness, I/O class and a cgroup v2 group with limits in each forked stage
+ *   before exec (src/place.c); `jobs` shows the placement.
+ * - `coproc [-n NAME] cmd` keeps one process on two pipes as a job; `cowrite` and
+ *   `coread VAR` send it a line and read its reply, with no fork per request.
+ * - Parse/expand memory comes from arenas (src/arena.c), reset once per command.
+ * - Unquoted *, ? and [...] expand to sorted pathnames (src/pathglob.c).
+ * - Command lookups go through the shared PATH hash (src/pathcache.c).
+ * - SIGCHLD is read from a signalfd in the REPL's poll loop; children are reaped
+ *   there in batches and job reports print before the next prompt.
+ * - Prompt from $MYSHELL_PS1 (PS1-style escapes, async $(cmd)), see src/prompt.c.
+ * - Lines are edited with src/lineedit.c: history, Ctrl-R, and Tab completion of
+ *   builtins, $PATH commands and paths (src/complete.c).
+ *
+ * - `myshell script`, `myshell -c 'cmd'` and piped input run without prompt,
+ *   history or job control, and exit with the last command's status.
+ * - `myshell --server [-j N] [socket]` keeps a warm, pre-forked shell on a unix
+ *   socket (src/server.c); with $MYSHELL_SERVER set, -c and script runs are
+ *   handed to it, fds and all, and run locally only if nobody answers.
  *
  * Compile:
- *   gcc -std=gnu11 -Wall -Wextra -o myshell_no_readline myshell_no_readline.c
+ *   make myshell
  *
  * Author: ChatGPT (modified to remove readline)
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <sys/stat.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,496 +60,2135 @@
 #include <ctype.h>
 #include <pwd.h>
 #include <stdint.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <time.h>
+
+#include "arena.h"
+#include "complete.h"
+#include "coreutils.h"
+#include "history.h"
+#include "histsearch.h"
+#include "lineedit.h"
+#include "pathcache.h"
+#include "pathglob.h"
+#include "place.h"
+#include "prompt.h"
+#include "server.h"
+#include "stats.h"
+#include "vars.h"
 
-#define MAX_TOKENS 512
-#define MAX_JOBS 128
 #define HISTORY_FILE ".myshell_history"
-#define HISTORY_MAX 50000
 #define MAX_LINE_LEN 16384
 
 typedef enum { JOB_RUNNING, JOB_STOPPED, JOB_DONE } job_state_t;
 
+struct job;
+
+typedef struct job_proc {
+    pid_t pid;
+    int stage;              /* index of its command in the pipeline */
+    int live;               /* not reaped yet */
+    struct job *job;
+    struct job_proc *hnext; /* pid index chain */
+    struct rusage ru;       /* from wait4() once reaped */
+    int64_t end_ns;         /* when it was reaped */
+} job_proc_t;
+
 typedef struct job {
-    int id;
+    int id;                 /* 0 until backgrounded or stopped */
     pid_t pgid;
     char *cmdline;
+    char *place;            /* placement shown by `jobs`, or NULL */
     job_state_t state;
+    job_proc_t *procs;      /* one per stage */
+    int nprocs, nlive;
+    int status;             /* wait status of the last stage */
+    int foreground;         /* being waited for by wait_for_job() */
+    int notify;             /* queued for notify_jobs() */
+    struct job *notify_next;
+    struct job *pgid_next;  /* pgid index chain */
 } job_t;
 
-static job_t jobs[MAX_JOBS];
-static int next_job_id = 1;
+static job_t **job_ids;     /* job number -> job, up to max_job_id */
+static size_t job_ids_cap;
+static int max_job_id;
+static job_t *current_job;  /* "+" job, target of a bare fg/bg */
+static job_proc_t **pid_buckets;
+static size_t pid_nbuckets, pid_count;
+static job_t **pgid_buckets;
+static size_t pgid_nbuckets;
+static job_t *notify_head, *notify_tail;
 static int job_count = 0;
+static int last_status;     /* exit status of the last command line */
 
 static pid_t shell_pgid;
+static pid_t shell_pid;    /* $$: the shell itself, also in its subshells */
 static int shell_terminal;
+static struct termios shell_tmodes;   /* cooked modes, restored before every command */
+/* Interactive: prompt, history and job control on a terminal.  Scripts,
+ * -c and piped input run without them, and their children stay in the
+ * shell's own process group. */
+static int interactive;
+
+extern char **environ;
 
 /* history */
-static char *history_arr[HISTORY_MAX];
-static int history_count = 0;
 static char histpath_global[4096] = {0};
 
 /* forward */
 static void init_shell(void);
-static void sigchld_handler(int sig);
 static void install_signal_handlers(void);
 static char *run_command_capture(const char *cmd);
-static char *expand_variables_and_subst(const char *input);
-static char **tokenize(const char *s, int *argc_out);
-static int is_builtin(const char *cmd);
-static int run_builtin(char **argv);
-static int execute_pipeline(char **cmds, int ncmds, const char *fullcmd, int background);
-static void add_job(pid_t pgid, const char *cmdline, job_state_t state);
-static job_t *find_job_by_pgid(pid_t pgid);
+static int launcher_builtin(char **argv);
+static int memstats_builtin(void);
+static job_t *add_job(pid_t pgid, const char *cmdline, job_state_t state, const pid_t *pids, int npids);
 static job_t *find_job_by_id(int id);
+static job_t *job_from_spec(const char *spec);
 static void remove_job(job_t *j);
 static void print_jobs(void);
+static int bi_parallel(char **argv);
+static int bi_coproc(char **argv);
+static int bi_cowrite(char **argv);
+static int bi_coread(char **argv);
 
 /* helpers */
 static char *xstrdup(const char *s) { if (!s) return NULL; return strdup(s); }
 
-/* --- History helpers --- */
-static void load_history_file(const char *histpath) {
-    FILE *f = fopen(histpath, "r");
-    if (!f) return;
-    char *line = NULL;
-    size_t n = 0;
-    while (getline(&line, &n, f) != -1) {
-        // strip newline
-        size_t L = strlen(line);
-        if (L && (line[L-1]=='\n' || line[L-1]=='\r')) line[L-1] = '\0';
-        if (history_count < HISTORY_MAX) history_arr[history_count++] = strdup(line);
-    }
-    free(line);
-    fclose(f);
-}
-static void append_history_file(const char *histpath, const char *line) {
-    FILE *f = fopen(histpath, "a");
-    if (!f) return;
-    fprintf(f, "%s\n", line);
-    fclose(f);
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
+
+/* --- History helpers --- */
 static void add_history_inmem_and_file(const char *line) {
     if (!line || !*line) return;
-    if (history_count < HISTORY_MAX) history_arr[history_count++] = strdup(line);
-    else {
-        // rotate: free oldest, move everything left by one (rare)
-        free(history_arr[0]);
-        memmove(history_arr, history_arr+1, sizeof(char*)*(HISTORY_MAX-1));
-        history_arr[HISTORY_MAX-1] = strdup(line);
-    }
-    if (histpath_global[0]) append_history_file(histpath_global, line);
+    uint64_t t0 = stats_now();
+    history_add(line);
+    histsearch_add(line);
+    history_save(line);
+    stats_since(STAT_HISTORY, t0);
 }
 
 /* --- Job management --- */
-static void add_job(pid_t pgid, const char *cmdline, job_state_t state) {
-    for (int i = 0; i < MAX_JOBS; ++i) {
-        if (jobs[i].id == 0) {
-            jobs[i].id = next_job_id++;
-            jobs[i].pgid = pgid;
-            jobs[i].cmdline = xstrdup(cmdline);
-            jobs[i].state = state;
-            job_count++;
-            return;
+/* Every launched pipeline gets a job_t, foreground ones included, so exit
+ * statuses always land in one place.  A job only takes a job number when
+ * it is put in the background or stopped.
+ *
+ * Jobs are indexed three ways, all O(1): job_ids[] by number, and two
+ * chained hash tables for pgid -> job and pid -> stage (one job_proc_t per
+ * process, so reaping a child touches only its own entry).  State changes
+ * that need reporting are queued for notify_jobs(). */
+static uint32_t pid_hash(pid_t p) { return (uint32_t)p * 2654435761u; }
+
+static void pid_index_grow(void) {
+    size_t nb = pid_nbuckets ? pid_nbuckets * 2 : 64;
+    job_proc_t **nt = calloc(nb, sizeof(*nt));
+    if (!nt) return;
+    for (size_t b = 0; b < pid_nbuckets; ++b)
+        for (job_proc_t *p = pid_buckets[b], *n; p; p = n) {
+            n = p->hnext;
+            p->hnext = nt[pid_hash(p->pid) & (nb - 1)];
+            nt[pid_hash(p->pid) & (nb - 1)] = p;
+        }
+    free(pid_buckets);
+    pid_buckets = nt;
+    pid_nbuckets = nb;
+}
+
+static void pgid_index_grow(void) {
+    size_t nb = pgid_nbuckets ? pgid_nbuckets * 2 : 64;
+    job_t **nt = calloc(nb, sizeof(*nt));
+    if (!nt) return;
+    for (size_t b = 0; b < pgid_nbuckets; ++b)
+        for (job_t *j = pgid_buckets[b], *n; j; j = n) {
+            n = j->pgid_next;
+            j->pgid_next = nt[pid_hash(j->pgid) & (nb - 1)];
+            nt[pid_hash(j->pgid) & (nb - 1)] = j;
         }
+    free(pgid_buckets);
+    pgid_buckets = nt;
+    pgid_nbuckets = nb;
+}
+
+static void pid_index_remove(job_proc_t *p) {
+    job_proc_t **pp = &pid_buckets[pid_hash(p->pid) & (pid_nbuckets - 1)];
+    while (*pp && *pp != p) pp = &(*pp)->hnext;
+    if (*pp) { *pp = p->hnext; pid_count--; }
+}
+
+static job_t *add_job(pid_t pgid, const char *cmdline, job_state_t state, const pid_t *pids, int npids) {
+    if (pid_count + npids > pid_nbuckets) pid_index_grow();
+    if (job_count + 1 > (int)pgid_nbuckets) pgid_index_grow();
+    job_t *j = calloc(1, sizeof(*j));
+    if (j) j->procs = calloc(npids ? npids : 1, sizeof(job_proc_t));
+    if (!j || !j->procs || !pid_nbuckets || !pgid_nbuckets) { perror("jobs"); if (j) free(j->procs); free(j); return NULL; }
+    for (int k = 0; k < npids; ++k) {
+        job_proc_t *p = &j->procs[k];
+        p->pid = pids[k];
+        p->job = j;
+        p->live = 1;
+        size_t b = pid_hash(p->pid) & (pid_nbuckets - 1);
+        p->hnext = pid_buckets[b];
+        pid_buckets[b] = p;
+        pid_count++;
     }
-    fprintf(stderr, "jobs: table full\n");
+    j->nprocs = j->nlive = npids;
+    j->pgid = pgid;
+    j->cmdline = xstrdup(cmdline);
+    j->state = state;
+    size_t b = pid_hash(pgid) & (pgid_nbuckets - 1);
+    j->pgid_next = pgid_buckets[b];
+    pgid_buckets[b] = j;
+    job_count++;
+    return j;
 }
 
+/* Give J the next number (one past the highest in use, as other shells
+ * do) and make it the current job for a bare fg/bg. */
+static void number_job(job_t *j) {
+    if (!j->id) {
+        int id = max_job_id + 1;
+        if ((size_t)id >= job_ids_cap) {
+            size_t nc = job_ids_cap ? job_ids_cap * 2 : 64;
+            job_t **ni = realloc(job_ids, nc * sizeof(*ni));
+            if (!ni) { perror("jobs"); return; }
+            memset(ni + job_ids_cap, 0, (nc - job_ids_cap) * sizeof(*ni));
+            job_ids = ni;
+            job_ids_cap = nc;
+        }
+        j->id = id;
+        job_ids[id] = j;
+        max_job_id = id;
+    }
+    current_job = j;
+}
+
+static job_t *find_job_by_id(int id) {
+    return id > 0 && id <= max_job_id ? job_ids[id] : NULL;
+}
 static job_t *find_job_by_pgid(pid_t pgid) {
-    for (int i = 0; i < MAX_JOBS; ++i) if (jobs[i].id && jobs[i].pgid == pgid) return &jobs[i];
+    if (!pgid_nbuckets) return NULL;
+    for (job_t *j = pgid_buckets[pid_hash(pgid) & (pgid_nbuckets - 1)]; j; j = j->pgid_next)
+        if (j->pgid == pgid) return j;
     return NULL;
 }
-static job_t *find_job_by_id(int id) {
-    for (int i = 0; i < MAX_JOBS; ++i) if (jobs[i].id == id) return &jobs[i];
+/* "%N" or "N" names job N; failing that, a bare number may be a pgid. */
+static job_t *job_from_spec(const char *spec) {
+    int pct = spec[0] == '%';
+    char *end;
+    long n = strtol(spec + pct, &end, 10);
+    if (end == spec + pct || *end || n <= 0 || n > INT32_MAX) return NULL;
+    job_t *j = find_job_by_id((int)n);
+    if (!j && !pct) j = find_job_by_pgid((pid_t)n);
+    return j;
+}
+static job_proc_t *find_proc(pid_t pid) {
+    if (!pid_nbuckets) return NULL;
+    for (job_proc_t *p = pid_buckets[pid_hash(pid) & (pid_nbuckets - 1)]; p; p = p->hnext)
+        if (p->pid == pid) return p;
     return NULL;
 }
+
+static void queue_notify(job_t *j) {
+    if (j->notify) return;
+    j->notify = 1;
+    j->notify_next = NULL;
+    if (notify_tail) notify_tail->notify_next = j; else notify_head = j;
+    notify_tail = j;
+}
+
 static void remove_job(job_t *j) {
     if (!j) return;
+    if (j->notify) {   /* rare: dropped before its report was printed */
+        job_t **pp = &notify_head, *prev = NULL;
+        while (*pp && *pp != j) { prev = *pp; pp = &(*pp)->notify_next; }
+        if (*pp) { *pp = j->notify_next; if (notify_tail == j) notify_tail = prev; }
+    }
+    for (int k = 0; k < j->nprocs; ++k) if (j->procs[k].live) pid_index_remove(&j->procs[k]);
+    job_t **pp = &pgid_buckets[pid_hash(j->pgid) & (pgid_nbuckets - 1)];
+    while (*pp && *pp != j) pp = &(*pp)->pgid_next;
+    if (*pp) *pp = j->pgid_next;
+    if (j->id) {
+        job_ids[j->id] = NULL;
+        while (max_job_id > 0 && !job_ids[max_job_id]) max_job_id--;
+    }
+    if (current_job == j) current_job = max_job_id ? job_ids[max_job_id] : NULL;
     free(j->cmdline);
-    j->cmdline = NULL;
-    j->id = 0;
-    j->pgid = 0;
-    j->state = JOB_DONE;
+    free(j->place);
+    free(j->procs);
+    free(j);
     job_count--;
 }
 static void print_jobs(void) {
-    for (int i = 0; i < MAX_JOBS; ++i) {
-        if (jobs[i].id) {
-            printf("[%d] %d ", jobs[i].id, (int)jobs[i].pgid);
-            if (jobs[i].state == JOB_RUNNING) printf("Running ");
-            else if (jobs[i].state == JOB_STOPPED) printf("Stopped ");
-            else printf("Done ");
-            printf("%s\n", jobs[i].cmdline);
+    for (int id = 1; id <= max_job_id; ++id) {
+        job_t *j = job_ids[id];
+        if (!j) continue;
+        printf("[%d]%c %d ", j->id, j == current_job ? '+' : ' ', (int)j->pgid);
+        if (j->state == JOB_RUNNING) printf("Running ");
+        else if (j->state == JOB_STOPPED) printf("Stopped ");
+        else printf("Done ");
+        printf("%s", j->cmdline);
+        if (j->place) printf("  [%s]", j->place);
+        printf("\n");
+    }
+}
+
+/* Exit status as the shell reports it: 128+N for death by signal N. */
+static int wait_status_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+/* Record a wait status (and, for an exit, its rusage) for PID.  Only ever
+ * called from the main loop. */
+static void job_update(pid_t pid, int status, const struct rusage *ru) {
+    job_proc_t *p = find_proc(pid);
+    if (!p) return;
+    job_t *j = p->job;
+    if (WIFSTOPPED(status)) {
+        j->state = JOB_STOPPED;
+        number_job(j);
+        queue_notify(j);
+    } else if (WIFCONTINUED(status)) {
+        j->state = JOB_RUNNING;
+    } else {
+        p->live = 0;
+        if (ru) p->ru = *ru;
+        p->end_ns = now_ns();
+        pid_index_remove(p);
+        if (p == &j->procs[j->nprocs - 1]) j->status = status;   /* the pipeline's status is its last stage's */
+        if (--j->nlive == 0) {
+            j->state = JOB_DONE;
+            /* the foreground waiter disposes of its own job */
+            if (j->id && !j->foreground) queue_notify(j);
         }
     }
 }
 
-/* --- Signal handling --- */
-static void sigchld_handler(int sig) {
-    (void)sig;
+/* Collect every child that changed state, in one batch. */
+static void reap_children(void) {
     int status;
+    struct rusage ru;
     pid_t pid;
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-        pid_t pgid = getpgid(pid);
-        job_t *j = find_job_by_pgid(pgid);
-        if (!j) continue;
-        if (WIFSTOPPED(status)) {
-            j->state = JOB_STOPPED;
-            fprintf(stderr, "\n[%d]+ Stopped\t%s\n", j->id, j->cmdline);
-        } else if (WIFCONTINUED(status)) {
-            j->state = JOB_RUNNING;
-        } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
-            j->state = JOB_DONE;
-            fprintf(stderr, "\n[%d]+ Done\t%s\n", j->id, j->cmdline);
-            remove_job(j);
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) job_update(pid, status, &ru);
+}
+
+/* Block until foreground job J finishes or stops.  Other jobs' children
+ * are left for reap_children(). */
+static void wait_for_job(job_t *j) {
+    uint64_t t0 = stats_now();
+    j->foreground = 1;
+    while (j->nlive > 0 && j->state != JOB_STOPPED) {
+        int status;
+        struct rusage ru;
+        pid_t pid = wait4(interactive ? -j->pgid : -1, &status, WUNTRACED, &ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
         }
+        job_update(pid, status, &ru);
+    }
+    j->foreground = 0;
+    stats_since(STAT_WAIT, t0);
+}
+
+/* Signal every process in J.  Without job control its stages share the
+ * shell's process group, so they are signalled one by one. */
+static int job_kill(job_t *j, int sig) {
+    if (interactive) return kill(-j->pgid, sig);
+    int rc = 0;
+    for (int i = 0; i < j->nprocs; ++i)
+        if (j->procs[i].live && kill(j->procs[i].pid, sig) < 0) rc = -1;
+    return rc;
+}
+
+/* Report finished and stopped jobs; called just before the prompt.  Without
+ * a terminal the reports are dropped but done jobs are still freed. */
+static void notify_jobs(void) {
+    while (notify_head) {
+        job_t *j = notify_head;
+        notify_head = j->notify_next;
+        if (!notify_head) notify_tail = NULL;
+        j->notify = 0;
+        if (interactive)
+            fprintf(stderr, "[%d]%c %s\t%s\n", j->id, j == current_job ? '+' : '-',
+                    j->state == JOB_STOPPED ? "Stopped" : "Done", j->cmdline);
+        if (j->state == JOB_DONE) remove_job(j);
     }
 }
 
-static void sigint_handler(int sig) { (void)sig; /* shell ignores; children receive */ }
-static void sigtstp_handler(int sig) { (void)sig; }
+/* --- Signal handling --- */
+/* SIGCHLD stays blocked and arrives through a signalfd polled by the REPL,
+ * so no job state is touched from signal context. */
+static int sigchld_fd = -1;
+
+static void drain_sigchld_fd(void) {
+    struct signalfd_siginfo si[16];
+    while (read(sigchld_fd, si, sizeof(si)) > 0) ;
+}
+
+/* Wait up to MS (-1: forever) for FD to be readable, for builtins that
+ * block in the shell (wait, coread).  Returns 1 when it is, 0 on timeout,
+ * -1 on Ctrl-C: the shell ignores SIGINT, so in here it is blocked, which
+ * keeps it pending, and taken from a signalfd. */
+static int wait_readable(int fd, int ms) {
+    static int intfd = -1;
+    sigset_t intr, old;
+    sigemptyset(&intr);
+    sigaddset(&intr, SIGINT);
+    if (interactive && intfd < 0) intfd = signalfd(-1, &intr, SFD_CLOEXEC | SFD_NONBLOCK);
+    struct pollfd pf[2] = { { fd, POLLIN, 0 }, { interactive ? intfd : -1, POLLIN, 0 } };
+    if (pf[1].fd >= 0) sigprocmask(SIG_BLOCK, &intr, &old);
+    int r;
+    while ((r = poll(pf, 2, ms)) < 0 && errno == EINTR) ;
+    int hit = pf[1].fd >= 0 && (pf[1].revents & POLLIN);
+    if (pf[1].fd >= 0) {
+        struct signalfd_siginfo si;
+        while (read(intfd, &si, sizeof(si)) > 0) ;
+        sigprocmask(SIG_SETMASK, &old, NULL);
+    }
+    if (hit) return -1;
+    return r > 0;
+}
 
 static void install_signal_handlers(void) {
-    struct sigaction sa;
-    sa.sa_handler = sigchld_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-    sigaction(SIGCHLD, &sa, NULL);
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+    sigchld_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd < 0) perror("signalfd");   /* children are still reaped at each prompt */
 
     signal(SIGINT, SIG_IGN);   /* shell ignores Ctrl-C */
     signal(SIGTSTP, SIG_IGN);  /* shell ignores Ctrl-Z */
 }
 
-/* --- Helpers: run command capture (for command substitution) --- */
-static char *run_command_capture(const char *cmd) {
-    FILE *fp = popen(cmd, "r");
-    if (!fp) return xstrdup("");
-    size_t cap = 4096;
-    char *out = malloc(cap);
-    size_t len = 0;
+/* --- Input: one read() buffer, drained a line at a time --- */
+static char *in_buf;
+static size_t in_len, in_cap, in_off;
+static int input_fd = STDIN_FILENO;   /* script file; -1 once -c text is loaded */
+
+/* Next line of script or -c input without its newline, or NULL at end of
+ * input.  Scripts are read in 64 KiB blocks; as in dash, a script on stdin
+ * is therefore not left for the commands it runs to read. */
+static char *read_command_line(void) {
     while (1) {
-        if (len + 1024 >= cap) { cap *= 2; out = realloc(out, cap); }
-        size_t r = fread(out + len, 1, 1024, fp);
-        if (r == 0) break;
-        len += r;
+        char *nl = in_off < in_len ? memchr(in_buf + in_off, '\n', in_len - in_off) : NULL;
+        if (nl) {
+            *nl = '\0';
+            char *line = in_buf + in_off;
+            in_off = (size_t)(nl - in_buf) + 1;
+            return line;
+        }
+        /* slide the partial line to the front and make room */
+        if (in_off) { memmove(in_buf, in_buf + in_off, in_len - in_off); in_len -= in_off; in_off = 0; }
+        size_t room = 65536;
+        if (in_cap - in_len < room) {
+            size_t nc = in_cap ? in_cap : 4096;
+            while (nc - in_len < room) nc *= 2;
+            char *nb = realloc(in_buf, nc);
+            if (!nb) { perror("realloc"); return NULL; }
+            in_buf = nb;
+            in_cap = nc;
+        }
+
+        uint64_t t0 = stats_now();
+        ssize_t r = input_fd >= 0 ? read(input_fd, in_buf + in_len, in_cap - in_len - 1) : 0;
+        stats_since(STAT_READ, t0);
+        if (r < 0) { if (errno == EINTR || errno == EAGAIN) continue; perror("read"); return NULL; }
+        if (r == 0) {
+            if (in_len == 0) return NULL;
+            in_buf[in_len] = '\0';     /* last line without a newline */
+            in_off = in_len;
+            return in_buf;
+        }
+        in_len += (size_t)r;
     }
-    if (len==0) out[0]='\0'; else out[len]='\0';
-    pclose(fp);
-    while (len>0 && (out[len-1]=='\n' || out[len-1]=='\r')) { out[len-1]='\0'; len--; }
-    return out;
 }
 
-/* Expand $VAR ${VAR} and simple command substitution $(...) and `...` (single-pass). */
-static char *expand_variables_and_subst(const char *input) {
-    size_t cap = strlen(input) + 1;
-    char *out = malloc(cap);
-    size_t oi = 0;
-    for (size_t i = 0; input[i]; ++i) {
-        if (input[i] == '\\') {
-            if (input[i+1]) { if (oi+2>cap) { cap*=2; out=realloc(out,cap);} out[oi++]=input[i+1]; i++; }
-        } else if (input[i] == '\'') {
-            ++i;
-            while (input[i] && input[i] != '\'') {
-                if (oi+2>cap){cap*=2; out=realloc(out,cap);} out[oi++]=input[i++];
-            }
-            // closing quote skip handled by loop
-        } else if (input[i]=='"') {
-            ++i;
-            while (input[i] && input[i] != '"') {
-                if (input[i] == '$') {
-                    size_t j = i+1;
-                    if (input[j]=='{') { j++; size_t start=j; while (input[j] && input[j] != '}') j++; char *name = strndup(input+start, j-start); char *val = getenv(name); free(name); if (!val) val=""; size_t L=strlen(val); if (oi+L+1>cap){cap=cap+L+1024; out=realloc(out,cap);} memcpy(out+oi, val, L); oi+=L; if (input[j]=='}') i=j; else i=j-1; }
-                    else { size_t start=j; while (input[j] && (isalnum((unsigned char)input[j]) || input[j]=='_')) j++; char *name = strndup(input+start, j-start); char *val = getenv(name); free(name); if (!val) val=""; size_t L=strlen(val); if (oi+L+1>cap){cap=cap+L+1024; out=realloc(out,cap);} memcpy(out+oi, val, L); oi+=L; i=j-1; }
-                } else if (input[i]=='$' && input[i+1]=='(') {
-                    size_t j=i+2; int depth=1;
-                    while (input[j] && depth>0) { if (input[j]=='(') depth++; else if (input[j]==')') depth--; j++; }
-                    char *inner = strndup(input + i + 2, j - (i+2) - 1 + 1);
-                    char *res = run_command_capture(inner);
-                    free(inner);
-                    size_t L=strlen(res);
-                    if (oi+L+1>cap){cap=cap+L+1024; out=realloc(out,cap);} memcpy(out+oi,res,L); oi+=L; free(res);
-                    i = j-1;
-                } else if (input[i]=='`') {
-                    size_t j=i+1; while (input[j] && input[j] != '`') j++;
-                    char *inner = strndup(input+i+1, j - (i+1));
-                    char *res = run_command_capture(inner);
-                    free(inner);
-                    size_t L=strlen(res);
-                    if (oi+L+1>cap){cap=cap+L+1024; out=realloc(out,cap);} memcpy(out+oi,res,L); oi+=L; free(res);
-                    i = (input[j] ? j : j-1);
-                } else {
-                    if (oi+2>cap){cap*=2; out=realloc(out,cap);} out[oi++]=input[i++];
-                    i--;
-                }
-            }
-        } else if (input[i] == '$') {
-            if (input[i+1] == '{') {
-                size_t j = i+2; while (input[j] && input[j] != '}') j++; char *name = strndup(input+i+2, j-(i+2)); char *val = getenv(name); free(name); if (!val) val=""; size_t L=strlen(val); if (oi+L+1>cap){cap=cap+L+1024; out=realloc(out,cap);} memcpy(out+oi, val, L); oi+=L; i = (input[j] ? j : j-1);
-            } else if (input[i+1] == '(') {
-                size_t j=i+2; int depth=1; while (input[j] && depth>0) { if (input[j]=='(') depth++; else if (input[j]==')') depth--; j++; }
-                char *inner = strndup(input + i + 2, j - (i+2) - 1 + 1);
-                char *res = run_command_capture(inner);
-                free(inner);
-                size_t L = strlen(res);
-                if (oi+L+1>cap){cap=cap+L+1024; out=realloc(out,cap);} memcpy(out+oi,res,L); oi+=L; free(res);
-                i = j-1;
-            } else {
-                size_t j = i+1; while (input[j] && (isalnum((unsigned char)input[j]) || input[j]=='_')) j++;
-                if (j == i+1) { out[oi++]='$'; } else {
-                    char *name = strndup(input+i+1, j-(i+1)); char *val = getenv(name); free(name); if (!val) val=""; size_t L=strlen(val); if (oi+L+1>cap){cap=cap+L+1024; out=realloc(out,cap);} memcpy(out+oi,val,L); oi+=L; i=j-1;
-                }
+/* Interactively: in raw mode (so the first key already reaches the
+ * editor), reap children that change state until a key arrives (their
+ * reports wait for the next prompt) and run due stats dumps; then edit the
+ * line with history, Ctrl-R and Tab completion (see src/lineedit.c).  The
+ * terminal is back in cooked mode before anything runs. */
+static char *read_interactive_line(void) {
+    struct termios raw = shell_tmodes;
+    raw.c_lflag &= ~(tcflag_t)(ECHO | ICANON);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(shell_terminal, TCSADRAIN, &raw);
+    char *line = NULL;
+    while (!lineedit_pending()) {
+        struct pollfd pfd[2] = { { STDIN_FILENO, POLLIN, 0 }, { sigchld_fd, POLLIN, 0 } };
+        int n = poll(pfd, sigchld_fd >= 0 ? 2 : 1, stats_dump_timeout());
+        if (n < 0) { if (errno == EINTR) continue; perror("poll"); goto out; }
+        if (n == 0) { stats_tick(); continue; }
+        if (pfd[1].revents & POLLIN) { drain_sigchld_fd(); reap_children(); }
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) break;
+    }
+    line = lineedit_read();
+out:
+    tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
+    return line;
+}
+
+/* --- Parser: raw line -> pipeline_t, built once and cached by raw text --- */
+
+typedef enum { PART_LIT, PART_VAR, PART_SUBST } part_kind_t;
+
+/* Every part is a NUL-terminated slice of its pipeline's text buffer. */
+typedef struct {
+    part_kind_t kind;
+    int quoted;             /* inside '...' or "...": not field-split */
+    char *text;             /* literal text, variable name or substituted command */
+    size_t len;
+} word_part_t;
+
+typedef struct {
+    word_part_t *parts;
+    int nparts, cap;
+} word_t;
+
+typedef enum { REDIR_IN, REDIR_OUT, REDIR_APPEND, REDIR_HEREDOC, REDIR_HERESTR } redir_kind_t;
+
+typedef struct {
+    redir_kind_t kind;
+    word_t target;          /* file name, here-string word or here-document body */
+} redir_t;
+
+/* NAME=value ahead of a stage's first word; name is a slice of the raw line. */
+typedef struct {
+    const char *name;
+    size_t nlen;
+    word_t value;
+} assign_t;
+
+typedef struct {
+    word_t *words;
+    int nwords, cap;
+    redir_t *redirs;
+    int nredirs, rcap;
+    assign_t *assigns;
+    int nassigns, acap;
+} stage_t;
+
+typedef enum { LIST_SEQ, LIST_AND, LIST_OR } list_op_t;
+
+/* One pipeline of a command list: stages[first, first + nstages). */
+typedef struct {
+    int first, nstages;
+    int background;
+    int timed;              /* prefixed by the `time` keyword */
+    list_op_t op;           /* what the next item runs on: ';'/'&', '&&' or '||' */
+    size_t raw_off, raw_len;    /* its text in raw, for job listings */
+} list_item_t;
+
+/* A parsed line: a list of pipelines joined by ; & && ||. */
+typedef struct pipeline {
+    stage_t *stages;
+    int nstages, cap;
+    list_item_t *items;
+    int nitems, icap;
+    char *raw;
+    char *text;             /* unquoted/unescaped word text, see slicer_t */
+    int refs;               /* callers holding it, plus one while cached */
+    arena_t arena;          /* owns everything above; lives as long as the parse */
+} pipeline_t;
+
+/* Parses are small and up to PARSE_CACHE_SIZE of them stay cached. */
+#define PARSE_ARENA_BLOCK 1024
+
+typedef struct { char *s; size_t len, cap; arena_t *a; } strbuf_t;
+
+static void sb_putn(strbuf_t *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t old = b->cap;
+        b->cap = b->cap ? b->cap * 2 : 16;
+        while (b->len + n + 1 > b->cap) b->cap *= 2;
+        b->s = arena_realloc(b->a, b->s, old, b->cap);
+    }
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+}
+static void sb_putc(strbuf_t *b, char c) { sb_putn(b, &c, 1); }
+
+/* Grow *arr (of *cap elements of size sz) so that index n is valid. */
+static void *grow(arena_t *a, void *arr, int *cap, int n, size_t sz) {
+    if (n < *cap) return arr;
+    int old = *cap;
+    *cap = *cap ? *cap * 2 : 4;
+    return arena_realloc(a, arr, (size_t)old * sz, (size_t)*cap * sz);
+}
+
+/* The parser writes word text once, in a single pass, into one buffer of
+ * 2*strlen(raw)+2 bytes: unescaping never lengthens text and each part adds
+ * a single terminator, so the buffer cannot overflow and no per-word
+ * allocation or copy is needed. */
+typedef struct { char *buf; size_t w; arena_t *a; } slicer_t;
+
+static void word_push(arena_t *a, word_t *w, part_kind_t kind, int quoted, char *text, size_t len) {
+    w->parts = grow(a, w->parts, &w->cap, w->nparts, sizeof(word_part_t));
+    w->parts[w->nparts++] = (word_part_t){ kind, quoted, text, len };
+}
+
+/* Pending literal run of the word being parsed; flushed as one part. */
+typedef struct { slicer_t *out; size_t start; int quoted; int active; } litacc_t;
+
+static void lit_flush(word_t *w, litacc_t *l) {
+    if (!l->active) return;
+    slicer_t *o = l->out;
+    size_t len = o->w - l->start;
+    o->buf[o->w++] = '\0';
+    word_push(o->a, w, PART_LIT, l->quoted, o->buf + l->start, len);
+    l->active = 0;
+}
+static void lit_putc(word_t *w, litacc_t *l, int quoted, char c) {
+    if (l->active && l->quoted != quoted) lit_flush(w, l);
+    if (!l->active) { l->active = 1; l->quoted = quoted; l->start = l->out->w; }
+    l->out->buf[l->out->w++] = c;
+}
+/* Flush pending literal text and add SRC[0..n) as its own part. */
+static void slice_push(word_t *w, litacc_t *l, part_kind_t kind, int quoted, const char *src, size_t n) {
+    lit_flush(w, l);
+    slicer_t *o = l->out;
+    char *t = o->buf + o->w;
+    memcpy(t, src, n);
+    t[n] = '\0';
+    o->w += n + 1;
+    word_push(o->a, w, kind, quoted, t, n);
+}
+
+/* Offset of the ')' closing a $( whose body starts at s, or -1. */
+static long scan_subst(const char *s) {
+    int depth = 1; char q = 0;
+    for (long i = 0; s[i]; ++i) {
+        char c = s[i];
+        if (q) { if (c == '\\' && q == '"' && s[i+1]) i++; else if (c == q) q = 0; continue; }
+        if (c == '\\' && s[i+1]) { i++; continue; }
+        if (c == '\'' || c == '"') q = c;
+        else if (c == '(') depth++;
+        else if (c == ')' && --depth == 0) return i;
+    }
+    return -1;
+}
+
+/* *pp points just past '$'.  Returns -1 on an unterminated construct. */
+static int parse_dollar(const char **pp, word_t *w, litacc_t *l, int quoted) {
+    const char *p = *pp;
+    if (*p == '(') {
+        long n = scan_subst(p + 1);
+        if (n < 0) return -1;
+        slice_push(w, l, PART_SUBST, quoted, p + 1, n);
+        *pp = p + 1 + n + 1;
+    } else if (*p == '{') {
+        const char *e = strchr(p + 1, '}');
+        if (!e) return -1;
+        slice_push(w, l, PART_VAR, quoted, p + 1, e - (p + 1));
+        *pp = e + 1;
+    } else if (isalnum((unsigned char)*p) || *p == '_') {
+        const char *e = p;
+        while (isalnum((unsigned char)*e) || *e == '_') e++;
+        slice_push(w, l, PART_VAR, quoted, p, e - p);
+        *pp = e;
+    } else if (*p == '?' || *p == '$') {
+        slice_push(w, l, PART_VAR, quoted, p, 1);
+        *pp = p + 1;
+    } else {
+        lit_putc(w, l, quoted, '$');
+    }
+    return 0;
+}
+
+static int parse_backtick(const char **pp, word_t *w, litacc_t *l, int quoted) {
+    const char *e = strchr(*pp, '`');
+    if (!e) return -1;
+    slice_push(w, l, PART_SUBST, quoted, *pp, e - *pp);
+    *pp = e + 1;
+    return 0;
+}
+
+static int is_word_end(char c) {
+    return c == '\0' || isspace((unsigned char)c) || c == '|' || c == '<' || c == '>' || c == '&' || c == ';';
+}
+
+/* Parse one word starting at *pp; returns -1 on unterminated quotes. */
+static int parse_word(slicer_t *out, const char **pp, word_t *w) {
+    const char *p = *pp;
+    litacc_t l = { .out = out };
+    int quoted_any = 0;
+    while (!is_word_end(*p)) {
+        if (*p == '\\') {
+            if (p[1]) { lit_putc(w, &l, 1, p[1]); p += 2; } else p++;
+        } else if (*p == '\'') {
+            const char *e = strchr(p + 1, '\'');
+            if (!e) goto unterminated;
+            quoted_any = 1;
+            for (p++; p < e; p++) lit_putc(w, &l, 1, *p);
+            p++;
+        } else if (*p == '"') {
+            quoted_any = 1;
+            for (p++; *p != '"'; ) {
+                if (!*p) goto unterminated;
+                if (*p == '\\' && p[1] && strchr("$`\"\\", p[1])) { lit_putc(w, &l, 1, p[1]); p += 2; }
+                else if (*p == '$') { p++; if (parse_dollar(&p, w, &l, 1) < 0) goto unterminated; }
+                else if (*p == '`') { p++; if (parse_backtick(&p, w, &l, 1) < 0) goto unterminated; }
+                else lit_putc(w, &l, 1, *p++);
             }
-        } else if (input[i]=='`') {
-            size_t j=i+1; while (input[j] && input[j] != '`') j++;
-            char *inner = strndup(input+i+1, j-(i+1)); char *res = run_command_capture(inner); free(inner);
-            size_t L=strlen(res); if (oi+L+1>cap){cap=cap+L+1024; out=realloc(out,cap);} memcpy(out+oi,res,L); oi+=L; free(res); i = (input[j] ? j : j-1);
+            p++;
+        } else if (*p == '$') {
+            p++;
+            if (parse_dollar(&p, w, &l, 0) < 0) goto unterminated;
+        } else if (*p == '`') {
+            p++;
+            if (parse_backtick(&p, w, &l, 0) < 0) goto unterminated;
         } else {
-            if (oi+2>cap) { cap *= 2; out = realloc(out, cap); }
-            out[oi++] = input[i];
+            lit_putc(w, &l, 0, *p++);
         }
     }
-    out[oi] = '\0';
-    return out;
+    lit_flush(w, &l);
+    if (w->nparts == 0 && quoted_any) slice_push(w, &l, PART_LIT, 1, "", 0);
+    *pp = p;
+    return 0;
+unterminated:
+    return -1;
 }
 
-/* --- Tokenize by whitespace respecting quotes and escapes --- */
-static char **tokenize(const char *s, int *argc_out) {
-    char **argv = calloc(MAX_TOKENS, sizeof(char*));
-    int argc = 0;
-    size_t i = 0, n = strlen(s);
+static void free_pipeline(pipeline_t *pl) {
+    arena_free(&pl->arena);
+    free(pl);
+}
+
+static stage_t *new_stage(pipeline_t *pl) {
+    pl->stages = grow(&pl->arena, pl->stages, &pl->cap, pl->nstages, sizeof(stage_t));
+    stage_t *st = &pl->stages[pl->nstages++];
+    memset(st, 0, sizeof(*st));
+    return st;
+}
+
+static int stage_empty(const stage_t *st) { return st->nwords == 0 && st->nredirs == 0 && st->nassigns == 0; }
+
+static list_item_t *new_item(pipeline_t *pl, size_t raw_off) {
+    pl->items = grow(&pl->arena, pl->items, &pl->icap, pl->nitems, sizeof(list_item_t));
+    list_item_t *it = &pl->items[pl->nitems++];
+    memset(it, 0, sizeof(*it));
+    it->first = pl->nstages;
+    it->raw_off = raw_off;
+    return it;
+}
+
+/* Close item IT, whose text ends just before END. */
+static void end_item(pipeline_t *pl, list_item_t *it, const char *end, list_op_t op) {
+    while (end > pl->raw + it->raw_off && isspace((unsigned char)end[-1])) end--;
+    it->nstages = pl->nstages - it->first;
+    it->op = op;
+    it->raw_len = (size_t)(end - (pl->raw + it->raw_off));
+}
+
+/* A here-document opened by <<DELIM (or <<-DELIM) on the current line;
+ * its body follows the line's newline.  stage/redir locate its redir_t. */
+typedef struct {
+    const char *delim;
+    size_t dlen;
+    int quoted;             /* some of DELIM was quoted: the body is literal */
+    int strip;              /* <<-: leading tabs are removed */
+    int stage, redir;
+} heredoc_t;
+
+/* *pp points just past "<<".  Read the optional '-' and the delimiter
+ * word, with quote removal, into H.  Returns -1 if there is none. */
+static int heredoc_open(arena_t *a, const char **pp, heredoc_t *h) {
+    const char *p = *pp;
+    strbuf_t b = { .a = a };
+    memset(h, 0, sizeof(*h));
+    if (*p == '-') { h->strip = 1; p++; }
+    while (*p == ' ' || *p == '\t') p++;
+    if (is_word_end(*p)) return -1;
+    while (!is_word_end(*p)) {
+        if (*p == '\\' && p[1]) { h->quoted = 1; sb_putc(&b, p[1]); p += 2; }
+        else if (*p == '\'' || *p == '"') {
+            const char *e = strchr(p + 1, *p);
+            if (!e) return -1;
+            h->quoted = 1;
+            sb_putn(&b, p + 1, (size_t)(e - p - 1));
+            p = e + 1;
+        } else sb_putc(&b, *p++);
+    }
+    h->delim = b.s ? b.s : "";
+    h->dlen = b.len;
+    *pp = p;
+    return 0;
+}
+
+/* Here-documents opened by LINE, in order, into *OUT; the input reader
+ * uses this to know how many bodies to read after it. */
+static int heredoc_scan(const char *line, arena_t *a, heredoc_t **out) {
+    int n = 0, cap = 0;
+    *out = NULL;
+    for (const char *p = line; *p; ) {
+        if (*p == '\\' && p[1]) p += 2;
+        else if (*p == '\'') { const char *e = strchr(p + 1, '\''); if (!e) break; p = e + 1; }
+        else if (*p == '"') {
+            for (p++; *p && *p != '"'; p++) if (*p == '\\' && p[1]) p++;
+            if (*p) p++;
+        } else if (p[0] == '<' && p[1] == '<' && p[2] != '<') {
+            p += 2;
+            *out = grow(a, *out, &cap, n, sizeof(heredoc_t));
+            if (heredoc_open(a, &p, &(*out)[n]) == 0) n++;
+        } else p += p[0] == '<' && p[1] == '<' ? 3 : 1;
+    }
+    return n;
+}
+
+/* Body text S of an unquoted here-document: $ and ` expand as in double
+ * quotes and a backslash escapes only $ ` \ and newline; nothing is split. */
+static void heredoc_body(slicer_t *out, const char *s, int quoted, word_t *w) {
+    litacc_t l = { .out = out };
+    for (const char *q = s; *q; ) {
+        if (quoted) lit_putc(w, &l, 1, *q++);
+        else if (*q == '\\' && q[1] && strchr("$`\\\n", q[1])) {
+            if (q[1] != '\n') lit_putc(w, &l, 1, q[1]);
+            q += 2;
+        } else if (*q == '$') {
+            q++;
+            if (parse_dollar(&q, w, &l, 1) < 0) lit_putc(w, &l, 1, '$');
+        } else if (*q == '`') {
+            q++;
+            if (parse_backtick(&q, w, &l, 1) < 0) lit_putc(w, &l, 1, '`');
+        } else lit_putc(w, &l, 1, *q++);
+    }
+    lit_flush(w, &l);
+    if (w->nparts == 0) slice_push(w, &l, PART_LIT, 1, "", 0);
+}
+
+/* Read the bodies of the N pending here-documents from P, the text after
+ * the line's newline; a missing delimiter ends the body at end of text.
+ * Returns where the text after the last delimiter line starts. */
+static const char *heredoc_read(pipeline_t *pl, slicer_t *out, const char *p, const heredoc_t *hd, int n) {
+    for (int i = 0; i < n; ++i) {
+        strbuf_t body = { .a = &pl->arena };
+        while (*p) {
+            const char *e = strchrnul(p, '\n'), *s = p;
+            if (hd[i].strip) while (*s == '\t') s++;
+            p = *e ? e + 1 : e;
+            if ((size_t)(e - s) == hd[i].dlen && memcmp(s, hd[i].delim, hd[i].dlen) == 0) break;
+            sb_putn(&body, s, (size_t)(e - s));
+            sb_putc(&body, '\n');
+        }
+        word_t *w = &pl->stages[hd[i].stage].redirs[hd[i].redir].target;
+        heredoc_body(out, body.s ? body.s : "", hd[i].quoted, w);
+    }
+    return p;
+}
+
+/* Length of the name if P starts an assignment word, NAME=..., else 0. */
+static size_t assign_len(const char *p) {
+    size_t n = 0;
+    while (isalnum((unsigned char)p[n]) || p[n] == '_') n++;
+    return p[n] == '=' && vars_valid_name(p, n) ? n : 0;
+}
+
+/* Parse a full command line.  Prints a diagnostic and returns NULL on error. */
+static pipeline_t *parse_line(const char *raw) {
+    pipeline_t *pl = calloc(1, sizeof(*pl));
+    arena_t *a = &pl->arena;
+    a->block_size = PARSE_ARENA_BLOCK;
+    size_t rawlen = strlen(raw);
+    pl->raw = arena_strndup(a, raw, rawlen);
+    pl->text = arena_alloc(a, 2 * rawlen + 2);
+    slicer_t out = { pl->text, 0, a };
+    list_item_t *it = new_item(pl, 0);
+    stage_t *st = new_stage(pl);
+    int open = 1;           /* `it` still takes stages */
+    /* scan the arena copy so item text offsets line up with pl->raw */
+    const char *p = pl->raw;
+    const char *err = NULL;
+    heredoc_t *hd = NULL;   /* here-documents waiting for the newline */
+    int nhd = 0, hdcap = 0;
+    const char *line_end = NULL;    /* where the first body starts */
+
+    while (1) {
+        while (isspace((unsigned char)*p)) {
+            if (*p == '\n' && nhd) {
+                if (!line_end) line_end = p;
+                p = heredoc_read(pl, &out, p + 1, hd, nhd);
+                nhd = 0;
+            } else p++;
+        }
+        if (!*p) break;
+        if (!open) {
+            it = new_item(pl, (size_t)(p - pl->raw));
+            st = new_stage(pl);
+            open = 1;
+        }
+        if (*p == '|' && p[1] != '|') {
+            if (stage_empty(st)) { err = "|"; break; }
+            st = new_stage(pl);
+            p++;
+        } else if (*p == ';' || *p == '&' || *p == '|') {
+            list_op_t op = LIST_SEQ;
+            const char *tok = ";";
+            if (p[0] == '&' && p[1] == '&') { op = LIST_AND; tok = "&&"; }
+            else if (p[0] == '|') { op = LIST_OR; tok = "||"; }
+            else if (p[0] == '&') tok = "&";
+            if (stage_empty(st)) { err = tok; break; }
+            const char *end = p;
+            p += strlen(tok);
+            if (*tok == '&' && !tok[1]) { it->background = 1; end = p; }
+            end_item(pl, it, end, op);
+            open = 0;
+            while (isspace((unsigned char)*p)) p++;
+            if (!*p && op != LIST_SEQ) { err = tok; break; }
+        } else if (*p == '<' && p[1] == '<' && p[2] != '<') {
+            p += 2;
+            hd = grow(a, hd, &hdcap, nhd, sizeof(heredoc_t));
+            if (heredoc_open(a, &p, &hd[nhd]) < 0) { err = "<<"; break; }
+            st->redirs = grow(a, st->redirs, &st->rcap, st->nredirs, sizeof(redir_t));
+            memset(&st->redirs[st->nredirs], 0, sizeof(redir_t));
+            st->redirs[st->nredirs].kind = REDIR_HEREDOC;
+            hd[nhd].stage = (int)(st - pl->stages);
+            hd[nhd++].redir = st->nredirs++;
+        } else if (*p == '<' || *p == '>') {
+            redir_kind_t kind = REDIR_IN;
+            const char *op = "<";
+            if (*p == '>') { kind = REDIR_OUT; op = ">"; if (p[1] == '>') { kind = REDIR_APPEND; op = ">>"; p++; } }
+            else if (p[1] == '<') { kind = REDIR_HERESTR; op = "<<<"; p += 2; }
+            p++;
+            while (isspace((unsigned char)*p)) p++;
+            if (is_word_end(*p)) { err = op; break; }
+            st->redirs = grow(a, st->redirs, &st->rcap, st->nredirs, sizeof(redir_t));
+            redir_t *r = &st->redirs[st->nredirs++];
+            memset(r, 0, sizeof(*r));
+            r->kind = kind;
+            if (parse_word(&out, &p, &r->target) < 0) { err = "unterminated quote"; break; }
+        } else if (st == &pl->stages[it->first] && stage_empty(st) && !it->timed &&
+                   strncmp(p, "time", 4) == 0 && is_word_end(p[4])) {
+            /* `time` is a keyword only in front of a pipeline */
+            it->timed = 1;
+            p += 4;
+        } else if (st->nwords == 0 && assign_len(p)) {
+            size_t n = assign_len(p);
+            st->assigns = grow(a, st->assigns, &st->acap, st->nassigns, sizeof(assign_t));
+            assign_t *as = &st->assigns[st->nassigns++];
+            memset(as, 0, sizeof(*as));
+            as->name = p;
+            as->nlen = n;
+            p += n + 1;
+            if (parse_word(&out, &p, &as->value) < 0) { err = "unterminated quote"; break; }
+        } else {
+            st->words = grow(a, st->words, &st->cap, st->nwords, sizeof(word_t));
+            word_t *w = &st->words[st->nwords++];
+            memset(w, 0, sizeof(*w));
+            if (parse_word(&out, &p, w) < 0) { err = "unterminated quote"; break; }
+        }
+    }
+    /* the line ended without a newline before the bodies: they are empty */
+    if (!err && nhd) heredoc_read(pl, &out, p, hd, nhd);
+    if (!err && open) {
+        if (pl->nstages - it->first > 1 && stage_empty(st)) err = "|";
+        else end_item(pl, it, line_end ? line_end : p, LIST_SEQ);
+    }
+    if (err) {
+        if (strchr(err, ' ')) fprintf(stderr, "syntax error: %s\n", err);
+        else fprintf(stderr, "syntax error near '%s'\n", err);
+        free_pipeline(pl);
+        return NULL;
+    }
+    return pl;
+}
+
+#define PARSE_CACHE_SIZE 64
+
+static struct { pipeline_t *pl; uint32_t hash; unsigned long used; } parse_cache[PARSE_CACHE_SIZE];
+static unsigned long parse_clock;
+
+static void release_pipeline(pipeline_t *pl) {
+    if (pl && --pl->refs == 0) free_pipeline(pl);
+}
+
+/* Parse RAW, reusing an earlier parse of the identical line.  The result
+ * is shared and read-only; hand it back with release_pipeline(). */
+static pipeline_t *parse_cached(const char *raw) {
+    uint32_t h = 2166136261u;
+    for (const char *c = raw; *c; ++c) { h ^= (unsigned char)*c; h *= 16777619u; }
+    int victim = 0;
+    for (int i = 0; i < PARSE_CACHE_SIZE; ++i) {
+        if (parse_cache[i].pl && parse_cache[i].hash == h && strcmp(parse_cache[i].pl->raw, raw) == 0) {
+            parse_cache[i].used = ++parse_clock;
+            parse_cache[i].pl->refs++;
+            STATS_INC(STAT_PARSE_HITS);
+            return parse_cache[i].pl;
+        }
+        if (parse_cache[victim].pl && (!parse_cache[i].pl || parse_cache[i].used < parse_cache[victim].used)) victim = i;
+    }
+    STATS_INC(STAT_PARSE_MISSES);
+    pipeline_t *pl = parse_line(raw);
+    if (!pl) return NULL;
+    release_pipeline(parse_cache[victim].pl);
+    parse_cache[victim].pl = pl;
+    parse_cache[victim].hash = h;
+    parse_cache[victim].used = ++parse_clock;
+    pl->refs = 2;
+    return pl;
+}
+
+/* --- Expansion: pipeline_t -> command_t argv/redirections, exactly once --- */
+
+/* Everything expansion produces lives here; reset once per REPL iteration. */
+static arena_t cmd_arena;
+static size_t last_cmd_allocs, last_cmd_bytes;
+
+typedef struct {
+    redir_kind_t kind;
+    char *path;             /* file name, or the here-document/here-string text */
+    size_t len;             /* length of that text */
+} xredir_t;
+
+typedef struct {
+    char **argv;            /* NULL-terminated; entries may alias the parse, never modify them */
+    int argc, cap;
+    xredir_t *redirs;
+    int nredirs;
+    char **assigns;         /* expanded "NAME=value" prefixes */
+    int nassigns;
+    char **envp;            /* environment for this stage, if its prefixes change it */
+    int bad;                /* expansion failed (e.g. ambiguous redirect) */
+} command_t;
+
+static void argv_push(command_t *c, char *s) {
+    c->argv = grow(&cmd_arena, c->argv, &c->cap, c->argc + 1, sizeof(char *));
+    c->argv[c->argc++] = s;
+    c->argv[c->argc] = NULL;
+}
+
+/* Directory listings read by this pipeline's patterns; reset before each
+ * expansion, since an earlier item of the line may have changed them. */
+static pathglob_cache_t glob_cache = { .a = &cmd_arena };
+
+/* A field being built.  Its text is kept as a glob pattern: quoted
+ * characters that are special to the matcher get a backslash, and
+ * unquoted '*', '?' or '[' mark it for pathname expansion. */
+typedef struct { strbuf_t b; int have, glob, escaped; } field_t;
+
+static void field_put(field_t *f, const char *s, size_t n, int quoted) {
+    f->have = 1;
+    const char *special = quoted ? "*?[\\" : "\\";
+    size_t i = 0;
     while (i < n) {
-        while (i < n && isspace((unsigned char)s[i])) i++;
-        if (i >= n) break;
-        char buf[4096]; size_t bi = 0;
-        if (s[i] == '"') {
-            i++;
-            while (i < n && s[i] != '"') {
-                if (bi < MAX_TOKENS - 1) buf[bi++] = s[i++];
-                else break; // prevent overflow
-            }
-            if (i < n && s[i] == '"') i++;
+        size_t run = i;
+        while (run < n && !strchr(special, s[run])) run++;
+        for (size_t k = i; !quoted && !f->glob && k < run; ++k)
+            f->glob = s[k] == '*' || s[k] == '?' || s[k] == '[';
+        sb_putn(&f->b, s + i, run - i);
+        if (run == n) break;
+        sb_putc(&f->b, '\\');
+        sb_putc(&f->b, s[run]);
+        f->escaped = 1;
+        i = run + 1;
+    }
+}
+
+/* Push the finished field: its pathname matches if there are any, else
+ * its text with the pattern escapes taken out. */
+static void field_end(field_t *f, command_t *c) {
+    if (!f->have) return;
+    char *text = f->b.s ? f->b.s : arena_strdup(&cmd_arena, "");
+    if (f->glob && pathglob_has_meta(text)) {
+        char **m;
+        size_t n = pathglob_expand(&glob_cache, text, &m);
+        for (size_t i = 0; i < n; ++i) argv_push(c, m[i]);
+        if (n) { *f = (field_t){ .b = { .a = &cmd_arena } }; return; }
+    }
+    argv_push(c, f->escaped ? pathglob_unescape(&cmd_arena, text) : text);
+    *f = (field_t){ .b = { .a = &cmd_arena } };
+}
+
+/* Value of a $NAME, $? or $$ part; unset names expand to "". */
+static const char *var_value(const word_part_t *pt) {
+    if (pt->len == 1 && (pt->text[0] == '?' || pt->text[0] == '$')) {
+        char *v = arena_alloc(&cmd_arena, 16);
+        snprintf(v, 16, "%d", pt->text[0] == '?' ? last_status : (int)shell_pid);
+        return v;
+    }
+    const char *v = vars_get(pt->text, pt->len);
+    return v ? v : "";
+}
+
+/* Expand one word into zero or more fields appended to c->argv.  Unquoted
+ * variable and substitution results are split on whitespace, then every
+ * field with an unquoted wildcard goes through pathname expansion. */
+static void expand_word(const word_t *w, command_t *c) {
+    /* the common case: a plain word goes into argv straight from the parse */
+    if (w->nparts == 1 && w->parts[0].kind == PART_LIT) {
+        const word_part_t *pt = &w->parts[0];
+        if (pt->quoted || !strpbrk(pt->text, "*?[") || !pathglob_has_meta(pt->text)) { argv_push(c, pt->text); return; }
+        /* unquoted parse text holds no backslashes: it is the pattern as is */
+        char **m;
+        size_t n = pathglob_expand(&glob_cache, pt->text, &m);
+        for (size_t i = 0; i < n; ++i) argv_push(c, m[i]);
+        if (!n) argv_push(c, pt->text);
+        return;
+    }
+    field_t f = { .b = { .a = &cmd_arena } };
+    for (int i = 0; i < w->nparts; ++i) {
+        const word_part_t *pt = &w->parts[i];
+        if (pt->kind == PART_LIT) { field_put(&f, pt->text, pt->len, pt->quoted); continue; }
+        const char *val;
+        if (pt->kind == PART_VAR) val = var_value(pt);
+        else val = run_command_capture(pt->text);
+        if (pt->quoted) { field_put(&f, val, strlen(val), 1); continue; }
+        for (const char *v = val; *v; ) {
+            if (isspace((unsigned char)*v)) { field_end(&f, c); v++; continue; }
+            const char *e = v;
+            while (*e && !isspace((unsigned char)*e)) e++;
+            field_put(&f, v, (size_t)(e - v), 0);
+            v = e;
         }
-        else if (s[i] == '\'') {
-            i++;
-            while (i < n && s[i] != '\'') {
-                buf[bi++] = s[i++];
+    }
+    field_end(&f, c);
+}
+
+/* Append W to B as one string, never split or globbed: assignment
+ * values, here-strings and here-document bodies. */
+static void expand_joined(strbuf_t *b, const word_t *w) {
+    for (int i = 0; i < w->nparts; ++i) {
+        const word_part_t *pt = &w->parts[i];
+        if (pt->kind == PART_LIT) { sb_putn(b, pt->text, pt->len); continue; }
+        const char *v = pt->kind == PART_VAR ? var_value(pt) : run_command_capture(pt->text);
+        sb_putn(b, v, strlen(v));
+    }
+}
+
+static char *expand_assign(const assign_t *as) {
+    strbuf_t b = { .a = &cmd_arena };
+    sb_putn(&b, as->name, as->nlen);
+    sb_putc(&b, '=');
+    expand_joined(&b, &as->value);
+    return b.s;
+}
+
+static command_t *expand_pipeline(const pipeline_t *pl, const list_item_t *it) {
+    pathglob_cache_reset(&glob_cache);
+    command_t *cmds = arena_calloc(&cmd_arena, it->nstages, sizeof(command_t));
+    for (int i = 0; i < it->nstages; ++i) {
+        const stage_t *st = &pl->stages[it->first + i];
+        command_t *c = &cmds[i];
+        if (st->nassigns) c->assigns = arena_alloc(&cmd_arena, st->nassigns * sizeof(char *));
+        for (int j = 0; j < st->nassigns; ++j) c->assigns[c->nassigns++] = expand_assign(&st->assigns[j]);
+        for (int j = 0; j < st->nwords; ++j) expand_word(&st->words[j], c);
+        if (c->argc && c->nassigns) c->envp = vars_environ_with(c->assigns, c->nassigns, &cmd_arena);
+        if (st->nredirs) c->redirs = arena_calloc(&cmd_arena, st->nredirs, sizeof(xredir_t));
+        for (int j = 0; j < st->nredirs; ++j) {
+            redir_kind_t kind = st->redirs[j].kind;
+            if (kind == REDIR_HEREDOC || kind == REDIR_HERESTR) {
+                strbuf_t b = { .a = &cmd_arena };
+                expand_joined(&b, &st->redirs[j].target);
+                if (kind == REDIR_HERESTR) sb_putc(&b, '\n');
+                c->redirs[c->nredirs].kind = kind;
+                c->redirs[c->nredirs].path = b.s ? b.s : "";
+                c->redirs[c->nredirs++].len = b.len;
+                continue;
             }
-            if (i < n && s[i] == '\'') i++;
-        } else {
-            while (i < n && !isspace((unsigned char)s[i])) {
-                buf[bi++] = s[i++];
+            command_t t = {0};
+            expand_word(&st->redirs[j].target, &t);
+            if (t.argc != 1) {
+                fprintf(stderr, "ambiguous redirect\n");
+                c->bad = 1;
+                continue;
             }
+            c->redirs[c->nredirs].kind = st->redirs[j].kind;
+            c->redirs[c->nredirs++].path = t.argv[0];
         }
-        buf[bi] = '\0';
-        argv[argc++] = strdup(buf);
     }
-    argv[argc] = NULL;
-    if (argc_out) *argc_out = argc;
-    return argv;
+    return cmds;
 }
 
-/* Check builtin */
-static int is_builtin(const char *cmd) {
-    if (!cmd) return 0;
-    const char *b[] = {"cd","exit","pwd","mkdir","touch","history","jobs","fg","bg","kill", NULL};
-    for (int i=0;b[i];++i) if (strcmp(cmd,b[i])==0) return 1;
+/* Report per-command arena usage; the current line counts as "this". */
+static int memstats_builtin(void) {
+    size_t parse_allocs = 0, parse_blocks = 0, cached = 0;
+    for (int i = 0; i < PARSE_CACHE_SIZE; ++i) {
+        if (!parse_cache[i].pl) continue;
+        cached++;
+        parse_allocs += parse_cache[i].pl->arena.total_allocs;
+        parse_blocks += parse_cache[i].pl->arena.nblocks;
+    }
+    printf("command arena: this %zu allocs/%zu bytes, last %zu allocs/%zu bytes\n",
+           cmd_arena.nallocs, cmd_arena.bytes, last_cmd_allocs, last_cmd_bytes);
+    printf("command arena: %zu allocs total, %zu resets, %zu blocks, peak %zu bytes\n",
+           cmd_arena.total_allocs, cmd_arena.resets, cmd_arena.nblocks, cmd_arena.peak_bytes);
+    printf("parse cache:   %zu/%d lines, %zu allocs in %zu blocks\n",
+           cached, PARSE_CACHE_SIZE, parse_allocs, parse_blocks);
     return 0;
 }
 
-/* Run builtin in shell process when appropriate */
-static int run_builtin(char **argv) {
-    if (!argv || !argv[0]) return 0;
-    if (strcmp(argv[0], "cd") == 0) {
-        const char *dir = argv[1] ? argv[1] : getenv("HOME");
-        if (!dir) dir = "/";
-        if (chdir(dir) < 0) perror("cd");
-        return 1;
-    } else if (strcmp(argv[0], "pwd") == 0) {
-        char cwd[4096]; if (getcwd(cwd,sizeof(cwd))) puts(cwd); else perror("pwd"); return 1;
-    } else if (strcmp(argv[0], "exit") == 0) {
-        int code = argv[1] ? atoi(argv[1]) : 0; exit(code);
-    } else if (strcmp(argv[0], "mkdir") == 0) { if (!argv[1]) { fprintf(stderr,"mkdir: missing operand\n"); return 1;} if (mkdir(argv[1],0755)<0) perror("mkdir"); return 1; }
-    else if (strcmp(argv[0], "touch") == 0) { if (!argv[1]) { fprintf(stderr,"touch: missing operand\n"); return 1;} int fd=open(argv[1],O_CREAT|O_WRONLY,0644); if (fd<0) perror("touch"); else close(fd); return 1; }
-    else if (strcmp(argv[0], "history") == 0) { for (int i=0;i<history_count;i++) printf("%4d  %s\n", i+1, history_arr[i]); return 1; }
-    else if (strcmp(argv[0], "jobs") == 0) { print_jobs(); return 1; }
-    else if (strcmp(argv[0], "fg") == 0 || strcmp(argv[0], "bg") == 0) {
-        int bg = (strcmp(argv[0], "bg") == 0);
-        int jid = 0;
-        if (argv[1]) jid = atoi(argv[1]);
-        if (!jid) {
-            // pick last job
-            int last = -1; for (int i=0;i<MAX_JOBS;i++) if (jobs[i].id) last=i;
-            if (last==-1) { fprintf(stderr, "fg/bg: no jobs\n"); return 1; }
-            jid = jobs[last].id;
-        }
-        job_t *j = find_job_by_id(jid);
-        if (!j) { fprintf(stderr, "fg/bg: job %d not found\n", jid); return 1; }
-        if (bg) {
-            if (kill(-j->pgid, SIGCONT) < 0) perror("kill (SIGCONT)"); else j->state = JOB_RUNNING;
-        } else {
-            if (tcsetpgrp(shell_terminal, j->pgid) < 0) perror("tcsetpgrp");
-            if (kill(-j->pgid, SIGCONT) < 0) perror("kill (SIGCONT)");
-            j->state = JOB_RUNNING;
-            int status; waitpid(-j->pgid, &status, WUNTRACED);
-            tcsetpgrp(shell_terminal, shell_pgid);
+/* --- Builtins: one registry, looked up by hash --- */
+/* Handlers return an exit status.  Flags say where a builtin may run:
+ *   BI_PARENT  changes shell state (cwd, jobs, caches); runs in the shell
+ *              only as a whole foreground command, elsewhere (pipelines,
+ *              background, $(...)) in a forked child like a subshell.
+ *   BI_INPROC  output only; runs in the shell with stdin/stdout swapped
+ *              whenever it is the last stage or stands alone, including
+ *              with redirections and in $(...).
+ *   BI_FORK    always gets its own process.
+ * Any builtin before the last stage of a pipeline is forked, so it cannot
+ * block the shell writing into a pipe nobody is reading yet. */
+enum { BI_PARENT = 1, BI_INPROC = 2, BI_FORK = 4 };
+
+typedef struct { const char *name; int (*fn)(char **argv); int flags; } builtin_t;
+
+static int bi_cd(char **argv) {
+    const char *dir = argv[1] ? argv[1] : vars_get("HOME", 4);
+    if (!dir) dir = "/";
+    if (chdir(dir) < 0) { perror("cd"); return 1; }
+    pathcache_invalidate_cwd();
+    prompt_cwd_changed();
+    return 0;
+}
+static int bi_pwd(char **argv) {
+    (void)argv;
+    char cwd[4096]; if (getcwd(cwd,sizeof(cwd))) { puts(cwd); return 0; } perror("pwd"); return 1;
+}
+static int bi_exit(char **argv) {
+    int code = argv[1] ? atoi(argv[1]) : last_status;
+    /* in a forked stage or subshell: leave the shell's exit handlers alone */
+    if (getpid() != shell_pid) { fflush(stdout); _exit(code); }
+    exit(code);
+}
+static int bi_mkdir(char **argv) {
+    if (!argv[1]) { fprintf(stderr,"mkdir: missing operand\n"); return 1;} if (mkdir(argv[1],0755)<0) { perror("mkdir"); return 1; } return 0;
+}
+static int bi_touch(char **argv) {
+    if (!argv[1]) { fprintf(stderr,"touch: missing operand\n"); return 1;} int fd=open(argv[1],O_CREAT|O_WRONLY|O_CLOEXEC,0644); if (fd<0) { perror("touch"); return 1; } close(fd); return 0;
+}
+static int bi_history(char **argv) {
+    (void)argv;
+    unsigned long first = history_first_number();
+    for (size_t i=0;i<history_len();i++) printf("%4lu  %s\n", first+i, history_get(i));
+    return 0;
+}
+static int bi_jobs(char **argv) { (void)argv; print_jobs(); return 0; }
+static int bi_hash(char **argv) { return pathcache_builtin(argv, stdout); }
+static int bi_memstats(char **argv) { (void)argv; return memstats_builtin(); }
+static int bi_shellstats(char **argv) { return stats_builtin(argv, stdout); }
+static int bi_export(char **argv) { return vars_export_builtin(argv, stdout); }
+static int bi_unset(char **argv) { return vars_unset_builtin(argv); }
+static int bi_fg(char **argv) {
+    int bg = (strcmp(argv[0], "bg") == 0);
+    if (!interactive) { fprintf(stderr, "%s: no job control\n", argv[0]); return 1; }
+    job_t *j = current_job;
+    if (argv[1]) j = job_from_spec(argv[1]);
+    else if (!j) { fprintf(stderr, "fg/bg: no jobs\n"); return 1; }
+    if (!j) { fprintf(stderr, "fg/bg: job %s not found\n", argv[1]); return 1; }
+    if (j->nlive == 0) {
+        /* finished but not reported yet: nothing to resume */
+        fprintf(stderr, "%s: job %d has terminated\n", argv[0], j->id);
+        int st = wait_status_code(j->status);
+        remove_job(j);
+        return st;
+    }
+    if (bg) {
+        if (kill(-j->pgid, SIGCONT) < 0) { perror("kill (SIGCONT)"); return 1; }
+        j->state = JOB_RUNNING;
+        return 0;
+    }
+    if (tcsetpgrp(shell_terminal, j->pgid) < 0) perror("tcsetpgrp");
+    if (kill(-j->pgid, SIGCONT) < 0) perror("kill (SIGCONT)");
+    j->state = JOB_RUNNING;
+    wait_for_job(j);
+    tcsetpgrp(shell_terminal, shell_pgid);
+    int st = j->state == JOB_STOPPED ? 128 + SIGTSTP : wait_status_code(j->status);
+    if (j->state == JOB_DONE) remove_job(j);
+    return st;
+}
+/* Wait for background job J the way the REPL does, through the SIGCHLD
+ * signalfd, so that Ctrl-C can end the wait; -1 if it did. */
+static int wait_interruptible(job_t *j) {
+    if (!interactive || sigchld_fd < 0) { wait_for_job(j); return 0; }
+    while (1) {
+        reap_children();
+        if (j->nlive == 0 || j->state != JOB_RUNNING) return 0;
+        if (wait_readable(sigchld_fd, -1) < 0) return -1;
+        drain_sigchld_fd();
+    }
+}
+/* wait [%job|pgid...]: block until the given background jobs, or all of
+ * them, finish; their Done reports are dropped.  With operands the status
+ * is the last one's. */
+static int bi_wait(char **argv) {
+    int st = 0;
+    for (int i = 1, id = 1; argv[1] ? argv[i] != NULL : id <= max_job_id; ++i, ++id) {
+        job_t *j = argv[1] ? job_from_spec(argv[i]) : find_job_by_id(id);
+        if (!j) {
+            if (argv[1]) { fprintf(stderr, "wait: %s: no such job\n", argv[i]); st = 127; }
+            continue;
         }
-        return 1;
-    } else if (strcmp(argv[0], "kill") == 0) {
-        if (!argv[1]) { fprintf(stderr, "kill: usage: kill [-SIGNAL] pid|%%job\n"); return 1; }
-        int sig = SIGTERM;
-        char *target = argv[1];
-        if (target[0]=='-' && isdigit((unsigned char)target[1])) { sig = atoi(target+1); if (argv[2]) target = argv[2]; else { fprintf(stderr, "kill: missing target\n"); return 1; } }
-        if (target[0]=='%') {
-            int jid = atoi(target+1);
-            job_t *j = find_job_by_id(jid);
-            if (!j) { fprintf(stderr, "kill: no such job %s\n", target); return 1; }
-            if (kill(-j->pgid, sig) < 0) perror("kill");
-        } else {
-            pid_t pid = (pid_t)atoi(target);
-            if (pid<=0) { fprintf(stderr, "kill: invalid pid\n"); return 1; }
-            if (kill(pid, sig) < 0) perror("kill");
+        if (j->state == JOB_RUNNING && wait_interruptible(j) < 0) return 130;
+        if (j->state != JOB_DONE) continue;
+        if (argv[1]) st = wait_status_code(j->status);
+        remove_job(j);
+    }
+    return st;
+}
+static int bi_kill(char **argv) {
+    if (!argv[1]) { fprintf(stderr, "kill: usage: kill [-SIGNAL] pid|%%job\n"); return 2; }
+    int sig = SIGTERM;
+    char *target = argv[1];
+    if (target[0]=='-' && isdigit((unsigned char)target[1])) { sig = atoi(target+1); if (argv[2]) target = argv[2]; else { fprintf(stderr, "kill: missing target\n"); return 2; } }
+    if (target[0]=='%') {
+        job_t *j = job_from_spec(target);
+        if (!j) { fprintf(stderr, "kill: no such job %s\n", target); return 1; }
+        if (job_kill(j, sig) < 0) { perror("kill"); return 1; }
+    } else {
+        pid_t pid = (pid_t)atoi(target);
+        if (pid<=0) { fprintf(stderr, "kill: invalid pid\n"); return 1; }
+        if (kill(pid, sig) < 0) { perror("kill"); return 1; }
+    }
+    return 0;
+}
+
+static const builtin_t builtins[] = {
+    { "cd",       bi_cd,            BI_PARENT },
+    { "exit",     bi_exit,          BI_PARENT },
+    { "fg",       bi_fg,            BI_PARENT },
+    { "bg",       bi_fg,            BI_PARENT },
+    { "hash",     bi_hash,          BI_PARENT },
+    { "launcher", launcher_builtin, BI_PARENT },
+    { "wait",     bi_wait,          BI_PARENT },
+    { "export",   bi_export,        BI_PARENT },
+    { "unset",    bi_unset,         BI_PARENT },
+    { "coproc",   bi_coproc,        BI_PARENT },
+    { "cowrite",  bi_cowrite,       BI_PARENT },
+    { "coread",   bi_coread,        BI_PARENT },
+    { "pwd",      bi_pwd,           BI_INPROC },
+    { "mkdir",    bi_mkdir,         BI_INPROC },
+    { "touch",    bi_touch,         BI_INPROC },
+    { "history",  bi_history,       BI_INPROC },
+    { "jobs",     bi_jobs,          BI_INPROC },
+    { "kill",     bi_kill,          BI_INPROC },
+    { "memstats", bi_memstats,      BI_INPROC },
+    { "echo",     coreutils_echo,   BI_INPROC },
+    { "printf",   coreutils_printf, BI_INPROC },
+    { "cat",      coreutils_cat,    BI_INPROC },
+    { "test",     coreutils_test,   BI_INPROC },
+    { "[",        coreutils_test,   BI_INPROC },
+    { "true",     coreutils_true,   BI_INPROC },
+    { "false",    coreutils_false,  BI_INPROC },
+    { "parallel", bi_parallel,      BI_INPROC },
+    { "shellstats", bi_shellstats,  BI_INPROC },
+};
+#define NBUILTINS ((int)(sizeof(builtins) / sizeof(builtins[0])))
+
+/* Open-addressed FNV-1a table over builtins[], filled on first use; at
+ * most a couple of probes and one strcmp per lookup. */
+#define BUILTIN_SLOTS 64
+static signed char builtin_slot[BUILTIN_SLOTS];
+
+static uint32_t builtin_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+/* The builtin that runs ARGV, or NULL for an external command; cat with
+ * options only the real one knows goes to the real one. */
+static const builtin_t *find_builtin(char **argv) {
+    static int ready;
+    const char *name = argv[0];
+    if (!name) return NULL;
+    if (!ready) {
+        memset(builtin_slot, -1, sizeof(builtin_slot));
+        for (int i = 0; i < NBUILTINS; ++i) {
+            uint32_t s = builtin_hash(builtins[i].name) & (BUILTIN_SLOTS - 1);
+            while (builtin_slot[s] >= 0) s = (s + 1) & (BUILTIN_SLOTS - 1);
+            builtin_slot[s] = (signed char)i;
         }
-        return 1;
+        ready = 1;
+    }
+    for (uint32_t s = builtin_hash(name) & (BUILTIN_SLOTS - 1); builtin_slot[s] >= 0; s = (s + 1) & (BUILTIN_SLOTS - 1))
+        if (strcmp(builtins[builtin_slot[s]].name, name) == 0) {
+            const builtin_t *b = &builtins[builtin_slot[s]];
+            return b->fn != coreutils_cat || coreutils_cat_plain(argv) ? b : NULL;
+        }
+    return NULL;
+}
+
+/* Run B in the shell with IN_FD/OUT_FD (-1: leave alone) as stdin/stdout. */
+static int run_builtin_inproc(const builtin_t *b, char **argv, int in_fd, int out_fd) {
+    int saved_in = -1, saved_out = -1;
+    STATS_INC(STAT_INPROC);
+    fflush(stdout);
+    if (in_fd != -1) { saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10); dup2(in_fd, STDIN_FILENO); }
+    if (out_fd != -1) { saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10); dup2(out_fd, STDOUT_FILENO); }
+    /* a reader that went away must fail the write, not kill the shell */
+    void (*oldpipe)(int) = signal(SIGPIPE, SIG_IGN);
+    int st = b->fn(argv);
+    fflush(stdout);
+    clearerr(stdout);
+    signal(SIGPIPE, oldpipe);
+    if (saved_out != -1) { dup2(saved_out, STDOUT_FILENO); close(saved_out); }
+    if (saved_in != -1) { dup2(saved_in, STDIN_FILENO); close(saved_in); }
+    return st;
+}
+
+/* May B run inside the shell as the last stage of an NCMDS-stage pipeline? */
+static int builtin_inproc_ok(const builtin_t *b, int ncmds) {
+    if (!b || (b->flags & BI_FORK)) return 0;
+    if (b->flags & BI_PARENT) return ncmds == 1;
+    return 1;
+}
+
+/* Ctrl-C cannot stop a builtin running in the shell, so an interactive
+ * cat stays in here only when all it reads (IN_FD, or the shell's stdin
+ * if -1, and its files) is regular files or pipes and is bound to end. */
+static int cat_inproc_ok(char **argv, int in_fd) {
+    if (!interactive) return 1;
+    struct stat sb;
+    int stdin_ok = fstat(in_fd != -1 ? in_fd : STDIN_FILENO, &sb) == 0 && (S_ISREG(sb.st_mode) || S_ISFIFO(sb.st_mode));
+    int files = 0, opts = 1;
+    for (int i = 1; argv[i]; ++i) {
+        if (opts && strcmp(argv[i], "--") == 0) { opts = 0; continue; }
+        if (opts && strcmp(argv[i], "-u") == 0) continue;
+        files++;
+        if (strcmp(argv[i], "-") == 0 ? !stdin_ok : stat(argv[i], &sb) == 0 && !S_ISREG(sb.st_mode)) return 0;
+    }
+    return files || stdin_ok;
+}
+
+
+/* --- time: where a pipeline's cost went --- */
+
+/* Set while a `time`d pipeline runs.  Stage figures come from wait4();
+ * the shell's own parse/expand/spawn time is clocked around those steps. */
+typedef struct {
+    int64_t start_ns;
+    int64_t parse_ns, expand_ns, spawn_ns;
+    int inproc;             /* the last stage ran in the shell: */
+    int64_t inproc_ns;      /*   its wall time */
+    struct rusage inproc_ru;    /*   and the shell's rusage growth over it */
+} pipetime_t;
+
+static pipetime_t *timing;
+/* set while a `place ...` pipeline is launched */
+static const place_t *placing;
+static int64_t parse_ns;    /* parse time of the current line */
+
+static double tv_secs(const struct timeval *t) { return (double)t->tv_sec + (double)t->tv_usec / 1e6; }
+
+static void tv_add(struct timeval *a, const struct timeval *b) {
+    a->tv_sec += b->tv_sec;
+    a->tv_usec += b->tv_usec;
+    if (a->tv_usec >= 1000000) { a->tv_sec++; a->tv_usec -= 1000000; }
+}
+
+static void tv_sub(struct timeval *a, const struct timeval *b) {
+    a->tv_sec -= b->tv_sec;
+    a->tv_usec -= b->tv_usec;
+    if (a->tv_usec < 0) { a->tv_sec--; a->tv_usec += 1000000; }
+}
+
+static void time_row(const char *label, double real, const struct rusage *ru, int rss, const char *cmd) {
+    char rs[32] = "-";
+    if (rss) snprintf(rs, sizeof(rs), "%ldkB", ru->ru_maxrss);
+    fprintf(stderr, "%-6s %8.3fs %8.3fs %8.3fs %9s %6ld %6ld  %s\n", label, real,
+            tv_secs(&ru->ru_utime), tv_secs(&ru->ru_stime), rs, ru->ru_nvcsw, ru->ru_nivcsw, cmd);
+}
+
+/* Stage command text for the report, cut to fit one line. */
+static const char *stage_text(const command_t *c) {
+    static char buf[48];
+    size_t n = 0;
+    for (int i = 0; i < c->argc && n + 1 < sizeof(buf); ++i)
+        n += (size_t)snprintf(buf + n, sizeof(buf) - n, "%s%s", i ? " " : "", c->argv[i]);
+    return buf;
+}
+
+/* Report on stderr: one row per forked stage (J may be NULL if nothing
+ * was forked), the in-shell builtin if any, the totals, then the shell's
+ * own share. */
+static void report_time(const pipetime_t *tm, const job_t *j, const command_t *cmds, int ncmds) {
+    int64_t end = now_ns();
+    struct rusage total;
+    memset(&total, 0, sizeof(total));
+    fprintf(stderr, "%-6s %9s %9s %9s %9s %6s %6s  %s\n", "stage", "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "command");
+    int k = 0;
+    for (int i = 0; i < ncmds; ++i) {
+        const command_t *c = &cmds[i];
+        char label[16];
+        snprintf(label, sizeof(label), "%d", i + 1);
+        if (c->bad || c->argc == 0) continue;
+        if (i == ncmds - 1 && tm->inproc) {
+            time_row(label, (double)tm->inproc_ns / 1e9, &tm->inproc_ru, 0, stage_text(c));
+            tv_add(&total.ru_utime, &tm->inproc_ru.ru_utime);
+            tv_add(&total.ru_stime, &tm->inproc_ru.ru_stime);
+            total.ru_nvcsw += tm->inproc_ru.ru_nvcsw;
+            total.ru_nivcsw += tm->inproc_ru.ru_nivcsw;
+            continue;
+        }
+        /* procs[] holds only the stages that launched, in order */
+        if (!j || k >= j->nprocs || j->procs[k].stage != i) continue;
+        const job_proc_t *p = &j->procs[k++];
+        time_row(label, (double)(p->end_ns - tm->start_ns) / 1e9, &p->ru, 1, stage_text(c));
+        tv_add(&total.ru_utime, &p->ru.ru_utime);
+        tv_add(&total.ru_stime, &p->ru.ru_stime);
+        if (p->ru.ru_maxrss > total.ru_maxrss) total.ru_maxrss = p->ru.ru_maxrss;
+        total.ru_nvcsw += p->ru.ru_nvcsw;
+        total.ru_nivcsw += p->ru.ru_nivcsw;
+    }
+    time_row("total", (double)(end - tm->start_ns) / 1e9, &total, j != NULL, "");
+    fprintf(stderr, "shell  parse %.3fms  expand %.3fms  spawn %.3fms\n",
+            (double)tm->parse_ns / 1e6, (double)tm->expand_ns / 1e6, (double)tm->spawn_ns / 1e6);
+}
+
+/* --- Launchers: fork+exec, or posix_spawn (no page-table copy of the shell) --- */
+
+typedef enum { LAUNCH_SPAWN, LAUNCH_FORK } launcher_t;
+static launcher_t launcher = LAUNCH_SPAWN;
+
+/* in_fd/out_fd become the child's stdin/stdout; close_fd is the parent's
+ * read end of the next pipe, which the child must not hold open.  envp is
+ * the child's environment. */
+static pid_t fork_stage(char **argv, char **envp, const char *exe, pid_t pgid, int in_fd, int out_fd, int close_fd, int background) {
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); return -1; }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        sigset_t none; sigemptyset(&none); sigprocmask(SIG_SETMASK, &none, NULL);
+
+        if (pgid == 0) pgid = getpid();
+        setpgid(0, pgid);
+
+        if (!background) tcsetpgrp(shell_terminal, pgid);
+
+        if (in_fd != -1) { dup2(in_fd, STDIN_FILENO); close(in_fd); }
+        if (out_fd != -1) { dup2(out_fd, STDOUT_FILENO); close(out_fd); }
+        if (close_fd != -1) close(close_fd);
+        environ = envp;
+        if (placing && place_apply(placing) < 0) _exit(126);
+
+        const builtin_t *b = find_builtin(argv);
+        if (b) {
+            int st = b->fn(argv);
+            fflush(stdout);
+            _exit(st);
+        }
+
+        pathcache_exec(exe, argv);
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t spawn_stage(char **argv, char **envp, const char *exe, pid_t pgid, int in_fd, int out_fd, int close_fd, int background) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&fa);
+    if (in_fd != -1) { posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO); posix_spawn_file_actions_addclose(&fa, in_fd); }
+    if (out_fd != -1) { posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO); posix_spawn_file_actions_addclose(&fa, out_fd); }
+    if (close_fd != -1) posix_spawn_file_actions_addclose(&fa, close_fd);
+
+    posix_spawnattr_init(&attr);
+    sigset_t def, none;
+    sigemptyset(&def);
+    sigaddset(&def, SIGINT); sigaddset(&def, SIGTSTP); sigaddset(&def, SIGQUIT);
+    sigaddset(&def, SIGCHLD); sigaddset(&def, SIGTTIN); sigaddset(&def, SIGTTOU);
+    sigemptyset(&none);
+    posix_spawnattr_setsigdefault(&attr, &def);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+#ifdef POSIX_SPAWN_TCSETPGROUP
+    if (!background) { flags |= POSIX_SPAWN_TCSETPGROUP; posix_spawnattr_tcsetpgrp_np(&attr, shell_terminal); }
+#else
+    (void)background;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid = -1;
+    int rc = exe ? posix_spawn(&pid, exe, &fa, &attr, argv, envp) : ENOENT;
+    /* hashed binary went away: retry with a full PATH walk */
+    if (rc == ENOENT && exe && !strchr(argv[0], '/')) rc = posix_spawnp(&pid, argv[0], &fa, &attr, argv, envp);
+    /* a script without #!: /bin/sh runs it, as execvp() would */
+    if (rc == ENOEXEC && exe) {
+        int n = 0;
+        while (argv[n]) n++;
+        char **sh = arena_alloc(&cmd_arena, (size_t)(n + 2) * sizeof(*sh));
+        sh[0] = "sh";
+        sh[1] = (char *)exe;
+        for (int i = 1; i <= n; ++i) sh[i + 1] = argv[i];
+        rc = posix_spawn(&pid, "/bin/sh", &fa, &attr, sh, envp);
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (rc != 0) { fprintf(stderr, "%s: %s\n", argv[0], strerror(rc)); return -1; }
+    return pid;
+}
+
+/* Where C's command is: looked up in its own PATH=... prefix if it has
+ * one, else through the shared cache. */
+static const char *command_path(const command_t *c) {
+    for (int i = c->nassigns - 1; i >= 0; --i)
+        if (strncmp(c->assigns[i], "PATH=", 5) == 0) return pathcache_lookup_in(c->argv[0], c->assigns[i] + 5);
+    return pathcache_lookup(c->argv[0]);
+}
+
+static pid_t launch_stage(char **argv, char **envp, const char *exe, pid_t pgid, int in_fd, int out_fd, int close_fd, int background) {
+    uint64_t t0 = stats_now();
+    /* posix_spawn cannot set affinity, niceness or a cgroup */
+    int use_fork = launcher == LAUNCH_FORK || placing || find_builtin(argv);
+#ifndef POSIX_SPAWN_TCSETPGROUP
+    /* without spawn-time tcsetpgrp a foreground child could read the tty before owning it */
+    if (!background) use_fork = 1;
+#endif
+    pid_t pid = use_fork ? fork_stage(argv, envp, exe, pgid, in_fd, out_fd, close_fd, background)
+                         : spawn_stage(argv, envp, exe, pgid, in_fd, out_fd, close_fd, background);
+    STATS_INC(use_fork ? STAT_FORKS : STAT_SPAWNS);
+    stats_since(STAT_LAUNCH, t0);
+    return pid;
+}
+
+static int launcher_builtin(char **argv) {
+    if (!argv[1]) { printf("%s\n", launcher == LAUNCH_SPAWN ? "spawn" : "fork"); return 0; }
+    if (strcmp(argv[1], "spawn") == 0) launcher = LAUNCH_SPAWN;
+    else if (strcmp(argv[1], "fork") == 0) launcher = LAUNCH_FORK;
+    else { fprintf(stderr, "launcher: usage: launcher [spawn|fork]\n"); return 2; }
+    return 0;
+}
+
+static int write_all(int fd, const char *s, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, s, n);
+        if (w < 0) { if (errno == EINTR) continue; return -1; }
+        s += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* A readable fd holding S.  Up to PIPE_BUF bytes fit in a pipe without
+ * blocking; anything larger goes into a memfd, so the shell never waits
+ * on the reader and nothing is written to disk. */
+static int heredoc_fd(const char *s, size_t n) {
+    int fd[2];
+    if (n <= PIPE_BUF) {
+        if (pipe2(fd, O_CLOEXEC) < 0) return -1;
+        write_all(fd[1], s, n);
+        close(fd[1]);
+        return fd[0];
+    }
+    int m = memfd_create("myshell-heredoc", MFD_CLOEXEC);
+    if (m < 0) return -1;
+    if (write_all(m, s, n) < 0 || lseek(m, 0, SEEK_SET) < 0) { close(m); return -1; }
+    return m;
+}
+
+/* Open a stage's redirections in order; later ones win.  Returns -1 (all
+ * fds closed) if any target cannot be opened. */
+static int open_redirs(const command_t *c, int *in_fd, int *out_fd) {
+    *in_fd = *out_fd = -1;
+    for (int j = 0; j < c->nredirs; ++j) {
+        const xredir_t *r = &c->redirs[j];
+        int fd;
+        int here = r->kind == REDIR_HEREDOC || r->kind == REDIR_HERESTR;
+        if (here) fd = heredoc_fd(r->path, r->len);
+        else if (r->kind == REDIR_IN) fd = open(r->path, O_RDONLY|O_CLOEXEC);
+        else if (r->kind == REDIR_OUT) fd = open(r->path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+        else fd = open(r->path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", here ? "here-document" : r->path, strerror(errno));
+            if (*in_fd != -1) close(*in_fd);
+            if (*out_fd != -1) close(*out_fd);
+            *in_fd = *out_fd = -1;
+            return -1;
+        }
+        int *slot = r->kind == REDIR_OUT || r->kind == REDIR_APPEND ? out_fd : in_fd;
+        if (*slot != -1) close(*slot);
+        *slot = fd;
     }
     return 0;
 }
 
-/* --- Execution: parse commands, handle redirection, pipes, background --- */
-
-/* Split line by pipes, respecting quotes */
-static char **split_pipes(const char *line, int *count) {
-    char **parts = calloc(MAX_TOKENS, sizeof(char*));
-    int np = 0;
-    size_t len = strlen(line);
-    size_t start = 0;
-    int in_sq = 0, in_dq = 0;
-    for (size_t i=0;i<=len;i++) {
-        char c = line[i];
-        if (c == '\0' || (c == '|' && !in_sq && !in_dq)) {
-            size_t partlen = i - start;
-            // trim
-            while (partlen>0 && isspace((unsigned char)line[start])) { start++; partlen--; }
-            while (partlen>0 && isspace((unsigned char)line[start+partlen-1])) partlen--;
-            char *part = strndup(line+start, partlen);
-            parts[np++] = part;
-            start = i+1;
-        } else if (c == '\'') in_sq = !in_sq;
-        else if (c == '"') in_dq = !in_dq;
-    }
-    parts[np] = NULL;
-    *count = np;
-    return parts;
-}
-
-static int execute_pipeline(char **cmds, int ncmds, const char *fullcmd, int background) {
+/* Launch every stage of an expanded pipeline.  Returns the pipeline's
+ * process group, or -1 if nothing was started.  With capture_fd set
+ * (command substitution) the stages join the shell's own process group,
+ * never take the terminal, and the last stage writes to capture_fd unless
+ * it redirects stdout itself.  Launched pids go to pids[] when non-NULL,
+ * and their stage indexes to stages[] when that is non-NULL too.
+ * With inproc_status set, a builtin last stage may run in the shell itself
+ * (see builtin_inproc_ok) and its exit status is stored there; otherwise
+ * it is set to -1.  Returns 0 if that was the only stage. */
+static pid_t launch_pipeline(command_t *cmds, int ncmds, int background, int capture_fd, pid_t *pids, int *stages, int *npids, int *inproc_status) {
     int prev_fd = -1;
     int pipefd[2];
-    pid_t pgid = 0;
+    /* captures and non-interactive runs keep children in the shell's group */
+    pid_t pgid = capture_fd != -1 || !interactive ? shell_pgid : 0;
+    if (capture_fd != -1 || !interactive) background = 1;
+    if (npids) *npids = 0;
+    if (inproc_status) *inproc_status = -1;
 
-    for (int i = 0; i < ncmds; ++i) {
-        char *expanded = expand_variables_and_subst(cmds[i]);
-        int argc = 0;
-        char **argv = tokenize(expanded, &argc);
-        free(expanded);
-        if (argc == 0) { free(argv); continue; }
+    /* children are only reaped from the main loop, so an early-exiting stage
+     * stays a zombie (keeping the pgid alive) until the rest are launched */
 
+    for (int i = 0; i < ncmds; ++i) {
+        command_t *c = &cmds[i];
         int in_fd = -1, out_fd = -1;
-        char **cleanargv = calloc(argc+1, sizeof(char*));
-        int ci = 0;
-        for (int j=0;j<argc;++j) {
-            if (strcmp(argv[j], "<") == 0) {
-                if (argv[j+1]) { in_fd = open(argv[j+1], O_RDONLY); if (in_fd<0) perror("open"); j++; }
-                else { fprintf(stderr, "syntax error near '<'\n"); }
-            } else if (strcmp(argv[j], ">") == 0) {
-                if (argv[j+1]) { out_fd = open(argv[j+1], O_WRONLY|O_CREAT|O_TRUNC, 0644); if (out_fd<0) perror("open"); j++; }
-                else { fprintf(stderr, "syntax error near '>'\n"); }
-            } else if (strcmp(argv[j], ">>") == 0) {
-                if (argv[j+1]) { out_fd = open(argv[j+1], O_WRONLY|O_CREAT|O_APPEND, 0644); if (out_fd<0) perror("open"); j++; }
-                else { fprintf(stderr, "syntax error near '>>'\n"); }
-            } else { cleanargv[ci++] = argv[j]; }
-        }
-        cleanargv[ci]=NULL;
-
-        if (i < ncmds-1) { if (pipe(pipefd) < 0) { perror("pipe"); return -1; } }
-
-        pid_t pid = fork();
-        if (pid < 0) { perror("fork"); return -1; }
-        else if (pid == 0) {
-            signal(SIGINT, SIG_DFL);
-            signal(SIGTSTP, SIG_DFL);
-            signal(SIGQUIT, SIG_DFL);
-            signal(SIGCHLD, SIG_DFL);
-
-            if (pgid == 0) pgid = getpid();
-            setpgid(0, pgid);
-
-            if (!background) tcsetpgrp(shell_terminal, pgid);
-
-            if (prev_fd != -1) { dup2(prev_fd, STDIN_FILENO); close(prev_fd); }
-            else if (in_fd != -1) { dup2(in_fd, STDIN_FILENO); close(in_fd); }
-
-            if (i < ncmds-1) { close(pipefd[0]); dup2(pipefd[1], STDOUT_FILENO); close(pipefd[1]); }
-            else if (out_fd != -1) { dup2(out_fd, STDOUT_FILENO); close(out_fd); }
-
-            if (is_builtin(cleanargv[0])) {
-                if (strcmp(cleanargv[0], "pwd") == 0 || strcmp(cleanargv[0], "mkdir") == 0 || strcmp(cleanargv[0], "touch") == 0 || strcmp(cleanargv[0], "history") == 0 || strcmp(cleanargv[0], "jobs") == 0) {
-                    run_builtin(cleanargv);
-                    _exit(0);
-                }
+        int failed = c->bad || open_redirs(c, &in_fd, &out_fd) < 0;
+        if (failed && i == ncmds-1 && inproc_status) *inproc_status = 1;
+        if (failed || c->argc == 0) {
+            if (in_fd != -1) close(in_fd);
+            if (out_fd != -1) close(out_fd);
+            /* a failed or empty stage writes nothing: the next one reads EOF */
+            if (i < ncmds-1 && pipe2(pipefd, O_CLOEXEC) == 0) {
+                close(pipefd[1]);
+                if (prev_fd != -1) close(prev_fd);
+                prev_fd = pipefd[0];
             }
+            continue;
+        }
 
-            execvp(cleanargv[0], cleanargv);
-            fprintf(stderr, "%s: %s\n", cleanargv[0], strerror(errno));
-            _exit(127);
-        } else {
-            if (pgid == 0) pgid = pid;
-            setpgid(pid, pgid);
+        /* close-on-exec so stages (and nested substitutions) only inherit their own ends */
+        if (i < ncmds-1) { if (pipe2(pipefd, O_CLOEXEC) < 0) { perror("pipe"); return -1; } }
 
-            if (prev_fd != -1) close(prev_fd);
-            if (i < ncmds-1) { close(pipefd[1]); prev_fd = pipefd[0]; }
-            else prev_fd = -1;
+        /* pipes take precedence over file redirections */
+        if (prev_fd != -1 && in_fd != -1) { close(in_fd); in_fd = -1; }
+        if (i < ncmds-1 && out_fd != -1) { close(out_fd); out_fd = -1; }
+        int stage_in = prev_fd != -1 ? prev_fd : in_fd;
+        int stage_out = i < ncmds-1 ? pipefd[1] : (out_fd != -1 ? out_fd : capture_fd);
+        int stage_close = i < ncmds-1 ? pipefd[0] : -1;
 
+        const builtin_t *b = find_builtin(c->argv);
+        if (i == ncmds-1 && inproc_status && !placing && builtin_inproc_ok(b, ncmds) &&
+            (b->fn != coreutils_cat || cat_inproc_ok(c->argv, stage_in))) {
+            struct rusage r0, r1;
+            int64_t t0 = 0;
+            if (timing) { t0 = now_ns(); getrusage(RUSAGE_SELF, &r0); }
+            *inproc_status = run_builtin_inproc(b, c->argv, stage_in, stage_out);
+            if (timing) {
+                getrusage(RUSAGE_SELF, &r1);
+                tv_sub(&r1.ru_utime, &r0.ru_utime);
+                tv_sub(&r1.ru_stime, &r0.ru_stime);
+                r1.ru_nvcsw -= r0.ru_nvcsw;
+                r1.ru_nivcsw -= r0.ru_nivcsw;
+                timing->inproc = 1;
+                timing->inproc_ns = now_ns() - t0;
+                timing->inproc_ru = r1;
+            }
+            if (prev_fd != -1) close(prev_fd);
+            prev_fd = -1;
             if (in_fd != -1) close(in_fd);
             if (out_fd != -1) close(out_fd);
+            break;
+        }
 
-            free(cleanargv);
-            free(argv);
+        /* resolve in the parent so the hash table persists across commands */
+        /* rebuilt first: the lookup reads $PATH from it */
+        char **envp = c->envp ? c->envp : vars_environ();
+        const char *exe = !b ? command_path(c) : NULL;
+
+        pid_t pid = launch_stage(c->argv, envp, exe, pgid, stage_in, stage_out, stage_close, background);
+        if (pid > 0) {
+            if (pgid == 0) pgid = pid;
+            setpgid(pid, pgid);
+            if (pids) {
+                if (stages) stages[*npids] = i;
+                pids[(*npids)++] = pid;
+            }
         }
+
+        if (prev_fd != -1) close(prev_fd);
+        if (i < ncmds-1) { close(pipefd[1]); prev_fd = pipefd[0]; }
+        else prev_fd = -1;
+
+        if (in_fd != -1) close(in_fd);
+        if (out_fd != -1) close(out_fd);
     }
+    if (prev_fd != -1) close(prev_fd);
+    if (pgid == 0 || (pids && *npids == 0)) return inproc_status && *inproc_status >= 0 ? 0 : -1;
+    return pgid;
+}
+
+/* Run a pipeline as a job; returns its exit status (0 once backgrounded).
+ * When `timing` is set the cost report is printed once it is done. */
+static int execute_pipeline(command_t *cmds, int ncmds, const char *fullcmd, int background) {
+    pid_t *pids = arena_calloc(&cmd_arena, ncmds, sizeof(pid_t));
+    int *stages = arena_calloc(&cmd_arena, ncmds, sizeof(int));
+    int npids = 0, inproc = -1;
+    int64_t t0 = timing ? now_ns() : 0;
+    STATS_INC(STAT_COMMANDS);
+    pid_t pgid = launch_pipeline(cmds, ncmds, background, -1, pids, stages, &npids, background ? NULL : &inproc);
+    if (timing) timing->spawn_ns = now_ns() - t0 - timing->inproc_ns;
+    if (pgid <= 0) {
+        if (timing && !background) report_time(timing, NULL, cmds, ncmds);
+        if (pgid == 0) return inproc;
+        return inproc >= 0 ? inproc : 1;
+    }
+
+    /* untracked children are still reaped, just never reported */
+    job_t *j = add_job(pgid, fullcmd, JOB_RUNNING, pids, npids);
+    if (!j) return 1;
+    for (int k = 0; k < npids; ++k) j->procs[k].stage = stages[k];
+    if (placing && placing->desc) j->place = xstrdup(placing->desc);
 
     if (background) {
-        add_job(pgid, fullcmd, JOB_RUNNING);
-        job_t *j = find_job_by_pgid(pgid);
-        if (j) printf("[%d] %d\n", j->id, (int)pgid);
+        number_job(j);
+        if (interactive) printf("[%d] %d\n", j->id, (int)pgid);
+        return 0;
+    }
+    if (interactive && tcsetpgrp(shell_terminal, pgid) < 0) perror("tcsetpgrp");
+    wait_for_job(j);
+    if (interactive) tcsetpgrp(shell_terminal, shell_pgid);
+    int st = j->state == JOB_STOPPED ? 128 + SIGTSTP : wait_status_code(j->status);
+    if (j->state == JOB_DONE) {
+        if (timing) report_time(timing, j, cmds, ncmds);
+        remove_job(j);
+    }
+    /* the pipeline's status is its last stage's, even when that ran in here */
+    return inproc >= 0 ? inproc : st;
+}
+
+/* --- Command lists: ; & && || --- */
+
+/* A command of nothing but NAME=value words sets shell variables; in the
+ * background it runs in a subshell, so it has no effect.  Its
+ * redirections are still opened (and truncated) and closed. */
+static int assign_only(const command_t *c, int background) {
+    int in_fd, out_fd;
+    if (c->bad || open_redirs(c, &in_fd, &out_fd) < 0) return 1;
+    if (in_fd != -1) close(in_fd);
+    if (out_fd != -1) close(out_fd);
+    if (background) return 0;
+    for (int i = 0; i < c->nassigns; ++i) vars_assign(c->assigns[i], 0);
+    return 0;
+}
+
+/* Run each pipeline of PL in turn, skipping those ruled out by a failed
+ * && or a successful ||.  Every item is expanded only when it is reached,
+ * so it sees the effects of the ones before it.  Returns the last status. */
+static int run_list(const pipeline_t *pl) {
+    list_op_t prev = LIST_SEQ;
+    for (int i = 0; i < pl->nitems; ++i) {
+        const list_item_t *it = &pl->items[i];
+        int run = prev == LIST_SEQ || (prev == LIST_AND) == (last_status == 0);
+        prev = it->op;
+        if (!run) continue;
+        pipetime_t tm = { .start_ns = now_ns(), .parse_ns = parse_ns };
+        command_t *cmds = expand_pipeline(pl, it);
+        tm.expand_ns = now_ns() - tm.start_ns;
+        stats_record(STAT_EXPAND, (uint64_t)tm.expand_ns);
+        if (it->nstages == 1 && cmds[0].argc == 0 && cmds[0].nassigns) {
+            last_status = assign_only(&cmds[0], it->background);
+            continue;
+        }
+        if (it->timed) timing = &tm;
+        char *text = arena_strndup(&cmd_arena, pl->raw + it->raw_off, it->raw_len);
+        place_t pc;
+        if (cmds[0].argc > 0 && strcmp(cmds[0].argv[0], "place") == 0) {
+            int k = place_parse(cmds[0].argv, &pc);
+            if (k < 0) { place_release(&pc); last_status = 2; timing = NULL; continue; }
+            cmds[0].argv += k;
+            cmds[0].argc -= k;
+            const builtin_t *pb = find_builtin(cmds[0].argv);
+            if (pb && (pb->flags & BI_PARENT)) {
+                /* it would change a forked child's state, not the shell's */
+                fprintf(stderr, "place: %s: cannot place a shell builtin\n", cmds[0].argv[0]);
+                place_release(&pc);
+                last_status = 2;
+                timing = NULL;
+                continue;
+            }
+            placing = &pc;
+        }
+        last_status = execute_pipeline(cmds, it->nstages, text, it->background);
+        if (placing) { place_release(&pc); placing = NULL; }
+        timing = NULL;
+    }
+    return last_status;
+}
+
+/* In a freshly forked child that runs shell code (a substituted list, a
+ * parallel task): drop the interactive setup, as a subshell would. */
+static void become_subshell(void) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    interactive = 0;
+    timing = NULL;
+    placing = NULL;
+    shell_pgid = getpgrp();
+}
+
+/* --- Command substitution: run through our own pipeline engine --- */
+
+static char *read_all_fd(int fd) {
+    size_t cap = 4096, len = 0;
+    char *out = arena_alloc(&cmd_arena, cap);
+    while (1) {
+        if (len + 1024 >= cap) { out = arena_realloc(&cmd_arena, out, cap, cap * 2); cap *= 2; }
+        ssize_t r = read(fd, out + len, cap - len - 1);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        len += (size_t)r;
+    }
+    out[len] = '\0';
+    while (len>0 && (out[len-1]=='\n' || out[len-1]=='\r')) { out[len-1]='\0'; len--; }
+    return out;
+}
+
+/* Output-only builtins run in the shell itself with stdout swapped to a memfd. */
+static char *capture_builtin(const builtin_t *b, char **argv) {
+    int mfd = memfd_create("myshell-subst", MFD_CLOEXEC);
+    if (mfd < 0) return arena_strdup(&cmd_arena, "");
+    run_builtin_inproc(b, argv, -1, mfd);
+    lseek(mfd, 0, SEEK_SET);
+    char *out = read_all_fd(mfd);
+    close(mfd);
+    return out;
+}
+
+/* A list runs in a forked child, as in a subshell. */
+static char *capture_list(const pipeline_t *pl) {
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) < 0) { perror("pipe"); return arena_strdup(&cmd_arena, ""); }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        become_subshell();
+        dup2(pfd[1], STDOUT_FILENO);
+        int st = run_list(pl);
+        fflush(stdout);
+        _exit(st);
+    }
+    close(pfd[1]);
+    char *out = pid > 0 ? read_all_fd(pfd[0]) : arena_strdup(&cmd_arena, "");
+    close(pfd[0]);
+    if (pid < 0) perror("fork");
+    else while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) ;
+    return out;
+}
+
+static char *capture_command(const char *cmd) {
+    pipeline_t *pl = parse_cached(cmd);
+    if (!pl) return arena_strdup(&cmd_arena, "");
+    if (pl->nitems > 1) {
+        char *out = capture_list(pl);
+        release_pipeline(pl);
+        return out;
+    }
+    const list_item_t *it = &pl->items[0];
+    command_t *cmds = expand_pipeline(pl, it);
+    char *out = NULL;
+    command_t *c0 = &cmds[0];
+    const builtin_t *b = c0->argc > 0 ? find_builtin(c0->argv) : NULL;
+
+    /* state-changing builtins get a child here, as in a subshell */
+    if (it->nstages == 1 && c0->nredirs == 0 && b && (b->flags & BI_INPROC) &&
+        (b->fn != coreutils_cat || cat_inproc_ok(c0->argv, -1))) {
+        out = capture_builtin(b, c0->argv);
     } else {
-        if (tcsetpgrp(shell_terminal, pgid) < 0) perror("tcsetpgrp");
-        int status;
-        pid_t w;
-        do {
-            w = waitpid(-pgid, &status, WUNTRACED);
-            if (w == -1 && errno != EINTR) break;
-            if (WIFSTOPPED(status)) {
-                add_job(pgid, fullcmd, JOB_STOPPED);
-                break;
+        int pfd[2];
+        if (pipe2(pfd, O_CLOEXEC) < 0) { perror("pipe"); out = arena_strdup(&cmd_arena, ""); }
+        else {
+            /* reap our own stages before the main loop's reaper sees them */
+            pid_t *pids = arena_calloc(&cmd_arena, it->nstages, sizeof(pid_t));
+            int npids = 0;
+            launch_pipeline(cmds, it->nstages, 1, pfd[1], pids, NULL, &npids, NULL);
+            close(pfd[1]);
+            out = read_all_fd(pfd[0]);
+            close(pfd[0]);
+            for (int i = 0; i < npids; ++i) {
+                int status;
+                while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR) ;
             }
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
-        tcsetpgrp(shell_terminal, shell_pgid);
+        }
     }
 
-    return 0;
+    release_pipeline(pl);
+    return out;
+}
+
+static char *run_command_capture(const char *cmd) {
+    uint64_t t0 = stats_now();
+    char *out = capture_command(cmd);
+    stats_since(STAT_SUBST, t0);
+    return out;
+}
+
+/* --- parallel: a bounded pool of task children --- */
+
+typedef struct {
+    job_t *job;             /* NULL once finished */
+    int out_fd;             /* -k: memfd holding the task's output, else -1 */
+    int done, status;
+} par_task_t;
+
+static void copy_fd_to_stdout(int fd) {
+    char buf[65536];
+    lseek(fd, 0, SEEK_SET);
+    ssize_t r;
+    while ((r = read(fd, buf, sizeof(buf))) > 0 || (r < 0 && errno == EINTR))
+        for (ssize_t off = 0; r > 0 && off < r; ) {
+            ssize_t w = write(STDOUT_FILENO, buf + off, (size_t)(r - off));
+            if (w < 0) { if (errno == EINTR) continue; return; }
+            off += w;
+        }
+}
+
+/* Fork a child that runs CMD as a command line. */
+static pid_t par_start(const char *cmd, int out_fd, int null_stdin) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    become_subshell();
+    if (null_stdin) {
+        int nul = open("/dev/null", O_RDONLY);
+        if (nul >= 0) { dup2(nul, STDIN_FILENO); close(nul); }
+    }
+    if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+    pipeline_t *pl = parse_cached(cmd);
+    int st = pl ? run_list(pl) : 2;
+    fflush(stdout);
+    _exit(st);
+}
+
+/* parallel [-j N] [-k] [command...]: run each argument (or each line of
+ * stdin) as a command line, at most N at once (default: online CPUs).
+ * Tasks are jobs like any other and are reaped through job_update().
+ * With -k each task's output is held in a memfd and written out in task
+ * order as soon as every earlier task has finished.  Exits with the number
+ * of failed tasks, capped at 101 as GNU parallel does. */
+static int bi_parallel(char **argv) {
+    long width = sysconf(_SC_NPROCESSORS_ONLN);
+    int keep = 0, i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        if (strcmp(argv[i], "-k") == 0) { keep = 1; continue; }
+        const char *v = strncmp(argv[i], "-j", 2) == 0 ? (argv[i][2] ? argv[i] + 2 : argv[++i]) : NULL;
+        char *end;
+        if (!v || (width = strtol(v, &end, 10)) < 1 || *end) {
+            fprintf(stderr, "parallel: usage: parallel [-j N] [-k] [command...]\n");
+            return 2;
+        }
+    }
+    if (width < 1) width = 1;
+
+    char **tasks = argv + i;
+    int ntasks = 0, from_stdin = !argv[i];
+    if (from_stdin) {
+        char *all = read_all_fd(STDIN_FILENO);
+        int cap = 0;
+        tasks = NULL;
+        for (char *l = all, *nl; l; l = nl) {
+            nl = strchr(l, '\n');
+            if (nl) *nl++ = '\0';
+            while (isspace((unsigned char)*l)) l++;
+            if (!*l) continue;
+            tasks = grow(&cmd_arena, tasks, &cap, ntasks, sizeof(char *));
+            tasks[ntasks++] = l;
+        }
+    } else {
+        while (tasks[ntasks]) ntasks++;
+    }
+    if (ntasks == 0) return 0;
+
+    par_task_t *t = arena_calloc(&cmd_arena, ntasks, sizeof(*t));
+    int *running = arena_calloc(&cmd_arena, (size_t)width, sizeof(int));
+    int nrunning = 0, next = 0, emitted = 0, failed = 0;
+    fflush(stdout);
+
+    while (emitted < ntasks) {
+        while (nrunning < width && next < ntasks) {
+            par_task_t *pt = &t[next];
+            pt->out_fd = keep ? memfd_create("myshell-parallel", MFD_CLOEXEC) : -1;
+            if (keep && pt->out_fd < 0) perror("parallel: memfd_create");
+            pid_t pid = par_start(tasks[next], pt->out_fd, from_stdin);
+            if (pid > 0) pt->job = add_job(pid, tasks[next], JOB_RUNNING, &pid, 1);
+            if (pid < 0) perror("parallel: fork");
+            if (pt->job) {
+                pt->job->foreground = 1;       /* ours to dispose of, never reported */
+                running[nrunning++] = next;
+            } else {
+                pt->done = 1;
+                pt->status = 1;
+                failed++;
+            }
+            next++;
+        }
+
+        if (nrunning > 0) {
+            int status;
+            struct rusage ru;
+            pid_t pid = wait4(-1, &status, 0, &ru);
+            if (pid < 0 && errno != EINTR) { perror("parallel: wait4"); break; }
+            if (pid > 0) job_update(pid, status, &ru);
+            for (int k = 0; k < nrunning; ++k) {
+                par_task_t *pt = &t[running[k]];
+                if (pt->job->state != JOB_DONE) continue;
+                pt->status = wait_status_code(pt->job->status);
+                if (pt->status != 0) failed++;
+                remove_job(pt->job);
+                pt->job = NULL;
+                pt->done = 1;
+                running[k--] = running[--nrunning];
+            }
+        }
+
+        while (emitted < next && t[emitted].done) {
+            if (t[emitted].out_fd >= 0) { copy_fd_to_stdout(t[emitted].out_fd); close(t[emitted].out_fd); }
+            emitted++;
+        }
+    }
+    return failed > 100 ? 101 : failed;
 }
 
 static void init_shell(void) {
     shell_terminal = STDIN_FILENO;
+    shell_pid = getpid();
+    vars_init(environ);
+    vars_environ();
+
+    /* MYSHELL_LAUNCHER=fork|spawn picks the process launcher (see `launcher`) */
+    const char *l = getenv("MYSHELL_LAUNCHER");
+    if (l && strcmp(l, "fork") == 0) launcher = LAUNCH_FORK;
+
+    /* MYSHELL_STATS_DUMP=file|unix:/socket [MYSHELL_STATS_INTERVAL=seconds] */
+    stats_reset();
+    const char *dump = getenv("MYSHELL_STATS_DUMP");
+    if (dump && *dump) {
+        const char *iv = getenv("MYSHELL_STATS_INTERVAL");
+        if (stats_dump_config(dump, iv ? (unsigned)atoi(iv) : 0) < 0)
+            fprintf(stderr, "myshell: stats dump %s: %s\n", dump, strerror(errno));
+    }
+
+    if (!interactive) {
+        /* no terminal to manage: stay in the caller's process group, and
+         * leave Ctrl-C and Ctrl-Z to stop the script as a whole */
+        shell_pgid = getpgrp();
+        return;
+    }
 
     /* Ignore terminal stop signals */
     signal(SIGTTOU, SIG_IGN);
     signal(SIGTTIN, SIG_IGN);
     signal(SIGTSTP, SIG_IGN);
 
-    /* Put shell in its own process group */
+    /* Put shell in its own process group (a session leader, as started by
+     * a terminal emulator, already leads one and may not call setpgid) */
     shell_pgid = getpid();
-    if (setpgid(shell_pgid, shell_pgid) < 0) {
+    if (getsid(0) != shell_pgid && setpgid(shell_pgid, shell_pgid) < 0) {
         perror("setpgid");
         exit(1);
     }
@@ -525,78 +2198,361 @@ static void init_shell(void) {
         perror("tcsetpgrp");
         exit(1);
     }
+    tcgetattr(shell_terminal, &shell_tmodes);
+
+    /* Tab completes builtins and the `time` keyword along with $PATH */
+    for (int i = 0; i < NBUILTINS; ++i) complete_add_command(builtins[i].name);
+    complete_add_command("time");
+    complete_add_command("place");
 
     /* Install handlers AFTER taking terminal */
     install_signal_handlers();
 }
 
 
+/* --- Coprocesses: one warm process, many requests --- */
+
+/* coproc [-n NAME] command...  starts COMMAND as a background job whose
+ * stdin and stdout are pipes held by the shell, and sets NAME_PID.
+ *   cowrite [-n NAME] word...           one line to its stdin
+ *   coread [-n NAME] [-t SECS] [VAR]    one line of its stdout into VAR
+ * NAME defaults to COPROC, VAR to REPLY.  Starting another coprocess
+ * under a name, or coproc -c [NAME], closes the old one's pipes so it
+ * sees EOF.  The command must flush each reply (python3 -u, sed -u). */
+typedef struct coproc {
+    char *name;
+    pid_t pid;
+    int to_fd, from_fd;     /* its stdin and stdout; close-on-exec here */
+    size_t start, len;      /* unread output: buf[start, start+len) */
+    char buf[4096];
+    struct coproc *next;
+} coproc_t;
+
+static coproc_t *coprocs;
+
+static coproc_t *find_coproc(const char *name) {
+    for (coproc_t *cp = coprocs; cp; cp = cp->next)
+        if (strcmp(cp->name, name) == 0) return cp;
+    return NULL;
+}
+
+static void coproc_close(coproc_t *cp) {
+    coproc_t **pp = &coprocs;
+    while (*pp != cp) pp = &(*pp)->next;
+    *pp = cp->next;
+    close(cp->to_fd);
+    close(cp->from_fd);
+    free(cp->name);
+    free(cp);
+}
+
+/* -n NAME (and -c, if CLOSE_IT is given); returns the index of the first
+ * operand, or -1 after printing USAGE. */
+static int coproc_opts(char **argv, const char **name, int *close_it, const char *usage) {
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "--") == 0) return i + 1;
+        if (close_it && strcmp(argv[i], "-c") == 0) { *close_it = 1; continue; }
+        if (strcmp(argv[i], "-n") == 0 && argv[i + 1]) { *name = argv[++i]; continue; }
+        break;
+    }
+    if (!vars_valid_name(*name, strlen(*name))) { fprintf(stderr, "%s\n", usage); return -1; }
+    return i;
+}
+
+static int bi_coproc(char **argv) {
+    const char *name = "COPROC";
+    int close_it = 0;
+    int i = coproc_opts(argv, &name, &close_it, "coproc: usage: coproc [-n name] command... | coproc -c [name]");
+    if (i < 0) return 2;
+    if (close_it) {
+        coproc_t *cp = find_coproc(argv[i] ? argv[i] : name);
+        if (!cp) { fprintf(stderr, "coproc: %s: no such coprocess\n", argv[i] ? argv[i] : name); return 1; }
+        coproc_close(cp);
+        return 0;
+    }
+    if (!argv[i]) { fprintf(stderr, "coproc: usage: coproc [-n name] command... | coproc -c [name]\n"); return 2; }
+
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0) { perror("coproc: pipe"); return 1; }
+    if (pipe2(out, O_CLOEXEC) < 0) { perror("coproc: pipe"); close(in[0]); close(in[1]); return 1; }
+    char **cmd = argv + i;
+    char **envp = vars_environ();
+    const char *exe = !find_builtin(cmd) ? pathcache_lookup(cmd[0]) : NULL;
+    pid_t pgid = interactive ? 0 : shell_pgid;
+    pid_t pid = launch_stage(cmd, envp, exe, pgid, in[0], out[1], in[1], 1);
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) { close(in[1]); close(out[0]); return 1; }
+    setpgid(pid, pgid ? pgid : pid);
+
+    coproc_t *old = find_coproc(name);
+    if (old) coproc_close(old);
+    coproc_t *cp = calloc(1, sizeof(*cp));
+    if (!cp || !(cp->name = xstrdup(name))) { perror("coproc"); free(cp); close(in[1]); close(out[0]); return 1; }
+    cp->pid = pid;
+    cp->to_fd = in[1];
+    cp->from_fd = out[0];
+    cp->next = coprocs;
+    coprocs = cp;
+
+    char text[1024], var[256], num[24];
+    size_t n = (size_t)snprintf(text, sizeof(text), "coproc %s:", name);
+    for (char **a = cmd; *a && n < sizeof(text); ++a) n += (size_t)snprintf(text + n, sizeof(text) - n, " %s", *a);
+    job_t *j = add_job(pgid ? pgid : pid, text, JOB_RUNNING, &pid, 1);
+    if (j) {
+        number_job(j);
+        if (interactive) printf("[%d] %d\n", j->id, (int)pid);
+    }
+    snprintf(var, sizeof(var), "%s_PID", name);
+    snprintf(num, sizeof(num), "%d", (int)pid);
+    vars_set(var, strlen(var), num, 0);
+    return 0;
+}
+
+static int bi_cowrite(char **argv) {
+    const char *name = "COPROC";
+    int i = coproc_opts(argv, &name, NULL, "cowrite: usage: cowrite [-n name] word...");
+    if (i < 0) return 2;
+    coproc_t *cp = find_coproc(name);
+    if (!cp) { fprintf(stderr, "cowrite: %s: no such coprocess\n", name); return 1; }
+    size_t n = 0;
+    for (int k = i; argv[k]; ++k) n += strlen(argv[k]) + 1;
+    char *line = arena_alloc(&cmd_arena, n + 1), *p = line;
+    for (int k = i; argv[k]; ++k) {
+        size_t l = strlen(argv[k]);
+        memcpy(p, argv[k], l);
+        p += l;
+        *p++ = argv[k + 1] ? ' ' : '\n';
+    }
+    if (p == line) *p++ = '\n';
+    if (write_all(cp->to_fd, line, (size_t)(p - line)) < 0) {
+        fprintf(stderr, "cowrite: %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+static int bi_coread(char **argv) {
+    const char *name = "COPROC";
+    int ms = -1, i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        if (strcmp(argv[i], "-n") == 0 && argv[i + 1]) { name = argv[++i]; continue; }
+        char *end;
+        double secs;
+        if (strcmp(argv[i], "-t") == 0 && argv[i + 1] && (secs = strtod(argv[i + 1], &end)) >= 0 && !*end) {
+            ms = (int)(secs * 1000);
+            i++;
+            continue;
+        }
+        break;
+    }
+    const char *var = argv[i] ? argv[i] : "REPLY";
+    if ((argv[i] && argv[i + 1]) || !vars_valid_name(var, strlen(var)) || !vars_valid_name(name, strlen(name))) {
+        fprintf(stderr, "coread: usage: coread [-n name] [-t secs] [var]\n");
+        return 2;
+    }
+    coproc_t *cp = find_coproc(name);
+    if (!cp) { fprintf(stderr, "coread: %s: no such coprocess\n", name); return 1; }
+    int64_t deadline = ms >= 0 ? now_ns() + (int64_t)ms * 1000000 : 0;
+    int st = 0;
+    char *nl;
+    while (!(nl = memchr(cp->buf + cp->start, '\n', cp->len))) {
+        if (cp->start + cp->len == sizeof(cp->buf)) {
+            if (cp->start == 0) break;   /* a full buffer without a newline is one line */
+            memmove(cp->buf, cp->buf + cp->start, cp->len);
+            cp->start = 0;
+        }
+        int left = ms < 0 ? -1 : (int)((deadline - now_ns()) / 1000000);
+        int w = wait_readable(cp->from_fd, left < 0 && ms >= 0 ? 0 : left);
+        if (w <= 0) return w < 0 ? 130 : 1;
+        ssize_t r = read(cp->from_fd, cp->buf + cp->start + cp->len, sizeof(cp->buf) - cp->start - cp->len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) { st = 1; break; }   /* EOF: whatever is left, as read does */
+        cp->len += (size_t)r;
+    }
+    size_t n = nl ? (size_t)(nl - (cp->buf + cp->start)) : cp->len;
+    char *val = arena_strndup(&cmd_arena, cp->buf + cp->start, n);
+    cp->start += n + (nl ? 1 : 0);
+    cp->len -= n + (nl ? 1 : 0);
+    if (cp->len == 0) cp->start = 0;
+    vars_set(var, strlen(var), val, 0);
+    return st;
+}
+
+/* --- Prompt --- */
+#define PS1_DEFAULT "\\e[1;32mmyshell\\e[0m:\\e[1;34m\\w\\e[0m$ "
+
+/* $(cmd) prompt segments run in a forked child through our own engine */
+static void prompt_runner(const char *cmd) {
+    shell_pgid = getpgrp();
+    char *out = run_command_capture(cmd);
+    if (out) fputs(out, stdout);
+    fflush(stdout);
+    _exit(0);
+}
+
+
 /* --- Main REPL --- */
+
+/* LINE plus the bodies of the here-documents it opens, read from the same
+ * input (interactively after a "> " prompt), one newline between lines.
+ * Lives in cmd_arena. */
+static char *read_heredocs(char *line) {
+    heredoc_t *hd;
+    int n = heredoc_scan(line, &cmd_arena, &hd);
+    if (n == 0) return line;
+    strbuf_t b = { .a = &cmd_arena };
+    sb_putn(&b, line, strlen(line));    /* the next read may move LINE */
+    for (int i = 0; i < n; ++i) {
+        while (1) {
+            if (interactive) { fputs("> ", stdout); fflush(stdout); }
+            char *l = interactive ? read_interactive_line() : read_command_line();
+            if (!l) break;
+            sb_putc(&b, '\n');
+            sb_putn(&b, l, strlen(l));
+            while (hd[i].strip && *l == '\t') l++;
+            if (strlen(l) == hd[i].dlen && memcmp(l, hd[i].delim, hd[i].dlen) == 0) break;
+        }
+    }
+    return b.s;
+}
+
+/* Point the input reader at the -c text or script ARGV names (stdin with
+ * neither, and only a terminal there makes the shell interactive).
+ * Returns 0, or the exit status if that fails. */
+static int open_input(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) { fprintf(stderr, "myshell: -c: option requires an argument\n"); return 2; }
+        in_len = strlen(argv[2]);
+        in_cap = in_len + 1;
+        in_buf = malloc(in_cap);
+        if (!in_buf) { perror("malloc"); return 2; }
+        memcpy(in_buf, argv[2], in_cap);
+        input_fd = -1;
+    } else if (argc > 1) {
+        input_fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (input_fd < 0) { fprintf(stderr, "myshell: %s: %s\n", argv[1], strerror(errno)); return 127; }
+    } else {
+        interactive = isatty(STDIN_FILENO);
+    }
+    return 0;
+}
+
+static int run_input(void);
+
+/* What the workers inherit: the $PATH executables, listed once here, so
+ * their lookups skip the PATH walk. */
+static int warm_name(const char *name, void *arg) { (void)name; (void)arg; return 0; }
+static void server_warm(void) { pathcache_complete("", warm_name, NULL); }
+
+/* One --server request, in a worker forked from the warm server; the
+ * client's environment replaces the server's. */
+static int serve_request(int argc, char **argv, char **envp) {
+    if (argc < 2) return 2;
+    vars_free();
+    vars_init(envp);
+    vars_environ();
+    shell_pid = getpid();
+    shell_pgid = getpgrp();
+    int st = open_input(argc, argv);
+    return st ? st : run_input();
+}
+
+/* myshell --server [-j N] [socket]: N idle workers (default 2); the socket
+ * defaults to $MYSHELL_SERVER. */
+static int run_server(int argc, char **argv) {
+    long workers = 2;
+    int i = 2;
+    if (i < argc && strncmp(argv[i], "-j", 2) == 0) {
+        const char *v = argv[i][2] ? argv[i] + 2 : argv[++i];
+        char *end;
+        if (!v || (workers = strtol(v, &end, 10)) < 1 || *end) workers = 0;
+        i++;
+    }
+    const char *path = i < argc ? argv[i] : getenv("MYSHELL_SERVER");
+    if (workers < 1 || !path || !*path || (i < argc && i + 1 < argc)) {
+        fprintf(stderr, "myshell: usage: myshell --server [-j N] [socket]\n");
+        return 2;
+    }
+    init_shell();
+    server_warm();
+    return server_main(path, (int)workers, serve_request, server_warm);
+}
+
+/* myshell [-c command | script] | --server ...: see open_input and
+ * run_server. */
 int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--server") == 0) return run_server(argc, argv);
+    const char *srv = getenv("MYSHELL_SERVER");
+    if (argc > 1 && srv && *srv) {
+        int st = server_client(srv, argc, argv);
+        if (st >= 0) return st;
+    }
+    int st = open_input(argc, argv);
+    if (st) return st;
     init_shell();
 
-    /* prepare history path and load history */
-    const char *homedir = getenv("HOME");
-    if (!homedir) homedir = getpwuid(getuid())->pw_dir;
-    snprintf(histpath_global, sizeof(histpath_global), "%s/%s", homedir, HISTORY_FILE);
-    load_history_file(histpath_global);
+    if (interactive) {
+        /* prepare history path and load history */
+        const char *homedir = getenv("HOME");
+        if (!homedir) homedir = getpwuid(getuid())->pw_dir;
+        snprintf(histpath_global, sizeof(histpath_global), "%s/%s", homedir, HISTORY_FILE);
+        uint64_t t0 = stats_now();
+        history_init(HISTORY_MAX);
+        history_load(histpath_global);
+        history_open(histpath_global);
+        history_compact_bg(histpath_global, HISTORY_MAX);
+        stats_since(STAT_HISTORY, t0);
+
+        prompt_init(PS1_DEFAULT, prompt_runner);
+    }
+
+    run_input();
+    free(in_buf);
+    if (interactive) { lineedit_free(); complete_free(); }
+    vars_free();
 
+    /* cleanup history memory */
+    history_free();
+    return last_status;
+}
+
+/* Read, parse and run lines until end of input; returns the last status. */
+static int run_input(void) {
     while (1) {
-        char cwd[4096]; if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "?");
-        char prompt[512]; snprintf(prompt, sizeof(prompt), "\033[1;32mmyshell\033[0m:\033[1;34m%s\033[0m$ ", cwd);
-        // print prompt and read line using getline
-        printf("%s", prompt);
-        fflush(stdout);
+        /* job reports only at prompt boundaries, never mid-command */
+        stats_tick();
+        vars_environ();     /* prompt and completion read the environment too */
+        reap_children();
+        notify_jobs();
+        if (interactive) prompt_show();
 
-        char *line = NULL;
-        size_t len = 0;
-        ssize_t nread = getline(&line, &len, stdin);
-        if (nread == -1) {
-            if (feof(stdin)) { printf("\n"); break; }
-            free(line);
-            continue;
-        }
-        // trim newline
-        if (nread>0 && line[nread-1]=='\n') line[nread-1] = '\0';
+        char *line = interactive ? read_interactive_line() : read_command_line();
+        if (!line) { if (interactive) printf("\n"); break; }
         char *trim = line;
         while (*trim && isspace((unsigned char)*trim)) trim++;
-        if (*trim == '\0') { free(line); continue; }
-
-        add_history_inmem_and_file(trim);
-
-        // detect background '&' at end
-        int background = 0;
-        size_t L = strlen(trim);
-        while (L>0 && isspace((unsigned char)trim[L-1])) L--;
-        if (L>0 && trim[L-1]=='&') { background = 1; trim[L-1] = '\0'; while (L>0 && isspace((unsigned char)trim[L-1])) { trim[L-1]='\0'; L--; } }
-
-        // split by pipes
-        int ncmds = 0;
-        char **parts = split_pipes(trim, &ncmds);
-
-        // single builtin that affects shell: run directly
-        if (ncmds == 1) {
-            int argc2 = 0;
-            char *expanded = expand_variables_and_subst(parts[0]);
-            char **tmp = tokenize(expanded, &argc2);
-            free(expanded);
-            if (argc2 > 0 && is_builtin(tmp[0])) {
-                if (strcmp(tmp[0], "cd")==0 || strcmp(tmp[0], "exit")==0) {
-                    run_builtin(tmp);
-                    for (int i=0;i<argc2;i++) free(tmp[i]); free(tmp);
-                    free(parts[0]); free(parts); free(line);
-                    continue;
-                }
-            }
-            for (int i=0;i<argc2;i++) free(tmp[i]); free(tmp);
-        }
+        if (*trim == '\0' || *trim == '#') continue;    /* blank, comment or #! line */
 
-        execute_pipeline(parts, ncmds, trim, background);
+        if (interactive) add_history_inmem_and_file(trim);
+        trim = read_heredocs(trim);
 
-        for (int i=0;i<ncmds;i++) free(parts[i]); free(parts); free(line);
-    }
+        int64_t t0 = now_ns();
+        pipeline_t *pl = parse_cached(trim);
+        parse_ns = now_ns() - t0;
+        stats_record(STAT_PARSE, (uint64_t)parse_ns);
+        if (!pl) { last_status = 2; continue; }
 
-    /* cleanup history memory */
-    for (int i=0;i<history_count;i++) free(history_arr[i]);
-    return 0;
+        /* each item is expanded once; builtins run in the shell where the registry allows */
+        run_list(pl);
+
+        release_pipeline(pl);
+
+        /* the pipeline is launched; drop this line's parse/expand memory at once */
+        last_cmd_allocs = cmd_arena.nallocs;
+        last_cmd_bytes = cmd_arena.bytes;
+        arena_reset(&cmd_arena);
+    }
+    return last_status;
 }
@@ -0,0 +1,586 @@
+/*
+ * history.c -- ring-buffer history store over a compacted string pool.
+ *
+ * ring[] holds (offset, length) pairs into pool[].  Text is appended at
+ * the end of the pool; entries that fall off the ring leave dead bytes
+ * behind, which are reclaimed by compacting live text to the front when
+ * the pool fills.  The pool is kept at least twice the live size, so each
+ * compaction pays for itself over the appends that follow.  Lines loaded
+ * from the history file stay in a copy of its tail in front of the ring,
+ * read in only as far back as asked for.
+ *
+ * The file itself is rewritten now and then by a background child (see
+ * Compaction below): newest copy of each line kept, trimmed to the ring's
+ * capacity, swapped in with rename(2).  Writers append under a shared
+ * flock on PATH.lock and reopen PATH once the file they hold is unlinked,
+ * so no session's lines land in a replaced file.
+ */
+#define _GNU_SOURCE
+#include "history.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct { uint32_t off, len; } hist_entry_t;
+
+static hist_entry_t *ring;
+static size_t ring_cap;
+static size_t ring_head;       /* index of the oldest entry */
+static size_t ring_count;
+static unsigned long total_added;
+
+static char *pool;
+static size_t pool_used, pool_cap;
+
+void history_init(size_t capacity) {
+    history_free();
+    ring_cap = capacity ? capacity : 1;
+    ring = calloc(ring_cap, sizeof(*ring));
+}
+
+static void file_unmap(void);
+
+void history_free(void) {
+    file_unmap();
+    free(ring);
+    free(pool);
+    ring = NULL;
+    pool = NULL;
+    ring_cap = ring_head = ring_count = 0;
+    pool_used = pool_cap = 0;
+    total_added = 0;
+}
+
+static hist_entry_t *entry(size_t i) { return &ring[(ring_head + i) % ring_cap]; }
+
+/* Make room for NEED more bytes: slide live text to the front in ring order,
+ * then grow if live text would still fill more than half the pool. */
+static int pool_reserve(size_t need) {
+    if (pool_used + need <= pool_cap) return 0;
+    size_t live = 0;
+    for (size_t i = 0; i < ring_count; ++i) live += entry(i)->len + 1;
+    size_t want = pool_cap ? pool_cap : 4096;
+    while (want < 2 * (live + need)) want *= 2;
+    char *np = want == pool_cap ? pool : malloc(want);
+    if (!np) return -1;
+    size_t w = 0;
+    for (size_t i = 0; i < ring_count; ++i) {
+        hist_entry_t *e = entry(i);
+        memmove(np + w, pool + e->off, e->len + 1);  /* w <= e->off within one pool */
+        e->off = (uint32_t)w;
+        w += e->len + 1;
+    }
+    if (np != pool) { free(pool); pool = np; pool_cap = want; }
+    pool_used = w;
+    return 0;
+}
+
+void history_add(const char *line) {
+    if (!line || !*line) return;
+    if (!ring) history_init(HISTORY_MAX);
+    size_t len = strlen(line);
+    if (len >= UINT32_MAX / 4) return;
+    if (ring_count == ring_cap) { ring_head = (ring_head + 1) % ring_cap; ring_count--; }
+    if (pool_reserve(len + 1) < 0) return;
+    hist_entry_t *e = entry(ring_count);
+    e->off = (uint32_t)pool_used;
+    e->len = (uint32_t)len;
+    memcpy(pool + pool_used, line, len + 1);
+    pool_used += len + 1;
+    ring_count++;
+    total_added++;
+}
+
+/* --- File tier ---
+ *
+ * The history file read at startup stays open and its bytes are copied
+ * in from the end with pread(), only as far back as a caller asks for:
+ * reaching the newest entries (arrow keys) costs one read of the tail,
+ * regardless of file size; only `history` and searches read the lot.
+ * No mapping is kept, so another process truncating the file cannot
+ * fault the shell; bytes that have gone read as empty lines, which are
+ * skipped.  The descriptor pins the inode, so a compaction renaming a
+ * new file into place does not disturb the copy either.  At most ring_cap
+ * file lines are ever indexed, and they give way to session lines as the
+ * ring fills.
+ */
+#define FILE_CHUNK 65536
+
+typedef struct { size_t off; uint32_t len; } file_line_t;
+
+static int ffd = -1;
+static size_t flen;            /* file size at load */
+static char *fbuf;             /* bytes [fbase, flen) of the file */
+static size_t fbase;
+static size_t fscan;           /* [0, fscan) not yet indexed */
+static file_line_t *flines;    /* flines[k]: k-th newest file line */
+static size_t nflines, flines_cap;
+static long fcount_all = -1;   /* non-empty lines in the whole file, lazily */
+static char *scratch;          /* materialized file line */
+static size_t scratch_cap;
+
+static void file_unmap(void) {
+    if (ffd >= 0) close(ffd);
+    free(fbuf);
+    free(flines);
+    free(scratch);
+    ffd = -1;
+    fbuf = NULL;
+    flines = NULL;
+    scratch = NULL;
+    flen = fbase = fscan = nflines = flines_cap = scratch_cap = 0;
+    fcount_all = -1;
+}
+
+/* File byte OFF, which must already be copied in. */
+static const char *fat(size_t off) { return fbuf + (off - fbase); }
+
+/* Copy in at least twice as much as before, down to offset FROM at the
+ * least; 0 once [FROM, flen) is held, -1 if memory ran out. */
+static int file_extend(size_t from) {
+    if (from >= fbase) return 0;
+    size_t have = flen - fbase, grow = have > FILE_CHUNK ? have : FILE_CHUNK;
+    size_t nbase = fbase > grow ? fbase - grow : 0;
+    if (nbase > from) nbase = from;
+    char *nb = malloc(flen - nbase);
+    if (!nb) return -1;
+    size_t n = fbase - nbase, got = 0;
+    while (got < n) {
+        ssize_t r = pread(ffd, nb + got, n - got, (off_t)(nbase + got));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        got += (size_t)r;
+    }
+    memset(nb + got, '\n', n - got);   /* truncated since: empty lines */
+    if (have) memcpy(nb + n, fbuf, have);
+    free(fbuf);
+    fbuf = nb;
+    fbase = nbase;
+    return 0;
+}
+
+/* File lines that may still be indexed (the ring has room for them). */
+static size_t file_room(void) { return ring_cap - ring_count; }
+
+/* Index backwards until K+1 file lines are known or the file/room runs out. */
+static void file_index(size_t k) {
+    while (nflines <= k && fscan > 0 && nflines < ring_cap) {
+        size_t end = fscan;
+        const char *nl;
+        /* the line starts after the previous newline, which may not be in yet */
+        while (!(nl = memrchr(fat(fbase), '\n', end - fbase)) && fbase > 0)
+            if (file_extend(fbase - 1) < 0) { fscan = 0; return; }
+        size_t start = nl ? (size_t)(nl - fbuf) + fbase + 1 : 0;
+        fscan = start ? start - 1 : 0;
+        size_t len = end - start;
+        while (len > 0 && *fat(start + len - 1) == '\r') len--;
+        if (len == 0 || len >= UINT32_MAX / 4) continue;
+        if (nflines == flines_cap) {
+            size_t nc = flines_cap ? flines_cap * 2 : 256;
+            if (nc > ring_cap) nc = ring_cap;
+            file_line_t *nf = realloc(flines, nc * sizeof(*nf));
+            if (!nf) { fscan = 0; return; }
+            flines = nf;
+            flines_cap = nc;
+        }
+        flines[nflines].off = start;
+        flines[nflines].len = (uint32_t)len;
+        nflines++;
+    }
+}
+
+static size_t file_visible(void) {
+    file_index(SIZE_MAX - 1);
+    size_t room = file_room();
+    return nflines < room ? nflines : room;
+}
+
+static const char *file_get(size_t k) {
+    if (k >= file_room()) return NULL;
+    file_index(k);
+    if (k >= nflines) return NULL;
+    file_line_t *l = &flines[k];
+    if (l->len + 1 > scratch_cap) {
+        size_t nc = scratch_cap ? scratch_cap : 128;
+        while (nc < l->len + 1) nc *= 2;
+        char *ns = realloc(scratch, nc);
+        if (!ns) return NULL;
+        scratch = ns;
+        scratch_cap = nc;
+    }
+    memcpy(scratch, fat(l->off), l->len);
+    scratch[l->len] = '\0';
+    return scratch;
+}
+
+size_t history_len(void) { return file_visible() + ring_count; }
+
+const char *history_get_recent(size_t k) {
+    if (k < ring_count) return pool + entry(ring_count - 1 - k)->off;
+    return ffd >= 0 ? file_get(k - ring_count) : NULL;
+}
+
+const char *history_get(size_t i) {
+    size_t n = history_len();
+    if (i >= n) return NULL;
+    return history_get_recent(n - 1 - i);
+}
+
+/* Lines older than the indexed ones are counted once per load and the
+ * count kept; the file copy it needs stays for later lookups too. */
+unsigned long history_first_number(void) {
+    size_t n = history_len();
+    if (ffd >= 0 && fcount_all < 0) {
+        long c = (long)nflines;
+        if (file_extend(0) == 0) {
+            for (size_t p = 0; p < fscan; ) {
+                const char *nl = memchr(fat(p), '\n', fscan - p);
+                size_t e = nl ? (size_t)(nl - fbuf) + fbase : fscan;
+                size_t len = e - p;
+                while (len > 0 && *fat(p + len - 1) == '\r') len--;
+                if (len) c++;
+                p = e + 1;
+            }
+        }
+        fcount_all = c;
+    }
+    unsigned long all = (fcount_all > 0 ? (unsigned long)fcount_all : 0) + total_added;
+    return all - n + 1;
+}
+
+void history_load(const char *path) {
+    if (!ring) history_init(HISTORY_MAX);
+    file_unmap();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) { close(fd); return; }
+    ffd = fd;
+    flen = fbase = fscan = (size_t)st.st_size;
+    if (file_extend(flen - 1) < 0) { file_unmap(); return; }
+    if (*fat(fscan - 1) == '\n') fscan--;
+}
+
+/* --- Buffered writer --- */
+
+static int hist_fd = -1;
+static int lock_fd = -1;                 /* PATH.lock, shared with compaction */
+static char hist_path[4096];
+static pid_t hist_owner;                 /* forked children must not flush */
+static int sync_each;                    /* MYSHELL_HISTORY_SYNC=fsync */
+static char wbuf[HISTORY_BUF_SIZE];
+static volatile size_t wlen;
+static volatile sig_atomic_t in_update;  /* main code is touching wbuf */
+static volatile sig_atomic_t flush_due;  /* timer fired during an update */
+static volatile sig_atomic_t timer_armed;
+
+static void write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t r = write(fd, p, n);
+        if (r < 0) { if (errno == EINTR) continue; return; }
+        p += r;
+        n -= (size_t)r;
+    }
+}
+
+/* Append whole lines under the shared lock.  A compaction may have
+ * renamed a new file over PATH; the one we hold is then unlinked and we
+ * follow PATH to its replacement.  Async-signal-safe (flock, fstat, open,
+ * dup3, write). */
+static void append_locked(const char *p, size_t n) {
+    if (lock_fd >= 0) flock(lock_fd, LOCK_SH);
+    struct stat st;
+    if (fstat(hist_fd, &st) == 0 && st.st_nlink == 0) {
+        int fd = open(hist_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (fd >= 0) { dup3(fd, hist_fd, O_CLOEXEC); close(fd); }
+    }
+    write_all(hist_fd, p, n);
+    if (lock_fd >= 0) flock(lock_fd, LOCK_UN);
+}
+
+/* Async-signal-safe: only append_locked() on the static buffer. */
+static void flush_raw(void) {
+    if (hist_fd < 0 || wlen == 0) return;
+    append_locked(wbuf, wlen);
+    wlen = 0;
+}
+
+static void alarm_handler(int sig) {
+    (void)sig;
+    int saved = errno;
+    if (in_update) flush_due = 1;
+    else flush_raw();
+    timer_armed = 0;
+    errno = saved;
+}
+
+static void fatal_handler(int sig) {
+    if (getpid() == hist_owner && !in_update) flush_raw();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void arm_timer(void) {
+    if (timer_armed) return;
+    struct itimerval it = { {0, 0}, {HISTORY_FLUSH_SECS, 0} };
+    timer_armed = 1;
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+static void close_at_exit(void) {
+    if (getpid() == hist_owner) history_close();
+}
+
+int history_open(const char *path) {
+    if (hist_fd >= 0) history_close();
+    hist_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (hist_fd < 0) return -1;
+    hist_owner = getpid();
+    snprintf(hist_path, sizeof(hist_path), "%s", path);
+    char lock[sizeof(hist_path) + 8];
+    snprintf(lock, sizeof(lock), "%s.lock", path);
+    lock_fd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    const char *mode = getenv("MYSHELL_HISTORY_SYNC");
+    if (mode && strcmp(mode, "fsync") == 0) sync_each = 1;
+
+    static int installed;
+    if (!installed) {
+        installed = 1;
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sigemptyset(&sa.sa_mask);
+        sa.sa_handler = alarm_handler;
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGALRM, &sa, NULL);
+        sa.sa_handler = fatal_handler;
+        sa.sa_flags = 0;
+        int fatal[] = { SIGHUP, SIGTERM, SIGSEGV, SIGBUS, SIGABRT, SIGFPE };
+        for (size_t i = 0; i < sizeof(fatal) / sizeof(fatal[0]); ++i) {
+            struct sigaction old;
+            /* keep signals the caller chose to ignore ignored */
+            if (sigaction(fatal[i], NULL, &old) == 0 && old.sa_handler == SIG_IGN) continue;
+            sigaction(fatal[i], &sa, NULL);
+        }
+        atexit(close_at_exit);
+    }
+    return 0;
+}
+
+void history_save(const char *line) {
+    if (hist_fd < 0 || !line || !*line) return;
+    size_t n = strlen(line);
+    in_update = 1;
+    if (wlen + n + 1 > sizeof(wbuf)) flush_raw();
+    if (n + 1 > sizeof(wbuf)) {
+        /* one append, so a compaction never sees half of it */
+        char *big = malloc(n + 1);
+        if (big) {
+            memcpy(big, line, n);
+            big[n] = '\n';
+            append_locked(big, n + 1);
+            free(big);
+        }
+    } else {
+        memcpy(wbuf + wlen, line, n);
+        wbuf[wlen + n] = '\n';
+        wlen += n + 1;
+    }
+    if (sync_each) { flush_raw(); fdatasync(hist_fd); }
+    in_update = 0;
+    if (flush_due) { flush_due = 0; history_flush(); }
+    if (wlen) arm_timer();
+}
+
+void history_flush(void) {
+    in_update = 1;
+    flush_raw();
+    in_update = 0;
+    flush_due = 0;
+}
+
+void history_close(void) {
+    if (hist_fd < 0) return;
+    history_flush();
+    if (timer_armed) {
+        struct itimerval off = { {0, 0}, {0, 0} };
+        setitimer(ITIMER_REAL, &off, NULL);
+        timer_armed = 0;
+    }
+    close(hist_fd);
+    hist_fd = -1;
+    if (lock_fd >= 0) close(lock_fd);
+    lock_fd = -1;
+}
+
+/* --- Compaction ---
+ *
+ * The size to scan is taken with the lock held exclusively, just long
+ * enough for an fstat, so it falls between whole appends.  The file is
+ * then read without the lock from a private map, newest line first; a
+ * hash set of the lines kept so far drops older duplicates.  The
+ * survivors go to PATH.<pid>.tmp oldest first.  Only then is the lock
+ * taken exclusively again, for as long as it takes to copy whatever was
+ * appended since the snapshot, fsync and rename.  Writers wait on that
+ * lock, never on the scan.
+ */
+typedef struct { uint64_t hash; size_t off; uint32_t len; } kept_t;
+
+static uint64_t fnv1a(const char *p, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) { h ^= (unsigned char)p[i]; h *= 1099511628211ULL; }
+    return h;
+}
+
+static int copy_range(int in, int out, off_t from, off_t to) {
+    char buf[65536];
+    while (from < to) {
+        size_t want = (size_t)(to - from) < sizeof(buf) ? (size_t)(to - from) : sizeof(buf);
+        ssize_t r = pread(in, buf, want, from);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        if (write(out, buf, (size_t)r) != r) return -1;
+        from += r;
+    }
+    return 0;
+}
+
+/* Write the newest KEEP distinct lines of M[0, N) to OUT, oldest first. */
+static int compact_lines(const char *m, size_t n, size_t keep, int out) {
+    size_t cap = 64;
+    while (cap < 2 * keep) cap *= 2;
+    kept_t *set = calloc(cap, sizeof(*set));
+    size_t *order = malloc(keep * sizeof(*order));
+    if (!set || !order) { free(set); free(order); return -1; }
+    size_t nkept = 0, end = n;
+    while (end > 0 && nkept < keep) {
+        const char *nl = memrchr(m, '\n', end);
+        size_t start = nl ? (size_t)(nl - m) + 1 : 0;
+        size_t len = end - start;
+        end = nl ? (size_t)(nl - m) : 0;
+        while (len > 0 && m[start + len - 1] == '\r') len--;
+        if (len == 0 || len >= UINT32_MAX / 4) continue;
+        uint64_t h = fnv1a(m + start, len);
+        size_t b = h & (cap - 1);
+        int dup = 0;
+        for (; set[b].len; b = (b + 1) & (cap - 1))
+            if (set[b].hash == h && set[b].len == len && memcmp(m + set[b].off, m + start, len) == 0) { dup = 1; break; }
+        if (dup) continue;
+        set[b] = (kept_t){ h, start, (uint32_t)len };
+        order[nkept++] = b;
+    }
+    /* one buffered pass, oldest first */
+    int rc = 0;
+    char buf[65536];
+    size_t used = 0;
+    for (size_t k = nkept; k-- > 0 && rc == 0; ) {
+        const kept_t *e = &set[order[k]];
+        if (used + e->len + 1 > sizeof(buf)) {
+            if (write(out, buf, used) != (ssize_t)used) rc = -1;
+            used = 0;
+        }
+        if (e->len + 1 > sizeof(buf)) {
+            if (write(out, m + e->off, e->len) != (ssize_t)e->len || write(out, "\n", 1) != 1) rc = -1;
+            continue;
+        }
+        memcpy(buf + used, m + e->off, e->len);
+        buf[used + e->len] = '\n';
+        used += e->len + 1;
+    }
+    if (rc == 0 && used && write(out, buf, used) != (ssize_t)used) rc = -1;
+    free(set);
+    free(order);
+    return rc;
+}
+
+int history_compact(const char *path, size_t keep) {
+    if (!keep) keep = HISTORY_MAX;
+    char tmp[4096 + 32], lock[4096 + 8];
+    snprintf(lock, sizeof(lock), "%s.lock", path);
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int lfd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    int out = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    struct stat st, now;
+    int rc = -1;
+    void *m = MAP_FAILED;
+    /* the size with no append in progress, so the scan never sees half a
+     * line (writers hold the lock shared while they write) */
+    if (lfd < 0 || out < 0 || flock(lfd, LOCK_EX) < 0) goto done;
+    int ok = fstat(fd, &st);
+    flock(lfd, LOCK_UN);
+    if (ok < 0) goto done;
+    if (st.st_size > 0) {
+        m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED || compact_lines(m, (size_t)st.st_size, keep, out) < 0) goto done;
+    }
+    if (flock(lfd, LOCK_EX) < 0) goto done;
+    /* another compaction got there first: its file is the one writers use */
+    if (stat(path, &now) == 0 && now.st_ino == st.st_ino && now.st_dev == st.st_dev &&
+        fstat(fd, &now) == 0 && copy_range(fd, out, st.st_size, now.st_size) == 0 &&
+        fdatasync(out) == 0 && rename(tmp, path) == 0) {
+        rc = 0;
+        /* the size it was left at, for history_compact_bg() */
+        struct stat done_st;
+        if (fstat(out, &done_st) == 0) {
+            char num[32];
+            int len = snprintf(num, sizeof(num), "%lld\n", (long long)done_st.st_size);
+            if (ftruncate(lfd, 0) == 0) write_all(lfd, num, (size_t)len);
+        }
+    }
+    flock(lfd, LOCK_UN);
+done:
+    if (m != MAP_FAILED) munmap(m, (size_t)st.st_size);
+    if (out >= 0) { close(out); if (rc < 0) unlink(tmp); }
+    if (lfd >= 0) close(lfd);
+    close(fd);
+    return rc;
+}
+
+/* Size of PATH after its last compaction, as left in PATH.lock; 0 if none. */
+static off_t compacted_size(const char *path) {
+    char lock[4096 + 8], num[32];
+    snprintf(lock, sizeof(lock), "%s.lock", path);
+    int fd = open(lock, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, num, sizeof(num) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    num[n] = '\0';
+    return (off_t)strtoll(num, NULL, 10);
+}
+
+void history_compact_bg(const char *path, size_t keep) {
+    struct stat st;
+    if (stat(path, &st) < 0 || st.st_size < HISTORY_COMPACT_BYTES) return;
+    /* a file that compacts to more than the threshold must grow by half
+     * again first, or every start would rewrite it for nothing */
+    off_t last = compacted_size(path);
+    if (st.st_size < last + last / 2) return;
+    /* a grandchild, so neither front end has a child of its own to reap */
+    pid_t pid = fork();
+    if (pid < 0) return;
+    if (pid == 0) {
+        if (fork() == 0) {
+            signal(SIGINT, SIG_IGN);
+            signal(SIGQUIT, SIG_IGN);
+            signal(SIGTSTP, SIG_IGN);
+            signal(SIGHUP, SIG_IGN);
+            _exit(history_compact(path, keep) < 0);
+        }
+        _exit(0);
+    }
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) ;
+}
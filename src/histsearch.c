@@ -0,0 +1,182 @@
+/*
+ * histsearch.c -- gram index for reverse history search.
+ *
+ * docs[] holds one entry per distinct line, with its text copied into a
+ * single pool.  An open-addressed table maps line text to its live doc id;
+ * when a line is used again the old doc is marked dead and a new one is
+ * appended, which keeps ids in recency order.  grams[] maps each trigram
+ * (hashed into a fixed set of buckets) to an ascending list of doc ids.
+ * A query is answered from the shortest posting list among its trigrams,
+ * so a query with an unseen trigram is rejected without touching the docs.
+ * The index is built on the first search, and lines that later drop off
+ * the history ring stay searchable.
+ */
+#define _GNU_SOURCE
+#include "histsearch.h"
+#include "history.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct { uint32_t off, len; uint32_t hash; int dead; } hs_doc_t;
+typedef struct { uint32_t n, cap; uint32_t *ids; } hs_post_t;
+
+static int built;
+static hs_doc_t *docs;
+static size_t ndocs, docs_cap;
+static char *text;
+static size_t text_used, text_cap;
+static int32_t *lines;          /* text hash -> doc id, -1 = empty */
+static size_t lines_cap;
+static hs_post_t *grams;        /* HS_BUCKETS trigram posting lists */
+
+static uint32_t hs_hash(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+    return h;
+}
+
+/* Trigrams are folded into HS_BUCKETS posting lists.  Collisions only
+ * cost extra candidates, since every candidate is checked with memmem(). */
+#define HS_BUCKETS 65536
+
+static uint32_t trigram(const char *s) {
+    uint32_t k = (uint32_t)(unsigned char)s[0] << 16 | (uint32_t)(unsigned char)s[1] << 8 | (unsigned char)s[2];
+    return (k * 2654435761u) >> 16;
+}
+
+static void gram_post(uint32_t b, uint32_t id) {
+    hs_post_t *p = &grams[b];
+    if (p->n && p->ids[p->n - 1] == id) return;   /* gram repeats in this line */
+    if (p->n == p->cap) {
+        uint32_t nc = p->cap ? p->cap * 2 : 8;
+        uint32_t *ni = realloc(p->ids, nc * sizeof(*ni));
+        if (!ni) return;
+        p->ids = ni;
+        p->cap = nc;
+    }
+    p->ids[p->n++] = id;
+}
+
+static int32_t *line_slot(const char *s, size_t n, uint32_t h) {
+    size_t m = lines_cap - 1;
+    for (size_t i = h & m; ; i = (i + 1) & m) {
+        int32_t id = lines[i];
+        if (id < 0) return &lines[i];
+        hs_doc_t *d = &docs[id];
+        if (d->hash == h && d->len == n && memcmp(text + d->off, s, n) == 0) return &lines[i];
+    }
+}
+
+static int lines_grow(void) {
+    size_t nc = lines_cap ? lines_cap * 2 : 4096;
+    int32_t *nl = malloc(nc * sizeof(*nl));
+    if (!nl) return -1;
+    memset(nl, 0xff, nc * sizeof(*nl));
+    free(lines);
+    lines = nl;
+    lines_cap = nc;
+    for (size_t id = 0; id < ndocs; ++id) {
+        hs_doc_t *d = &docs[id];
+        if (!d->dead) *line_slot(text + d->off, d->len, d->hash) = (int32_t)id;
+    }
+    return 0;
+}
+
+static void index_line(const char *s) {
+    size_t n = strlen(s);
+    if (!n || n >= UINT32_MAX / 4) return;
+    if ((ndocs + 1) * 2 > lines_cap && lines_grow() < 0) return;
+    if (ndocs == docs_cap) {
+        size_t nc = docs_cap ? docs_cap * 2 : 1024;
+        hs_doc_t *nd = realloc(docs, nc * sizeof(*nd));
+        if (!nd) return;
+        docs = nd;
+        docs_cap = nc;
+    }
+    if (text_used + n + 1 > text_cap) {
+        size_t nc = text_cap ? text_cap : 65536;
+        while (nc < text_used + n + 1) nc *= 2;
+        char *nt = realloc(text, nc);
+        if (!nt) return;
+        text = nt;
+        text_cap = nc;
+    }
+    uint32_t h = hs_hash(s, n);
+    int32_t *slot = line_slot(s, n, h);
+    if (*slot >= 0) docs[*slot].dead = 1;      /* the newer copy wins */
+    uint32_t id = (uint32_t)ndocs++;
+    *slot = (int32_t)id;
+    docs[id] = (hs_doc_t){ (uint32_t)text_used, (uint32_t)n, h, 0 };
+    memcpy(text + text_used, s, n + 1);
+    text_used += n + 1;
+    for (size_t i = 0; i + 3 <= n; ++i) gram_post(trigram(s + i), id);
+}
+
+static void build(void) {
+    built = 1;
+    grams = calloc(HS_BUCKETS, sizeof(*grams));
+    if (!grams) return;
+    size_t n = history_len();
+    for (size_t i = 0; i < n; ++i) index_line(history_get(i));
+}
+
+void histsearch_add(const char *line) {
+    if (built && grams && line) index_line(line);
+}
+
+/* Short queries have no trigram: scan the docs newest first instead.
+ * A match is usually near the top, and a miss is a single pass over the
+ * text pool. */
+static long scan_docs(const char *q, size_t qn, long before) {
+    for (long id = before - 1; id >= 0; --id) {
+        hs_doc_t *d = &docs[id];
+        if (!d->dead && memmem(text + d->off, d->len, q, qn)) return id;
+    }
+    return -1;
+}
+
+long histsearch_find(const char *query, long before) {
+    if (!built) build();
+    size_t qn = query ? strlen(query) : 0;
+    if (!qn || !grams || before < 0) return -1;
+    if ((size_t)before > ndocs) before = (long)ndocs;
+    if (qn < 3) return scan_docs(query, qn, before);
+    hs_post_t *best = NULL;
+    for (size_t i = 0; i + 3 <= qn; ++i) {
+        hs_post_t *p = &grams[trigram(query + i)];
+        if (!p->n) return -1;
+        if (!best || p->n < best->n) best = p;
+    }
+    /* ids are ascending: find the last one below BEFORE, then walk back */
+    size_t lo = 0, hi = best->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (best->ids[mid] < (uint32_t)before) lo = mid + 1; else hi = mid;
+    }
+    while (lo-- > 0) {
+        hs_doc_t *d = &docs[best->ids[lo]];
+        if (!d->dead && memmem(text + d->off, d->len, query, qn)) return best->ids[lo];
+    }
+    return -1;
+}
+
+const char *histsearch_text(long id) {
+    if (id < 0 || (size_t)id >= ndocs) return NULL;
+    return text + docs[id].off;
+}
+
+void histsearch_free(void) {
+    for (size_t i = 0; grams && i < HS_BUCKETS; ++i) free(grams[i].ids);
+    free(grams);
+    free(lines);
+    free(docs);
+    free(text);
+    grams = NULL;
+    lines = NULL;
+    docs = NULL;
+    text = NULL;
+    lines_cap = ndocs = docs_cap = text_used = text_cap = 0;
+    built = 0;
+}
@@ -0,0 +1,441 @@
+/*
+ * lineedit.c -- gap-buffer line editor with differential redraw.
+ *
+ * The text is buf[0, gs) followed by buf[ge, cap); the gap sits at the
+ * cursor, so typing and deleting only move the gap edges.  After each
+ * batch of input the visible line is rebuilt into disp and compared with
+ * what was last drawn (shown): only the part after their common prefix is
+ * rewritten, the leftover tail is cleared with CSI K, and the cursor is
+ * put back with one CSI n D.  The whole update is collected in out and
+ * written at once.  Columns are counted in UTF-8 code points; lines wider
+ * than the terminal are not handled specially.
+ *
+ * Tab asks complete.c for the candidates: one is inserted whole (with a
+ * space unless it is a directory), several are narrowed to their common
+ * prefix, and when that adds nothing they are listed in columns under
+ * the line and the prompt is shown again.
+ */
+#define _GNU_SOURCE
+#include "lineedit.h"
+#include "complete.h"
+#include "histsearch.h"
+#include "history.h"
+#include "prompt.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define LE_LIST_MAX 1000          /* candidates listed before "... and N more" */
+
+typedef struct { char *s; size_t len, cap; } le_str_t;
+
+static char *buf;
+static size_t cap, gs, ge;        /* gap is [gs, ge); cursor == gs */
+
+static le_str_t disp, shown, out, line, query;
+static size_t shown_cur;          /* terminal cursor, as a byte offset into shown */
+
+static unsigned char inbuf[4096];
+static size_t inpos, inlen;
+
+/* --- Strings --- */
+
+static void str_reserve(le_str_t *b, size_t n) {
+    if (b->len + n <= b->cap) return;
+    size_t nc = b->cap ? b->cap : 256;
+    while (nc < b->len + n) nc *= 2;
+    char *ns = realloc(b->s, nc);
+    if (!ns) { perror("lineedit"); exit(EXIT_FAILURE); }
+    b->s = ns;
+    b->cap = nc;
+}
+
+static void str_put(le_str_t *b, const char *s, size_t n) {
+    str_reserve(b, n);
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+}
+
+static int is_cont(unsigned char c) { return (c & 0xC0) == 0x80; }
+
+static size_t cols(const char *s, size_t n) {
+    size_t c = 0;
+    for (size_t i = 0; i < n; ++i) if (!is_cont((unsigned char)s[i])) c++;
+    return c;
+}
+
+/* --- Gap buffer --- */
+
+static size_t gb_len(void) { return cap - (ge - gs); }
+
+static void gb_reserve(size_t n) {
+    if (ge - gs >= n) return;
+    size_t len = gb_len(), tail = cap - ge;
+    size_t nc = cap ? cap : 256;
+    while (nc - len < n) nc *= 2;
+    char *nb = realloc(buf, nc);
+    if (!nb) { perror("lineedit"); exit(EXIT_FAILURE); }
+    memmove(nb + nc - tail, nb + ge, tail);
+    buf = nb;
+    ge = nc - tail;
+    cap = nc;
+}
+
+static void gb_move(size_t pos) {
+    if (pos < gs) {
+        size_t n = gs - pos;
+        memmove(buf + ge - n, buf + pos, n);
+        gs -= n;
+        ge -= n;
+    } else if (pos > gs) {
+        size_t n = pos - gs;
+        memmove(buf + gs, buf + ge, n);
+        gs += n;
+        ge += n;
+    }
+}
+
+static void gb_insert(const char *s, size_t n) {
+    gb_reserve(n);
+    memcpy(buf + gs, s, n);
+    gs += n;
+}
+
+static void gb_set(const char *s) {
+    gs = 0;
+    ge = cap;
+    gb_insert(s, strlen(s));
+}
+
+/* Byte offsets of the code point before / after the cursor. */
+static size_t gb_prev(void) {
+    size_t p = gs;
+    while (p > 0 && is_cont((unsigned char)buf[--p])) {}
+    return p;
+}
+
+static size_t gb_next(void) {
+    size_t p = ge;
+    if (p < cap) p++;
+    while (p < cap && is_cont((unsigned char)buf[p])) p++;
+    return gs + (p - ge);
+}
+
+/* --- Redraw --- */
+
+static void move_left(size_t n) {
+    char seq[32];
+    if (n) str_put(&out, seq, (size_t)snprintf(seq, sizeof(seq), "\033[%zuD", n));
+}
+
+static void flush_out(void) {
+    size_t off = 0;
+    while (off < out.len) {
+        ssize_t w = write(STDOUT_FILENO, out.s + off, out.len - off);
+        if (w < 0) { if (errno == EINTR) continue; break; }
+        off += (size_t)w;
+    }
+    out.len = 0;
+}
+
+/* Bring the screen from shown to disp with the cursor at byte CUR. */
+static void redraw(size_t cur) {
+    size_t p = 0, m = shown.len < disp.len ? shown.len : disp.len;
+    while (p < m && shown.s[p] == disp.s[p]) p++;
+    while (p > 0 && p < disp.len && is_cont((unsigned char)disp.s[p])) p--;
+    size_t tc = shown_cur;
+    if (p < disp.len || p < shown.len) {
+        if (tc > p) move_left(cols(shown.s + p, tc - p));
+        else str_put(&out, disp.s + tc, p - tc);          /* unchanged, just step over */
+        str_put(&out, disp.s + p, disp.len - p);
+        if (cols(shown.s + p, shown.len - p) > cols(disp.s + p, disp.len - p))
+            str_put(&out, "\033[K", 3);
+        tc = disp.len;
+    }
+    if (tc > cur) move_left(cols(disp.s + cur, tc - cur));
+    else str_put(&out, disp.s + tc, cur - tc);
+    shown.len = 0;
+    str_put(&shown, disp.s, disp.len);
+    shown_cur = cur;
+    flush_out();
+}
+
+static void redraw_line(void) {
+    disp.len = 0;
+    str_put(&disp, buf, gs);
+    str_put(&disp, buf + ge, cap - ge);
+    redraw(gs);
+}
+
+/* --- Input --- */
+
+/* Next input byte, reading a new block only when the last one is used
+ * up; REPAINT runs first so the screen catches up before we block. */
+static int next_byte(void (*repaint)(void)) {
+    if (inpos == inlen) {
+        if (repaint) repaint();
+        ssize_t r;
+        do r = read(STDIN_FILENO, inbuf, sizeof(inbuf)); while (r < 0 && errno == EINTR);
+        if (r <= 0) return EOF;
+        inpos = 0;
+        inlen = (size_t)r;
+    }
+    return inbuf[inpos++];
+}
+
+/* Read a CSI sequence after "\033[": parameters into PARAM, returns the
+ * final byte. */
+static int read_csi(char *param, size_t n) {
+    size_t k = 0;
+    int c;
+    while ((c = next_byte(NULL)) != EOF && (c < 0x40 || c > 0x7e))
+        if (k + 1 < n) param[k++] = (char)c;
+    param[k] = '\0';
+    return c;
+}
+
+/* Insert the byte just read and the plain bytes after it as one block. */
+static void insert_run(void) {
+    size_t start = inpos - 1;
+    while (inpos < inlen && inbuf[inpos] >= 32 && inbuf[inpos] != 127) inpos++;
+    gb_insert((const char *)inbuf + start, inpos - start);
+}
+
+/* Read bracketed-paste text up to "\033[201~"; line breaks and tabs turn
+ * into spaces so a pasted block is edited, not run. */
+static void read_paste(void) {
+    int c;
+    while ((c = next_byte(NULL)) != EOF) {
+        if (c == 27) {
+            char param[16];
+            if (next_byte(NULL) == '[' && read_csi(param, sizeof(param)) == '~' && strcmp(param, "201") == 0)
+                return;
+            continue;
+        }
+        if (c == '\r' || c == '\n' || c == '\t') { gb_insert(" ", 1); continue; }
+        if (c < 32 || c == 127) continue;
+        insert_run();
+    }
+}
+
+/* --- Reverse search --- */
+
+static long search_cur;
+static int search_failed;
+
+static void redraw_search(void) {
+    const char *text = search_cur >= 0 ? histsearch_text(search_cur) : "";
+    disp.len = 0;
+    str_put(&disp, search_failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`",
+            search_failed ? 26 : 19);
+    str_put(&disp, query.s, query.len);
+    str_put(&disp, "': ", 3);
+    str_put(&disp, text, strlen(text));
+    redraw(disp.len);
+}
+
+static void search_query_end(void) {
+    str_reserve(&query, 1);
+    query.s[query.len] = '\0';
+}
+
+/* Ctrl-R mode.  Typing narrows (keeping the current match if it still
+ * fits), Ctrl-R steps to the next older match, Backspace widens from the
+ * newest again, Ctrl-G restores the line.  Any other key leaves the match
+ * in the editor and is then handled normally.  Returns 1 for Enter. */
+static int reverse_search(void) {
+    query.len = 0;
+    search_query_end();
+    search_cur = -1;
+    search_failed = 0;
+    line.len = 0;
+    str_put(&line, buf, gs);
+    str_put(&line, buf + ge, cap - ge);
+    str_put(&line, "", 1);
+
+    while (1) {
+        int c = next_byte(redraw_search);
+        if (c == 18) {
+            if (search_cur >= 0 && !search_failed) {
+                long next = histsearch_find(query.s, search_cur);
+                if (next >= 0) search_cur = next; else search_failed = 1;
+            }
+        } else if (c == 127 || c == 8) {
+            while (query.len > 0 && is_cont((unsigned char)query.s[--query.len])) {}
+            search_query_end();
+            search_cur = histsearch_find(query.s, LONG_MAX);
+            search_failed = query.len > 0 && search_cur < 0;
+        } else if (c == 7) {
+            gb_set(line.s);
+            return 0;
+        } else if (c == EOF || c < 32) {
+            if (search_cur >= 0) gb_set(histsearch_text(search_cur));
+            if (c != EOF && c != '\n' && c != '\r') inpos--;   /* handle it as an editing key */
+            return c == '\n' || c == '\r';
+        } else {
+            char ch = (char)c;
+            str_put(&query, &ch, 1);
+            search_query_end();
+            if (!search_failed) {
+                long m = histsearch_find(query.s, search_cur >= 0 ? search_cur + 1 : LONG_MAX);
+                if (m >= 0) search_cur = m; else search_failed = 1;
+            }
+        }
+    }
+}
+
+/* --- Completion --- */
+
+/* What a listing shows for a candidate: the part after its last '/',
+ * keeping a trailing one. */
+static const char *cand_label(const char *c) {
+    size_t n = strlen(c);
+    const char *p = c + n - (n && c[n - 1] == '/');
+    while (p > c && p[-1] != '/') p--;
+    return p;
+}
+
+static void list_candidates(const char *const *cand, size_t n) {
+    size_t shown_n = n > LE_LIST_MAX ? LE_LIST_MAX : n, width = 0;
+    for (size_t i = 0; i < shown_n; ++i) {
+        const char *l = cand_label(cand[i]);
+        size_t w = cols(l, strlen(l));
+        if (w > width) width = w;
+    }
+    struct winsize ws;
+    size_t term = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col ? ws.ws_col : 80;
+    size_t ncol = term / (width + 2);
+    if (ncol == 0) ncol = 1;
+    size_t rows = (shown_n + ncol - 1) / ncol;
+
+    str_put(&out, shown.s + shown_cur, shown.len - shown_cur);   /* leave the line from its end */
+    str_put(&out, "\n", 1);
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t c = 0; c < ncol; ++c) {
+            size_t i = c * rows + r;
+            if (i >= shown_n) break;
+            const char *l = cand_label(cand[i]);
+            size_t w = cols(l, strlen(l));
+            str_put(&out, l, strlen(l));
+            if (c + 1 < ncol && i + rows < shown_n)
+                for (; w < width + 2; ++w) str_put(&out, " ", 1);
+        }
+        str_put(&out, "\n", 1);
+    }
+    if (n > shown_n) {
+        char more[48];
+        str_put(&out, more, (size_t)snprintf(more, sizeof(more), "... and %zu more\n", n - shown_n));
+    }
+    flush_out();
+    prompt_show();
+    shown.len = shown_cur = 0;
+}
+
+static void complete_word(void) {
+    line.len = 0;
+    str_put(&line, buf, gs);
+    str_put(&line, "", 1);
+    size_t start;
+    const char *const *cand;
+    size_t n = complete_line(line.s, gs, &start, &cand);
+    if (n == 0) { str_put(&out, "\a", 1); return; }
+
+    size_t common = strlen(cand[0]);
+    for (size_t i = 1; i < n; ++i) {
+        size_t k = 0;
+        while (k < common && cand[i][k] == cand[0][k]) k++;
+        common = k;
+    }
+    while (common > 0 && common < strlen(cand[0]) && is_cont((unsigned char)cand[0][common])) common--;
+
+    size_t have = gs - start;
+    if (n > 1 && common == have && memcmp(cand[0], buf + start, have) == 0) {
+        list_candidates(cand, n);
+        return;
+    }
+    if (n > 1 && common == 0) { str_put(&out, "\a", 1); return; }
+    gs = start;
+    gb_insert(cand[0], common);
+    if (n == 1 && cand[0][common - 1] != '/') gb_insert(" ", 1);
+}
+
+/* --- Editor --- */
+
+char *lineedit_read(void) {
+    size_t history_back = 0;      /* entries stepped back from the newest (0 = new line) */
+    int c;
+
+    fflush(stdout);
+    gs = 0;
+    ge = cap;
+    shown.len = shown_cur = 0;
+    str_put(&out, "\033[?2004h", 8);
+
+    while ((c = next_byte(redraw_line)) != EOF) {
+        if (c == '\n' || c == '\r') break;
+        if (c == 4 && gb_len() == 0) { c = EOF; break; }   /* Ctrl-D on an empty line */
+        if (c == '\t') {
+            complete_word();
+        } else if (c == 18) {
+            if (reverse_search()) break;
+            history_back = 0;
+        } else if (c == 127 || c == 8) {
+            gs = gb_prev();
+        } else if (c == 27) {
+            char param[16];
+            if (next_byte(NULL) != '[') continue;
+            int f = read_csi(param, sizeof(param));
+            if (f == 'A') {
+                const char *h = history_get_recent(history_back);
+                if (h) { gb_set(h); history_back++; }
+            } else if (f == 'B') {
+                if (history_back > 1) { history_back--; gb_set(history_get_recent(history_back - 1)); }
+                else { gb_set(""); history_back = 0; }
+            } else if (f == 'C') {
+                gb_move(gb_next());
+            } else if (f == 'D') {
+                gb_move(gb_prev());
+            } else if (f == '~' && strcmp(param, "3") == 0) {
+                ge += gb_next() - gs;
+            } else if (f == '~' && strcmp(param, "200") == 0) {
+                read_paste();
+            }
+        } else if (c >= 32) {
+            insert_run();
+        }
+    }
+
+    if (c == EOF && gb_len() == 0) {
+        str_put(&out, "\033[?2004l", 8);
+        flush_out();
+        return NULL;
+    }
+    gb_move(gb_len());
+    redraw_line();
+    str_put(&out, "\n\033[?2004l", 9);
+    flush_out();
+    gb_reserve(1);
+    buf[gs] = '\0';
+    return buf;
+}
+
+int lineedit_pending(void) {
+    return inpos < inlen;
+}
+
+void lineedit_free(void) {
+    free(buf);
+    free(disp.s);
+    free(shown.s);
+    free(out.s);
+    free(line.s);
+    free(query.s);
+    buf = NULL;
+    cap = gs = ge = 0;
+    disp = shown = out = line = query = (le_str_t){0};
+}
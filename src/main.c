@@ -6,25 +6,27 @@
 #include <sys/wait.h>
 #include <termios.h>
 #include <fcntl.h>
-#include <limits.h>
-#include <pwd.h>
 #include <sys/stat.h>
-#define MAX_LINE 1024
+
+#include "complete.h"
+#include "histsearch.h"
+#include "history.h"
+#include "lineedit.h"
+#include "pathcache.h"
+#include "prompt.h"
+
 #define MAX_ARGS 64
-#define MAX_HISTORY 1000
 #define HISTORY_FILE "/home/okasha/myshell_history"
 
 // Terminal settings
 struct termios orig_termios;
 
-// History storage
-char *history[MAX_HISTORY];
-int history_count = 0;
+// Piped or redirected input: no raw mode, prompt or history
+int interactive;
 
+// Autocd check is an uncached stat() on purpose: it must see fresh mkdirs
 int is_directory(const char *path) {
-    struct stat st;
-    if (stat(path, &st) != 0) return 0;  // path does not exist
-    return S_ISDIR(st.st_mode);
+    return pathcache_is_directory(path);
 }
 
 // Save original terminal and enable raw mode
@@ -40,45 +42,26 @@ void disable_raw_mode() {
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
 }
 
+// Kali-style two-line prompt; override with MYSHELL_PS1 (see include/prompt.h)
+#define MAIN_PS1 "\\e[0;32m┌──(\\e[1;34m\\u㉿\\H\\e[0;32m)-[\\e[1;37m\\w\\e[0m\\e[0;32m]\\n└─\\e[1;34m$ \\e[0m"
+
 void print_prompt() {
-    char cwd[PATH_MAX];
-    char hostname[HOST_NAME_MAX];
-    struct passwd *pw = getpwuid(getuid());
-
-    getcwd(cwd, sizeof(cwd));
-    gethostname(hostname, sizeof(hostname));
-    printf("\033[0;32m┌──(");               // new line with $
-    printf("\033[1;34m%s㉿%s",pw->pw_name,hostname);
-    printf("\033[0;32m)-[");
-    printf("\033[1;37m%s\033[0m",cwd);
-    printf("\033[0;32m]\n└─");
-    printf("\033[1;34m$ ");
-    printf("\033[0m");
-
-    //printf("\033[1;32mThis text is bold green\n");               // new line with $
+    prompt_show();
 }
 
-// Load history from file
+// Load history from file (shared store, see src/history.c)
 void load_history() {
-    FILE *f = fopen(HISTORY_FILE, "r");
-    if (!f) return;
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), f)) {
-        line[strcspn(line, "\n")] = 0;
-        if (history_count < MAX_HISTORY)
-            history[history_count++] = strdup(line);
-    }
-    fclose(f);
+    history_init(HISTORY_MAX);
+    history_load(HISTORY_FILE);
+    history_open(HISTORY_FILE);
+    history_compact_bg(HISTORY_FILE, HISTORY_MAX);
 }
 
 // Save a line to history file
 void save_history(const char *line) {
-    FILE *f = fopen(HISTORY_FILE, "a");
-    if (!f) return;
-    fprintf(f, "%s\n", line);
-    fclose(f);
-    if (history_count < MAX_HISTORY)
-        history[history_count++] = strdup(line);
+    history_add(line);
+    histsearch_add(line);
+    history_save(line);
 }
 
 // Parse input into args
@@ -87,7 +70,7 @@ void parse_input(char *input, char **args) {
     int pos = 0;
     int len = strlen(input);
 
-    while (pos < len) {
+    while (pos < len && i < MAX_ARGS - 1) {
         while (pos < len && (input[pos] == ' ' || input[pos] == '\t'))
             pos++;
 
@@ -132,6 +115,10 @@ int shell_cd(char **args) {
     } else {
         if (chdir(args[1]) != 0)
             perror("shell");
+        else {
+            pathcache_invalidate_cwd();
+            prompt_cwd_changed();
+        }
     }
     return 1;
 }
@@ -139,6 +126,8 @@ int shell_cd(char **args) {
 // Execute external commands
 // Execute external commands with I/O redirection (combined)
 int shell_execute(char **args) {
+    // Resolve before forking so the PATH hash survives in the parent
+    const char *exe = pathcache_lookup(args[0]);
     pid_t pid = fork();
     int status;
 
@@ -167,8 +156,8 @@ int shell_execute(char **args) {
             i++;
         }
 
-        if (execvp(args[0], args) == -1)
-            perror("shell");
+        pathcache_exec(exe, args);
+        perror("shell");
         exit(EXIT_FAILURE);
     } else if (pid < 0) {
         perror("shell");
@@ -182,151 +171,63 @@ int shell_execute(char **args) {
 }
 
 
-// Read line with arrow keys history
-void read_line(char *buffer) {
-    int pos = 0;               // current cursor position
-    int len = 0;               // current line length
-    int c;
-    int history_index = history_count;
-
-    buffer[0] = '\0';
-
-    while (1) {
-        c = getchar();
-
-        if (c == '\n') {
-            buffer[len] = '\0';
-            printf("\n");
-            break;
-        } 
-        else if (c == 127 || c == 8) { // backspace
-            if (pos > 0) {   // cursor > start of input
-                if (pos <= 0) continue;  // safety check
-
-                // Normal deletion
-                for (int i = pos - 1; i < len - 1; i++)
-                    buffer[i] = buffer[i + 1];
-
-                pos--;
-                len--;
-                buffer[len] = '\0';
-
-                printf("\b");                           // move left
-                printf("%s ", buffer + pos);            // overwrite rest
-                for (int i = 0; i <= len - pos; i++)    // move cursor back
-                    printf("\b");
-            }
-        }
-        else if (c == 27) { // escape sequence
-            if ((c = getchar()) == 91) { // CSI
-                c = getchar();
-                if (c == 'A') { // up arrow
-                    if (history_index > 0) {
-                        for (int i = 0; i < len; i++) printf("\b \b");
-                        history_index--;
-                        strcpy(buffer, history[history_index]);
-                        len = strlen(buffer);
-                        pos = len;
-                        printf("%s", buffer);
-                    }
-                } 
-                else if (c == 'B') { // down arrow
-                    for (int i = 0; i < len; i++) printf("\b \b");
-                    if (history_index < history_count - 1) {
-                        history_index++;
-                        strcpy(buffer, history[history_index]);
-                        len = strlen(buffer);
-                        pos = len;
-                        printf("%s", buffer);
-                    } else {
-                        buffer[0] = '\0';
-                        len = 0;
-                        pos = 0;
-                    }
-                } 
-                else if (c == 'C') { // right arrow
-                    if (pos < len) {
-                        printf("\033[C");
-                        pos++;
-                    }
-                } 
-                else if (c == 'D') { // left arrow
-                    if (pos > 0) {
-                        printf("\033[D");
-                        pos--;
-                    }
-                }
-                else if (c == 51) 
-                {   // '3'
-                    c = getchar();    // should read '~'
-                    if (c == 126) 
-                    {   // delete key
-                        if (pos < len) {
-                            // shift everything left starting at cursor
-                            for (int i = pos; i < len - 1; i++)
-                                buffer[i] = buffer[i + 1];
-
-                            len--;
-                            buffer[len] = '\0';
-
-                            // redraw line from cursor to end
-                            printf("%s ", buffer + pos); 
-                            for (int i = 0; i <= len - pos; i++) 
-                                printf("\b");
-                        }
-                    }
-                }
-            }
-        } 
-        else { // normal character
-            for (int i = len; i > pos; i--) buffer[i] = buffer[i-1]; // shift right
-            buffer[pos] = c;
-            printf("%c", c);
-            pos++;
-            len++;
-            buffer[len] = '\0';
-
-            // redraw rest of line if not at end
-            if (pos < len) {
-                printf("%s", buffer + pos);
-                for (int i = 0; i < len - pos; i++) printf("\b");
-            }
-        }
-    }
+// Read line with arrow keys history, Ctrl-R search, Tab completion and bracketed paste;
+// non-interactive input goes through stdio's buffer instead
+char *read_line() {
+    static char *buf;
+    static size_t cap;
+    if (interactive) return lineedit_read();
+    ssize_t n = getline(&buf, &cap, stdin);
+    if (n < 0) return NULL;
+    if (n > 0 && buf[n - 1] == '\n') buf[n - 1] = '\0';
+    return buf;
 }
 
 
 // Main shell loop
 int main() {
-    char line[MAX_LINE];
-    char raw_line[MAX_LINE];
+    char *line;
     char *args[MAX_ARGS];
     int status = 1;
 
-    enable_raw_mode();
-    load_history();
+    interactive = isatty(STDIN_FILENO);
+    if (interactive) {
+        enable_raw_mode();
+        load_history();
+        prompt_init(MAIN_PS1, NULL);
+        // Tab completes these next to $PATH commands and paths
+        complete_add_command("cd");
+        complete_add_command("exit");
+        complete_add_command("history");
+        complete_add_command("hash");
+        complete_add_command("echo");
+    }
 
     while (status) {
-        print_prompt();
-        fflush(stdout);
+        if (interactive) print_prompt();
+        else fflush(stdout);
 
-        read_line(line);
+        line = read_line();
+        if (!line) break;
         if (strlen(line) == 0) continue;
 
-        save_history(line);
-        strcpy(raw_line, line);
+        if (interactive) save_history(line);
         parse_input(line, args);
+        if (!args[0]) continue;
 
         if (strcmp(args[0], "cd") == 0) {
             status = shell_cd(args);
         } else if (strcmp(args[0], "exit") == 0) {
             status = 0;
         } else if (strcmp(args[0], "history") == 0) {
-            for (int i = 0; i < history_count; i++)
-                printf("%d %s\n", i + 1, history[i]);
+            unsigned long first = history_first_number();
+            for (size_t i = 0; i < history_len(); i++)
+                printf("%lu %s\n", first + i, history_get(i));
+        } else if (strcmp(args[0], "hash") == 0) {
+            pathcache_builtin(args, stdout);
         } else if (strcmp(args[0], "echo") == 0) {
             // Print everything that comes AFTER "echo" in original input
-            char *p = strstr(raw_line, "echo");
+            char *p = strstr(line, "echo");
             if (p) {
                 p += 4; // skip the word "echo"
                 while (*p == ' ') p++; // skip one space
@@ -337,7 +238,7 @@ int main() {
         }else {
             if (is_directory(args[0])) {
                 // Treat it as cd
-                char *cd_args[2];
+                char *cd_args[3];
                 cd_args[0] = "cd";
                 cd_args[1] = args[0];
                 cd_args[2] = NULL;
@@ -350,6 +251,6 @@ int main() {
 
     }
 
-    disable_raw_mode();
+    if (interactive) disable_raw_mode();
     return 0;
 }
@@ -0,0 +1,498 @@
+/*
+ * pathcache.c -- hashed $PATH lookup and stat cache.
+ *
+ * Two chained hash tables keyed by string:
+ *   - names: command name -> resolved path (or a negative entry for misses)
+ *   - stats: path -> stat() result (or the errno it failed with)
+ * Negative name results and stat results expire after PATHCACHE_NEG_TTL
+ * seconds so freshly installed tools are picked up without `hash -r`.
+ *
+ * For completion, every executable in the $PATH directories is also kept
+ * in a trie (see "Executable trie" below), which name lookups share.
+ */
+#define _GNU_SOURCE
+#include "pathcache.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct pc_entry {
+    char *key;
+    char *path;            /* names: resolved path, NULL for a miss */
+    struct stat st;        /* stats: valid when err == 0 */
+    int err;               /* stats: errno of a failed stat() */
+    time_t stamp;          /* monotonic seconds when filled */
+    unsigned hits;
+    uint32_t hash;
+    struct pc_entry *next;
+} pc_entry_t;
+
+typedef struct {
+    pc_entry_t **buckets;
+    size_t nbuckets;
+    size_t count;
+} pc_table_t;
+
+static pc_table_t names;
+static pc_table_t stats;
+static char *cached_path_env;      /* $PATH the names table was built for */
+static int path_has_relative;      /* $PATH contains "" or "." style entries */
+
+static void trie_free(void);
+
+static uint32_t pc_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static time_t pc_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void pc_free_entry(pc_entry_t *e) {
+    free(e->key);
+    free(e->path);
+    free(e);
+}
+
+static void pc_table_clear(pc_table_t *t) {
+    for (size_t b = 0; b < t->nbuckets; ++b) {
+        pc_entry_t *e = t->buckets[b];
+        while (e) { pc_entry_t *n = e->next; pc_free_entry(e); e = n; }
+        t->buckets[b] = NULL;
+    }
+    t->count = 0;
+}
+
+static pc_entry_t *pc_table_find(pc_table_t *t, const char *key, uint32_t h) {
+    if (!t->nbuckets) return NULL;
+    for (pc_entry_t *e = t->buckets[h & (t->nbuckets - 1)]; e; e = e->next)
+        if (e->hash == h && strcmp(e->key, key) == 0) return e;
+    return NULL;
+}
+
+static void pc_table_grow(pc_table_t *t) {
+    size_t nb = t->nbuckets ? t->nbuckets * 2 : 64;
+    pc_entry_t **nbk = calloc(nb, sizeof(*nbk));
+    if (!nbk) return;
+    for (size_t b = 0; b < t->nbuckets; ++b) {
+        pc_entry_t *e = t->buckets[b];
+        while (e) {
+            pc_entry_t *n = e->next;
+            e->next = nbk[e->hash & (nb - 1)];
+            nbk[e->hash & (nb - 1)] = e;
+            e = n;
+        }
+    }
+    free(t->buckets);
+    t->buckets = nbk;
+    t->nbuckets = nb;
+}
+
+static pc_entry_t *pc_table_insert(pc_table_t *t, const char *key, uint32_t h) {
+    if (t->count + 1 > t->nbuckets * 3 / 4) pc_table_grow(t);
+    if (!t->nbuckets) return NULL;
+    pc_entry_t *e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+    e->key = strdup(key);
+    if (!e->key) { free(e); return NULL; }
+    e->hash = h;
+    e->next = t->buckets[h & (t->nbuckets - 1)];
+    t->buckets[h & (t->nbuckets - 1)] = e;
+    t->count++;
+    return e;
+}
+
+static void pc_table_remove(pc_table_t *t, const char *key) {
+    if (!t->nbuckets) return;
+    uint32_t h = pc_hash(key);
+    pc_entry_t **pp = &t->buckets[h & (t->nbuckets - 1)];
+    while (*pp) {
+        pc_entry_t *e = *pp;
+        if (e->hash == h && strcmp(e->key, key) == 0) {
+            *pp = e->next;
+            pc_free_entry(e);
+            t->count--;
+            return;
+        }
+        pp = &e->next;
+    }
+}
+
+/* Drop the names table if $PATH changed since it was filled. */
+static void pc_check_path_env(void) {
+    const char *p = getenv("PATH");
+    if (!p) p = "/usr/local/bin:/usr/bin:/bin";
+    if (cached_path_env && strcmp(cached_path_env, p) == 0) return;
+    pc_table_clear(&names);
+    trie_free();
+    free(cached_path_env);
+    cached_path_env = strdup(p);
+    path_has_relative = 0;
+    const char *s = p;
+    while (1) {
+        const char *c = strchr(s, ':');
+        size_t L = c ? (size_t)(c - s) : strlen(s);
+        if (L == 0 || s[0] != '/') path_has_relative = 1;
+        if (!c) break;
+        s = c + 1;
+    }
+}
+
+int pathcache_stat(const char *path, struct stat *st) {
+    uint32_t h = pc_hash(path);
+    pc_entry_t *e = pc_table_find(&stats, path, h);
+    time_t now = pc_now();
+    if (e && now - e->stamp < PATHCACHE_NEG_TTL) {
+        STATS_INC(STAT_STAT_HITS);
+        e->hits++;
+        if (e->err) { errno = e->err; return -1; }
+        if (st) *st = e->st;
+        return 0;
+    }
+    STATS_INC(STAT_STAT_MISSES);
+    if (!e) {
+        /* every path ever probed would pile up here: start over instead */
+        if (stats.count >= PATHCACHE_STAT_MAX) pc_table_clear(&stats);
+        e = pc_table_insert(&stats, path, h);
+    }
+    struct stat tmp;
+    int rc = stat(path, &tmp);
+    int err = errno;
+    if (e) { e->err = rc < 0 ? err : 0; e->st = tmp; e->stamp = now; }
+    if (rc < 0) { errno = err; return -1; }
+    if (st) *st = tmp;
+    return 0;
+}
+
+int pathcache_is_directory(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    return S_ISDIR(st.st_mode);
+}
+
+static int pc_is_executable(const char *path) {
+    struct stat st;
+    if (pathcache_stat(path, &st) != 0) return 0;
+    if (!S_ISREG(st.st_mode)) return 0;
+    return access(path, X_OK) == 0;
+}
+
+/* Walk the directory list S for NAME; returns a malloc'd path or NULL. */
+static char *pc_search_in(const char *name, const char *s) {
+    size_t nl = strlen(name);
+    while (1) {
+        const char *c = strchr(s, ':');
+        size_t L = c ? (size_t)(c - s) : strlen(s);
+        char *cand = malloc(L + nl + 3);
+        if (!cand) return NULL;
+        if (L == 0) { memcpy(cand, "./", 2); L = 2; }
+        else { memcpy(cand, s, L); cand[L++] = '/'; }
+        memcpy(cand + L, name, nl + 1);
+        STATS_INC(STAT_PATH_PROBES);
+        if (pc_is_executable(cand)) return cand;
+        free(cand);
+        if (!c) break;
+        s = c + 1;
+    }
+    return NULL;
+}
+
+static char *pc_search(const char *name) { return pc_search_in(name, cached_path_env); }
+
+/* --- Executable trie --- */
+/* Every executable in the absolute $PATH directories, as a first-child /
+ * next-sibling trie whose children are kept in byte order, so walking a
+ * prefix's subtree yields the names sorted.  Node 0 is the root; DIR is
+ * the index of the first $PATH directory holding the name (the one
+ * execvp() would pick), -1 on inner nodes.
+ *
+ * It is built on the first completion and rebuilt once any directory's
+ * mtime differs from the one recorded before listing it, or $PATH changes.
+ * A trie checked within the last PATHCACHE_NEG_TTL seconds also answers
+ * names-table misses, so a new command costs a walk of its letters rather
+ * than a stat() per $PATH entry. */
+typedef struct {
+    unsigned char c;
+    int32_t child, next, dir;
+} pc_tnode_t;
+
+static pc_tnode_t *trie;
+static size_t trie_len, trie_cap;
+static char **trie_dirs;
+static int64_t *trie_mtimes;       /* ns, -1 for a directory that did not exist */
+static size_t trie_ndirs;
+static time_t trie_checked;        /* pc_now() of the last mtime check, 0 = no trie */
+
+static void trie_free(void) {
+    for (size_t i = 0; i < trie_ndirs; ++i) free(trie_dirs[i]);
+    free(trie_dirs);
+    free(trie_mtimes);
+    free(trie);
+    trie = NULL;
+    trie_dirs = NULL;
+    trie_mtimes = NULL;
+    trie_len = trie_cap = trie_ndirs = 0;
+    trie_checked = 0;
+}
+
+static int64_t dir_mtime(const char *dir) {
+    struct stat st;
+    if (stat(dir, &st) != 0) return -1;
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static int32_t trie_node(unsigned char c) {
+    if (trie_len == trie_cap) {
+        size_t nc = trie_cap ? trie_cap * 2 : 4096;
+        pc_tnode_t *nt = realloc(trie, nc * sizeof(*nt));
+        if (!nt) return -1;
+        trie = nt;
+        trie_cap = nc;
+    }
+    trie[trie_len] = (pc_tnode_t){ c, -1, -1, -1 };
+    return (int32_t)trie_len++;
+}
+
+static void trie_insert(const char *name, int32_t dir) {
+    int32_t n = 0;
+    for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+        int32_t prev = -1, k = trie[n].child;
+        while (k >= 0 && trie[k].c < *p) { prev = k; k = trie[k].next; }
+        if (k < 0 || trie[k].c != *p) {
+            int32_t m = trie_node(*p);
+            if (m < 0) return;
+            trie[m].next = k;
+            if (prev >= 0) trie[prev].next = m; else trie[n].child = m;
+            k = m;
+        }
+        n = k;
+    }
+    if (trie[n].dir < 0) trie[n].dir = dir;
+}
+
+static void trie_add_dir(int32_t dir) {
+    DIR *d = opendir(trie_dirs[dir]);
+    if (!d) return;
+    int dfd = dirfd(d);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.' && (!de->d_name[1] || (de->d_name[1] == '.' && !de->d_name[2]))) continue;
+        if (de->d_type != DT_REG && de->d_type != DT_LNK && de->d_type != DT_UNKNOWN) continue;
+        struct stat st;
+        if (fstatat(dfd, de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (faccessat(dfd, de->d_name, X_OK, 0) != 0) continue;
+        trie_insert(de->d_name, dir);
+    }
+    closedir(d);
+}
+
+static void trie_build(void) {
+    trie_free();
+    if (trie_node(0) < 0) return;
+    size_t n = 1;
+    for (const char *s = cached_path_env; *s; ++s) n += *s == ':';
+    trie_dirs = calloc(n, sizeof(*trie_dirs));
+    trie_mtimes = calloc(n, sizeof(*trie_mtimes));
+    if (!trie_dirs || !trie_mtimes) { trie_free(); return; }
+    const char *s = cached_path_env;
+    while (1) {
+        const char *c = strchr(s, ':');
+        size_t L = c ? (size_t)(c - s) : strlen(s);
+        if (L > 0 && s[0] == '/') {          /* relative entries depend on the cwd */
+            char *dir = strndup(s, L);
+            if (dir) {
+                int32_t i = (int32_t)trie_ndirs++;
+                trie_dirs[i] = dir;
+                trie_mtimes[i] = dir_mtime(dir);    /* before listing: a change mid-scan shows next time */
+                trie_add_dir(i);
+            }
+        }
+        if (!c) break;
+        s = c + 1;
+    }
+    trie_checked = pc_now();
+}
+
+/* Make sure the trie matches the directories on disk. */
+static void trie_refresh(void) {
+    if (trie_checked) {
+        size_t i = 0;
+        while (i < trie_ndirs && dir_mtime(trie_dirs[i]) == trie_mtimes[i]) i++;
+        if (i == trie_ndirs) { trie_checked = pc_now(); return; }
+    }
+    trie_build();
+}
+
+static int32_t trie_find(const char *prefix) {
+    int32_t n = 0;
+    for (const unsigned char *p = (const unsigned char *)prefix; *p && n >= 0; ++p) {
+        int32_t k = trie[n].child;
+        while (k >= 0 && trie[k].c < *p) k = trie[k].next;
+        n = k >= 0 && trie[k].c == *p ? k : -1;
+    }
+    return n;
+}
+
+/* Resolved path for NAME from a recently checked trie, NULL if it has no
+ * such command; *USED says whether the trie could answer at all. */
+static char *trie_resolve(const char *name, int *used) {
+    *used = 0;
+    if (!trie_checked || path_has_relative || pc_now() - trie_checked >= PATHCACHE_NEG_TTL) return NULL;
+    *used = 1;
+    int32_t n = trie_find(name);
+    if (n < 0 || trie[n].dir < 0) return NULL;
+    const char *dir = trie_dirs[trie[n].dir];
+    size_t dl = strlen(dir), nl = strlen(name);
+    char *path = malloc(dl + nl + 2);
+    if (!path) return NULL;
+    memcpy(path, dir, dl);
+    path[dl] = '/';
+    memcpy(path + dl + 1, name, nl + 1);
+    return path;
+}
+
+static int trie_walk(int32_t n, char *name, size_t len, int (*fn)(const char *, void *), void *arg, size_t *count) {
+    for (int32_t k = trie[n].child; k >= 0; k = trie[k].next) {
+        if (len >= NAME_MAX) continue;
+        name[len] = (char)trie[k].c;
+        name[len + 1] = '\0';
+        if (trie[k].dir >= 0) {
+            ++*count;
+            if (fn(name, arg)) return 1;
+        }
+        if (trie_walk(k, name, len + 1, fn, arg, count)) return 1;
+    }
+    return 0;
+}
+
+size_t pathcache_complete(const char *prefix, int (*fn)(const char *name, void *arg), void *arg) {
+    pc_check_path_env();
+    trie_refresh();
+    if (!trie_checked) return 0;
+    size_t len = strlen(prefix), count = 0;
+    if (len > NAME_MAX) return 0;
+    int32_t n = trie_find(prefix);
+    if (n < 0) return 0;
+    char name[NAME_MAX + 2];
+    memcpy(name, prefix, len + 1);
+    if (len && trie[n].dir >= 0) {
+        count++;
+        if (fn(name, arg)) return count;
+    }
+    trie_walk(n, name, len, fn, arg, &count);
+    return count;
+}
+
+static const char *pc_lookup(const char *name) {
+    if (!name || !*name) return NULL;
+    if (strchr(name, '/')) return name;
+    pc_check_path_env();
+    uint32_t h = pc_hash(name);
+    pc_entry_t *e = pc_table_find(&names, name, h);
+    if (e) {
+        if (e->path) { e->hits++; STATS_INC(STAT_PATH_HITS); return e->path; }
+        if (pc_now() - e->stamp < PATHCACHE_NEG_TTL) { e->hits++; STATS_INC(STAT_PATH_HITS); return NULL; }
+    } else {
+        e = pc_table_insert(&names, name, h);
+        if (!e) return NULL;
+    }
+    STATS_INC(STAT_PATH_MISSES);
+    free(e->path);
+    int from_trie;
+    e->path = trie_resolve(name, &from_trie);
+    if (!from_trie) e->path = pc_search(name);
+    e->stamp = pc_now();
+    e->hits = 1;
+    return e->path;
+}
+
+const char *pathcache_lookup(const char *name) {
+    uint64_t t0 = stats_now();
+    const char *r = pc_lookup(name);
+    stats_since(STAT_LOOKUP, t0);
+    return r;
+}
+
+const char *pathcache_lookup_in(const char *name, const char *path) {
+    static char *last;
+    if (!name || !*name) return NULL;
+    if (strchr(name, '/')) return name;
+    free(last);
+    last = pc_search_in(name, path);
+    return last;
+}
+
+/* Run a script without a #! line the way execvp() does: with /bin/sh. */
+static void exec_sh(const char *path, char **argv) {
+    int n = 0;
+    while (argv[n]) n++;
+    char **sh = malloc((size_t)(n + 2) * sizeof(*sh));
+    if (!sh) { errno = ENOEXEC; return; }
+    sh[0] = "sh";
+    sh[1] = (char *)path;
+    for (int i = 1; i <= n; ++i) sh[i + 1] = argv[i];
+    execv("/bin/sh", sh);
+    free(sh);
+    errno = ENOEXEC;
+}
+
+void pathcache_exec(const char *path, char **argv) {
+    if (!path) { errno = ENOENT; return; }
+    execv(path, argv);
+    if (errno == ENOEXEC) { exec_sh(path, argv); return; }
+    if (errno != ENOENT || strchr(argv[0], '/')) return;
+    /* the hashed binary went away: fall back to a full PATH walk */
+    execvp(argv[0], argv);
+}
+
+void pathcache_forget(const char *name) {
+    pc_table_remove(&names, name);
+}
+
+void pathcache_clear(void) {
+    pc_table_clear(&names);
+    trie_free();
+    pc_table_clear(&stats);
+}
+
+void pathcache_invalidate_cwd(void) {
+    pc_table_clear(&stats);
+    if (path_has_relative) pc_table_clear(&names);
+}
+
+int pathcache_builtin(char **argv, FILE *out) {
+    int status = 0;
+    int i = 1;
+    if (argv[1] && strcmp(argv[1], "-r") == 0) { pathcache_clear(); i = 2; }
+    else if (argv[1] && strcmp(argv[1], "-d") == 0) {
+        for (i = 2; argv[i]; ++i) pathcache_forget(argv[i]);
+        return 0;
+    }
+    if (argv[i]) {
+        for (; argv[i]; ++i) {
+            pathcache_forget(argv[i]);
+            if (!pathcache_lookup(argv[i])) { fprintf(stderr, "hash: %s: not found\n", argv[i]); status = 1; }
+        }
+        return status;
+    }
+    if (i == 2) return 0;
+    if (names.count == 0) { fprintf(out, "hash: hash table empty\n"); return 0; }
+    fprintf(out, "hits\tcommand\n");
+    for (size_t b = 0; b < names.nbuckets; ++b)
+        for (pc_entry_t *e = names.buckets[b]; e; e = e->next)
+            if (e->path) fprintf(out, "%4u\t%s\n", e->hits, e->path);
+            else fprintf(out, "%4u\t%s (not found)\n", e->hits, e->key);
+    return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * pathglob.c -- pathname expansion over cached getdents64 listings.
+ *
+ * A pattern is taken one '/'-separated component at a time.  Components
+ * without wildcards are appended to the path as they are; no directory
+ * is read for them, only the final path is checked to exist.  A wildcard
+ * component is compiled once into a short op list (literal runs, '?',
+ * bracket sets as 256-bit maps, '*') and run against each entry of the
+ * directory's cached listing with a single-backtrack matcher: at a
+ * mismatch only the most recent '*' is retried one byte further on, so a
+ * match costs O(pattern * name) at worst.
+ *
+ * Listings are read with raw getdents64 into one buffer per call and
+ * keep name, length and d_type; d_type decides whether an entry can be
+ * descended into without a stat().
+ */
+#define _GNU_SOURCE
+#include "pathglob.h"
+#include "stats.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* The kernel's record, as getdents64 fills the buffer. */
+struct pg_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    const char *name;
+    size_t len;
+    unsigned char type;     /* DT_* from getdents64 */
+} pg_ent_t;
+
+struct pathglob_dir {
+    const char *path;
+    uint32_t hash;
+    pg_ent_t *ents;
+    size_t n;
+    pathglob_dir_t *next;
+};
+
+typedef enum { G_LIT, G_ANY, G_SET, G_STAR } gop_kind_t;
+
+typedef struct {
+    gop_kind_t kind;
+    const char *lit;        /* G_LIT: unescaped bytes */
+    size_t len;
+    uint32_t set[8];        /* G_SET: byte bitmap, already negated */
+} gop_t;
+
+typedef struct {
+    gop_t *ops;
+    int n;
+    int dot;                /* starts with a literal '.': may match dot files */
+} gmatch_t;
+
+typedef struct {
+    pathglob_cache_t *c;
+    char path[PATH_MAX];
+    char **out;
+    size_t nout;
+    int cap;
+} pg_ctx_t;
+
+/* --- Patterns --- */
+
+static void set_add(uint32_t *set, unsigned c) { set[c >> 5] |= 1u << (c & 31); }
+static int set_has(const uint32_t *set, unsigned char c) { return (set[c >> 5] >> (c & 31)) & 1; }
+
+static int class_fill(uint32_t *set, const char *name, size_t n) {
+    static const struct { const char *name; int (*fn)(int); } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+        { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+        { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); ++i) {
+        if (strlen(classes[i].name) != n || memcmp(classes[i].name, name, n) != 0) continue;
+        for (unsigned c = 0; c < 128; ++c) if (classes[i].fn((int)c)) set_add(set, c);
+        return 1;
+    }
+    return 0;
+}
+
+/* Parse the set after '[' at P; returns the byte past its ']' or NULL if
+ * it is not closed before END (then the '[' is literal). */
+static const char *parse_set(const char *p, const char *end, uint32_t *set) {
+    int neg = 0, first = 1;
+    memset(set, 0, 8 * sizeof(*set));
+    if (p < end && (*p == '!' || *p == '^')) { neg = 1; p++; }
+    while (p < end) {
+        if (*p == ']' && !first) {
+            if (neg) for (int i = 0; i < 8; ++i) set[i] = ~set[i];
+            return p + 1;
+        }
+        first = 0;
+        if (p[0] == '[' && p + 1 < end && p[1] == ':') {
+            const char *q = p + 2;
+            while (q + 1 < end && !(q[0] == ':' && q[1] == ']')) q++;
+            if (q + 1 < end && class_fill(set, p + 2, (size_t)(q - (p + 2)))) { p = q + 2; continue; }
+        }
+        unsigned char lo = (unsigned char)*p;
+        if (lo == '\\' && p + 1 < end) lo = (unsigned char)*++p;
+        p++;
+        if (p + 1 < end && *p == '-' && p[1] != ']') {
+            unsigned char hi = (unsigned char)*++p;
+            if (hi == '\\' && p + 1 < end) hi = (unsigned char)*++p;
+            p++;
+            for (unsigned c = lo; c <= hi; ++c) set_add(set, c);
+        } else {
+            set_add(set, lo);
+        }
+    }
+    return NULL;
+}
+
+static int has_meta(const char *p, const char *end) {
+    uint32_t set[8];
+    for (; p < end; ++p) {
+        if (*p == '\\') { if (p + 1 < end) p++; continue; }
+        if (*p == '*' || *p == '?') return 1;
+        if (*p == '[' && parse_set(p + 1, end, set)) return 1;
+    }
+    return 0;
+}
+
+int pathglob_has_meta(const char *pattern) {
+    return has_meta(pattern, pattern + strlen(pattern));
+}
+
+static void compile(arena_t *a, const char *p, const char *end, gmatch_t *m) {
+    int cap = 0;
+    char *lit = arena_alloc(a, (size_t)(end - p) + 1);
+    size_t lw = 0;
+    m->ops = NULL;
+    m->n = 0;
+    m->dot = p < end && (*p == '.' || (*p == '\\' && p + 1 < end && p[1] == '.'));
+    while (p < end) {
+        gop_t op = { G_LIT, NULL, 0, {0} };
+        if (*p == '*') {
+            p++;
+            if (m->n && m->ops[m->n - 1].kind == G_STAR) continue;
+            op.kind = G_STAR;
+        } else if (*p == '?') {
+            p++;
+            op.kind = G_ANY;
+        } else {
+            const char *after = *p == '[' ? parse_set(p + 1, end, op.set) : NULL;
+            if (after) {
+                op.kind = G_SET;
+                p = after;
+            } else {
+                /* a literal run, up to the next wildcard */
+                op.lit = lit + lw;
+                while (p < end && *p != '*' && *p != '?' && !(*p == '[' && parse_set(p + 1, end, op.set))) {
+                    if (*p == '\\' && p + 1 < end) p++;
+                    lit[lw++] = *p++;
+                }
+                op.len = (size_t)(lit + lw - op.lit);
+            }
+        }
+        if (m->n == cap) {
+            int old = cap;
+            cap = cap ? cap * 2 : 4;
+            m->ops = arena_realloc(a, m->ops, (size_t)old * sizeof(gop_t), (size_t)cap * sizeof(gop_t));
+        }
+        m->ops[m->n++] = op;
+    }
+}
+
+/* Bytes of S[0..n) matched by the non-star OP, or 0. */
+static size_t op_match(const gop_t *op, const char *s, size_t n) {
+    if (n == 0) return 0;
+    switch (op->kind) {
+    case G_LIT:
+        return op->len <= n && memcmp(s, op->lit, op->len) == 0 ? op->len : 0;
+    case G_ANY: {
+        size_t k = 1;         /* one whole UTF-8 code point */
+        while (k < n && ((unsigned char)s[k] & 0xC0) == 0x80) k++;
+        return k;
+    }
+    case G_SET:
+        return set_has(op->set, (unsigned char)*s) ? 1 : 0;
+    default:
+        return 0;
+    }
+}
+
+static int gmatch(const gmatch_t *m, const char *s, size_t n) {
+    if (s[0] == '.' && !m->dot) return 0;
+    int oi = 0, star = -1;
+    size_t si = 0, star_si = 0;
+    while (1) {
+        if (oi < m->n) {
+            const gop_t *op = &m->ops[oi];
+            if (op->kind == G_STAR) { star = oi++; star_si = si; continue; }
+            size_t k = op_match(op, s + si, n - si);
+            if (k) { si += k; oi++; continue; }
+        } else if (si == n) {
+            return 1;
+        }
+        if (star < 0 || star_si >= n) return 0;
+        si = ++star_si;
+        oi = star + 1;
+    }
+}
+
+/* --- Listings --- */
+
+static uint32_t pg_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+/* Entries of directory PATH, from the cache or read now.  NULL if it
+ * cannot be opened as a directory (remembered too). */
+static pathglob_dir_t *listing(pathglob_cache_t *c, const char *path) {
+    uint32_t h = pg_hash(path);
+    pathglob_dir_t **bucket = &c->buckets[h & (PATHGLOB_BUCKETS - 1)];
+    for (pathglob_dir_t *d = *bucket; d; d = d->next)
+        if (d->hash == h && strcmp(d->path, path) == 0) {
+            STATS_INC(STAT_GLOB_HITS);
+            return d->ents ? d : NULL;
+        }
+    STATS_INC(STAT_GLOB_READS);
+    pathglob_dir_t *d = arena_calloc(c->a, 1, sizeof(*d));
+    d->path = arena_strdup(c->a, path);
+    d->hash = h;
+    d->next = *bucket;
+    *bucket = d;
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    char buf[32768];
+    size_t cap = 0;
+    long got;
+    d->ents = arena_alloc(c->a, sizeof(pg_ent_t));   /* non-NULL marks an opened directory */
+    while ((got = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < got; ) {
+            const struct pg_dirent64 *de = (const struct pg_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            const char *nm = de->d_name;
+            if (nm[0] == '.' && (!nm[1] || (nm[1] == '.' && !nm[2]))) continue;
+            if (d->n == cap) {
+                size_t nc = cap ? cap * 2 : 32;
+                d->ents = arena_realloc(c->a, d->ents, (cap ? cap : 1) * sizeof(pg_ent_t), nc * sizeof(pg_ent_t));
+                cap = nc;
+            }
+            size_t len = strlen(nm);
+            d->ents[d->n++] = (pg_ent_t){ arena_strndup(c->a, nm, len), len, de->d_type };
+        }
+    }
+    close(fd);
+    return d;
+}
+
+void pathglob_cache_reset(pathglob_cache_t *c) {
+    memset(c->buckets, 0, sizeof(c->buckets));
+}
+
+/* --- Expansion --- */
+
+static void emit(pg_ctx_t *g, size_t len) {
+    if (g->nout == (size_t)g->cap) {
+        int old = g->cap;
+        g->cap = g->cap ? g->cap * 2 : 8;
+        g->out = arena_realloc(g->c->a, g->out, (size_t)old * sizeof(char *), (size_t)g->cap * sizeof(char *));
+    }
+    g->out[g->nout++] = arena_strndup(g->c->a, g->path, len);
+}
+
+static int is_dir_at(const char *path, unsigned char type) {
+    if (type == DT_DIR) return 1;
+    if (type != DT_LNK && type != DT_UNKNOWN) return 0;
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Append N bytes of S to the path at LEN, unescaping if ESC; returns the
+ * new length, or 0 if it would not fit. */
+static size_t path_put(pg_ctx_t *g, size_t len, const char *s, size_t n, int esc) {
+    for (size_t i = 0; i < n; ++i) {
+        if (esc && s[i] == '\\' && i + 1 < n) i++;
+        if (len + 1 >= sizeof(g->path)) return 0;
+        g->path[len++] = s[i];
+    }
+    g->path[len] = '\0';
+    return len;
+}
+
+/* Match PAT (the rest of the pattern) below the path prefix of LEN bytes. */
+static void glob_rec(pg_ctx_t *g, const char *pat, size_t len) {
+    const char *e = pat;
+    while (*e && *e != '/') { if (*e == '\\' && e[1]) e++; e++; }
+    int last = *e == '\0';
+    const char *rest = last ? NULL : e + 1;
+
+    if (e == pat && !last) {            /* leading or doubled '/' */
+        if ((len = path_put(g, len, "/", 1, 0))) glob_rec(g, rest, len);
+        return;
+    }
+    if (!has_meta(pat, e)) {
+        size_t n = path_put(g, len, pat, (size_t)(e - pat), 1);
+        if (!n) return;
+        struct stat st;
+        if (last) {
+            if (lstat(g->path, &st) == 0) emit(g, n);
+        } else if (!*rest) {
+            if (stat(g->path, &st) == 0 && S_ISDIR(st.st_mode) && (n = path_put(g, n, "/", 1, 0))) emit(g, n);
+        } else if ((n = path_put(g, n, "/", 1, 0))) {
+            glob_rec(g, rest, n);
+        }
+        return;
+    }
+
+    pathglob_dir_t *d = listing(g->c, len ? g->path : ".");
+    if (!d) return;
+    gmatch_t m;
+    compile(g->c->a, pat, e, &m);
+    for (size_t i = 0; i < d->n; ++i) {
+        const pg_ent_t *ent = &d->ents[i];
+        if (!gmatch(&m, ent->name, ent->len)) continue;
+        size_t n = path_put(g, len, ent->name, ent->len, 0);
+        if (!n) continue;
+        if (last) emit(g, n);
+        else if (is_dir_at(g->path, ent->type) && (n = path_put(g, n, "/", 1, 0))) {
+            if (!*rest) emit(g, n);
+            else glob_rec(g, rest, n);
+        }
+        g->path[len] = '\0';
+    }
+}
+
+static int str_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+size_t pathglob_expand(pathglob_cache_t *c, const char *pattern, char ***out) {
+    pg_ctx_t *g = malloc(sizeof(*g));
+    if (!g) return 0;
+    g->c = c;
+    g->path[0] = '\0';
+    g->out = NULL;
+    g->nout = 0;
+    g->cap = 0;
+    glob_rec(g, pattern, 0);
+    if (g->nout > 1) qsort(g->out, g->nout, sizeof(char *), str_cmp);
+    size_t n = g->nout;
+    *out = g->out;
+    free(g);
+    return n;
+}
+
+char *pathglob_unescape(arena_t *a, const char *pattern) {
+    size_t n = strlen(pattern), w = 0;
+    char *s = arena_alloc(a, n + 1);
+    for (size_t i = 0; i < n; ++i) {
+        if (pattern[i] == '\\' && i + 1 < n) i++;
+        s[w++] = pattern[i];
+    }
+    s[w] = '\0';
+    return s;
+}
@@ -0,0 +1,232 @@
+/*
+ * place.c -- job placement between fork and exec (see place.h).
+ *
+ * Everything that can fail for a reason the user should see (a bad CPU
+ * list, a cgroup that cannot be created or limited) is done by
+ * place_parse() in the shell, before any stage starts.  The child only
+ * makes a few syscalls on itself: sched_setaffinity, setpriority,
+ * ioprio_set and a write of "0" to the cgroup.procs fd opened by the
+ * shell, which moves the writer into that group.
+ */
+#define _GNU_SOURCE
+#include "place.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* The cgroup v2 mount: /sys/fs/cgroup, or its unified/ subdirectory on
+ * hybrid systems that still mount v1 controllers at the top. */
+static const char *cg_root(void) {
+    if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0) return "/sys/fs/cgroup";
+    if (access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK) == 0) return "/sys/fs/cgroup/unified";
+    return "/sys/fs/cgroup";
+}
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static int parse_cpus(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s) {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s || lo < 0) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo) return -1;
+        }
+        if (hi >= CPU_SETSIZE) return -1;
+        for (long c = lo; c <= hi; ++c) CPU_SET((int)c, set);
+        s = end;
+        if (*s == ',') s++;
+        else if (*s) return -1;
+    }
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+static int parse_ioprio(const char *s) {
+    static const char *const classes[] = { NULL, "rt", "be", "idle" };
+    const char *colon = strchr(s, ':');
+    size_t n = colon ? (size_t)(colon - s) : strlen(s);
+    int cls = 0, level = 4;
+    for (int i = 1; i < 4; ++i)
+        if (strlen(classes[i]) == n && strncmp(s, classes[i], n) == 0) cls = i;
+    if (!cls) return -1;
+    if (colon) {
+        char *end;
+        level = (int)strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end || level < 0 || level > 7 || cls == 3) return -1;
+    }
+    return cls << IOPRIO_CLASS_SHIFT | (cls == 3 ? 0 : level);
+}
+
+/* Write S to DIR/FILE; -1 with errno set on failure. */
+static int write_file(const char *dir, const char *file, const char *s) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t w = write(fd, s, strlen(s));
+    int e = errno;
+    close(fd);
+    errno = e;
+    return w < 0 ? -1 : 0;
+}
+
+/* Set a controller file of group DIR, first enabling the controller in
+ * the parent's subtree if the file is not there. */
+static int cg_limit(const char *dir, const char *controller, const char *file, const char *value) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if (access(path, F_OK) < 0) {
+        char parent[PATH_MAX], on[32];
+        snprintf(parent, sizeof(parent), "%s", dir);
+        char *slash = strrchr(parent, '/');
+        if (slash) *slash = '\0';
+        snprintf(on, sizeof(on), "+%s", controller);
+        write_file(parent, "cgroup.subtree_control", on);
+    }
+    if (write_file(dir, file, value) < 0) {
+        fprintf(stderr, "place: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Create (mkdir -p) the group for NAME, set its limits and open its
+ * cgroup.procs; NAME is taken under the v2 root unless it is already a
+ * path inside it. */
+static int cg_prepare(place_t *p, const char *name, const char *mem, const char *cpu) {
+    const char *root = cg_root();
+    size_t rlen = strlen(root);
+    char dir[PATH_MAX];
+    if (strncmp(name, root, rlen) == 0 && name[rlen] == '/') snprintf(dir, sizeof(dir), "%s", name);
+    else {
+        while (*name == '/') name++;
+        snprintf(dir, sizeof(dir), "%s/%s", root, name);
+    }
+    for (char *s = dir + rlen + 1; ; ++s) {
+        if (*s != '/' && *s) continue;
+        char c = *s;
+        *s = '\0';
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+            fprintf(stderr, "place: %s: %s\n", dir, strerror(errno));
+            return -1;
+        }
+        *s = c;
+        if (!c) break;
+    }
+    if (mem && cg_limit(dir, "memory", "memory.max", mem) < 0) return -1;
+    if (cpu && cg_limit(dir, "cpu", "cpu.max", cpu) < 0) return -1;
+    char procs[PATH_MAX];
+    if (snprintf(procs, sizeof(procs), "%s/cgroup.procs", dir) >= (int)sizeof(procs)) errno = ENAMETOOLONG;
+    else p->cg_fd = open(procs, O_WRONLY | O_CLOEXEC);
+    if (p->cg_fd < 0) { fprintf(stderr, "place: %s: %s\n", procs, strerror(errno)); return -1; }
+    return 0;
+}
+
+/* memory.max value from 512M, 2G, 1048576 or max. */
+static int parse_mem(const char *s, char *out, size_t cap) {
+    if (strcmp(s, "max") == 0) { snprintf(out, cap, "max"); return 0; }
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s) return -1;
+    const char *units = "KMGT";
+    const char *u = *end ? strchr(units, *end & ~0x20) : NULL;
+    if (*end && (!u || end[1])) return -1;
+    for (const char *k = units; u && k <= u; ++k) v <<= 10;
+    snprintf(out, cap, "%llu", v);
+    return 0;
+}
+
+static void desc_add(char *buf, size_t cap, const char *fmt, const char *val) {
+    size_t n = strlen(buf);
+    if (n && n + 1 < cap) buf[n++] = ' ';
+    snprintf(buf + n, cap - n, fmt, val);
+}
+
+int place_parse(char **argv, place_t *p) {
+    memset(p, 0, sizeof(*p));
+    p->ioprio = -1;
+    p->cg_fd = -1;
+    const char *cg = NULL, *mem = NULL, *quota = NULL;
+    char memv[32], cpuv[48], desc[256] = "";
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        char opt = argv[i][1];
+        const char *v = argv[i][2] ? argv[i] + 2 : argv[++i];
+        if (!v || !strchr("cnigmq", opt)) goto usage;
+        char *end;
+        switch (opt) {
+        case 'c':
+            if (parse_cpus(v, &p->cpus) < 0) { fprintf(stderr, "place: %s: bad CPU list\n", v); return -1; }
+            p->have_cpus = 1;
+            desc_add(desc, sizeof(desc), "cpus=%s", v);
+            break;
+        case 'n':
+            p->nice = (int)strtol(v, &end, 10);
+            if (end == v || *end) goto usage;
+            p->have_nice = 1;
+            desc_add(desc, sizeof(desc), "nice=%s", v);
+            break;
+        case 'i':
+            if ((p->ioprio = parse_ioprio(v)) < 0) { fprintf(stderr, "place: %s: bad I/O class\n", v); return -1; }
+            desc_add(desc, sizeof(desc), "io=%s", v);
+            break;
+        case 'g': cg = v; break;
+        case 'm':
+            if (parse_mem(v, memv, sizeof(memv)) < 0) { fprintf(stderr, "place: %s: bad memory size\n", v); return -1; }
+            mem = v;
+            break;
+        case 'q': {
+            long pct = strtol(v, &end, 10);
+            if (end == v || (*end && strcmp(end, "%") != 0) || pct < 1) { fprintf(stderr, "place: %s: bad CPU percentage\n", v); return -1; }
+            snprintf(cpuv, sizeof(cpuv), "%ld 100000", pct * 1000);
+            quota = v;
+            break;
+        }
+        }
+    }
+    if (!argv[i]) goto usage;
+    if ((mem || quota) && !cg) { fprintf(stderr, "place: -m and -q need a cgroup (-g)\n"); return -1; }
+    if (cg) {
+        if (cg_prepare(p, cg, mem ? memv : NULL, quota ? cpuv : NULL) < 0) return -1;
+        desc_add(desc, sizeof(desc), "cg=%s", cg);
+        if (mem) desc_add(desc, sizeof(desc), "mem=%s", mem);
+        if (quota) desc_add(desc, sizeof(desc), "cpu=%s", quota);
+    }
+    p->desc = strdup(desc);
+    return i;
+usage:
+    fprintf(stderr, "place: usage: place [-c cpus] [-n inc] [-i class[:level]] [-g cgroup] [-m bytes] [-q percent] command...\n");
+    return -1;
+}
+
+int place_apply(const place_t *p) {
+    if (p->cg_fd >= 0 && write(p->cg_fd, "0", 1) < 0) { perror("place: cgroup.procs"); return -1; }
+    if (p->have_cpus && sched_setaffinity(0, sizeof(p->cpus), &p->cpus) < 0) { perror("place: sched_setaffinity"); return -1; }
+    if (p->have_nice) {
+        errno = 0;
+        int cur = getpriority(PRIO_PROCESS, 0);
+        if ((cur == -1 && errno) || setpriority(PRIO_PROCESS, 0, cur + p->nice) < 0) { perror("place: setpriority"); return -1; }
+    }
+    if (p->ioprio >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, p->ioprio) < 0) { perror("place: ioprio_set"); return -1; }
+    return 0;
+}
+
+void place_release(place_t *p) {
+    if (p->cg_fd >= 0) close(p->cg_fd);
+    p->cg_fd = -1;
+    free(p->desc);
+    p->desc = NULL;
+}
@@ -0,0 +1,298 @@
+/*
+ * prompt.c -- cached prompt rendering.
+ *
+ * The template is split once into text and $(cmd) segments.  Each segment
+ * keeps the value of its last finished run.  A new run starts, in a child
+ * writing to a non-blocking pipe, only when the template or the cwd
+ * changed or the value is PROMPT_SEG_TTL seconds old; runs in flight are
+ * drained at each prompt without waiting.  The rendered prompt is rebuilt
+ * only when the template, the cwd or a segment value changed.
+ *
+ * Segment children are created with no exit signal (clone() without
+ * SIGCHLD), which keeps them out of the shell's wait4(-1) reaper: only
+ * waitpid(..., __WCLONE) here collects them, so a pid we kill or wait for
+ * is never one that was already reaped and reused.
+ */
+#define _GNU_SOURCE
+#include "prompt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    char *cmd;
+    char *value;            /* last finished output, trailing newlines cut */
+    char *pending;          /* output of the run in flight */
+    size_t plen, pcap;
+    int fd;                 /* read end of the run in flight, -1 if none */
+    pid_t pid;              /* child not reaped yet, 0 if none */
+    int stale;              /* template or cwd changed since the last run */
+    time_t done_at;         /* when the last run finished */
+} seg_t;
+
+static char *tmpl;          /* template in use */
+static const char *default_tmpl;
+static prompt_runner_t runner;
+static seg_t *segs;
+static size_t nsegs;
+
+static char user[256], host[256], home[PATH_MAX], cwd[PATH_MAX];
+static int is_root;
+
+static char *out;
+static size_t out_len, out_cap;
+static int dirty = 1;
+
+static void out_put(const char *s, size_t n) {
+    if (out_len + n > out_cap) {
+        size_t nc = out_cap ? out_cap : 256;
+        while (nc < out_len + n) nc *= 2;
+        char *no = realloc(out, nc);
+        if (!no) return;
+        out = no;
+        out_cap = nc;
+    }
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+static void out_str(const char *s) { out_put(s, strlen(s)); }
+
+static void sh_runner(const char *cmd) {
+    execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+    _exit(127);
+}
+
+static time_t mono_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void load_cwd(void) {
+    if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "?");
+    dirty = 1;
+}
+
+/* --- Segments --- */
+
+static void seg_stop(seg_t *s) {
+    if (s->fd >= 0) close(s->fd);
+    if (s->pid > 0) { kill(s->pid, SIGTERM); waitpid(s->pid, NULL, __WCLONE); }
+    s->fd = -1;
+    s->pid = 0;
+}
+
+static void segs_free(void) {
+    for (size_t i = 0; i < nsegs; ++i) {
+        seg_stop(&segs[i]);
+        free(segs[i].cmd);
+        free(segs[i].value);
+        free(segs[i].pending);
+    }
+    free(segs);
+    segs = NULL;
+    nsegs = 0;
+}
+
+/* End of the $( that starts at P (just past the '('), or NULL. */
+static const char *subst_end(const char *p) {
+    int depth = 1;
+    for (; *p; ++p) {
+        if (*p == '(') depth++;
+        else if (*p == ')' && --depth == 0) return p;
+    }
+    return NULL;
+}
+
+static void set_template(const char *t) {
+    segs_free();
+    free(tmpl);
+    tmpl = strdup(t);
+    dirty = 1;
+    if (!tmpl) return;
+    for (const char *p = tmpl; (p = strstr(p, "$(")); ) {
+        const char *e = subst_end(p + 2);
+        if (!e) break;
+        seg_t *ns = realloc(segs, (nsegs + 1) * sizeof(*ns));
+        if (!ns) break;
+        segs = ns;
+        segs[nsegs] = (seg_t){ strndup(p + 2, (size_t)(e - p - 2)), NULL, NULL, 0, 0, -1, 0, 1, 0 };
+        nsegs++;
+        p = e + 1;
+    }
+}
+
+static void seg_start(seg_t *s) {
+    int pfd[2];
+    if (!s->cmd || pipe2(pfd, O_CLOEXEC | O_NONBLOCK) < 0) return;
+    /* fork() with exit signal 0: see the top of the file */
+    pid_t pid = (pid_t)syscall(SYS_clone, 0, NULL, NULL, NULL, NULL);
+    if (pid < 0) { close(pfd[0]); close(pfd[1]); return; }
+    if (pid == 0) {
+        /* own group, off the terminal: Ctrl-C and job control pass it by and
+         * it cannot scribble over the line being edited */
+        setpgid(0, 0);
+        int nul = open("/dev/null", O_RDWR);
+        if (nul >= 0) { dup2(nul, STDIN_FILENO); dup2(nul, STDERR_FILENO); close(nul); }
+        dup2(pfd[1], STDOUT_FILENO);
+        fcntl(STDOUT_FILENO, F_SETFL, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);   /* the shell may keep SIGCHLD blocked */
+        runner(s->cmd);
+        _exit(127);
+    }
+    close(pfd[1]);
+    s->fd = pfd[0];
+    s->pid = pid;
+    s->plen = 0;
+    s->stale = 0;
+}
+
+/* Drain what the run in flight has written; on EOF publish the value. */
+static void seg_poll(seg_t *s) {
+    if (s->pid > 0 && s->fd < 0) {
+        /* output finished earlier, the child had not exited yet */
+        if (waitpid(s->pid, NULL, WNOHANG | __WCLONE) != 0) s->pid = 0;
+        return;
+    }
+    if (s->fd < 0) return;
+    while (1) {
+        if (s->plen + 256 > s->pcap) {
+            size_t nc = s->pcap ? s->pcap * 2 : 256;
+            char *np = realloc(s->pending, nc);
+            if (!np) return;
+            s->pending = np;
+            s->pcap = nc;
+        }
+        ssize_t r = read(s->fd, s->pending + s->plen, s->pcap - s->plen - 1);
+        if (r > 0) { s->plen += (size_t)r; continue; }
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return;                        /* EAGAIN: still running */
+        break;
+    }
+    close(s->fd);
+    s->fd = -1;
+    s->done_at = mono_secs();
+    while (s->plen > 0 && (s->pending[s->plen - 1] == '\n' || s->pending[s->plen - 1] == '\r')) s->plen--;
+    s->pending[s->plen] = '\0';
+    if (!s->value || strcmp(s->value, s->pending) != 0) {
+        free(s->value);
+        s->value = strdup(s->pending);
+        dirty = 1;
+    }
+    if (waitpid(s->pid, NULL, WNOHANG | __WCLONE) != 0) s->pid = 0;
+}
+
+/* --- Rendering --- */
+
+static void put_cwd(int last_only) {
+    size_t hl = strlen(home);
+    int in_home = hl > 1 && strncmp(cwd, home, hl) == 0 && (cwd[hl] == '/' || cwd[hl] == '\0');
+    if (!last_only) {
+        if (in_home) { out_put("~", 1); out_str(cwd + hl); }
+        else out_str(cwd);
+        return;
+    }
+    if (in_home && cwd[hl] == '\0') { out_put("~", 1); return; }
+    const char *slash = strrchr(cwd, '/');
+    out_str(slash && slash[1] ? slash + 1 : cwd);
+}
+
+static void render(void) {
+    size_t si = 0;
+    out_len = 0;
+    for (const char *p = tmpl; p && *p; ) {
+        if (p[0] == '$' && p[1] == '(') {
+            const char *e = subst_end(p + 2);
+            if (e) {
+                if (si < nsegs && segs[si].value) out_str(segs[si].value);
+                si++;
+                p = e + 1;
+                continue;
+            }
+        }
+        if (*p != '\\' || !p[1]) { out_put(p++, 1); continue; }
+        switch (p[1]) {
+        case 'u': out_str(user); break;
+        case 'h': out_put(host, strcspn(host, ".")); break;
+        case 'H': out_str(host); break;
+        case 'w': put_cwd(0); break;
+        case 'W': put_cwd(1); break;
+        case '$': out_put(is_root ? "#" : "$", 1); break;
+        case 'n': out_put("\n", 1); break;
+        case 'e': out_put("\033", 1); break;
+        case '\\': out_put("\\", 1); break;
+        case '[': case ']': break;
+        default: out_put(p, 2); break;
+        }
+        p += 2;
+    }
+    dirty = 0;
+}
+
+/* --- API --- */
+
+void prompt_init(const char *default_template, prompt_runner_t r) {
+    struct passwd *pw = getpwuid(getuid());
+    snprintf(user, sizeof(user), "%s", pw ? pw->pw_name : "?");
+    const char *h = getenv("HOME");
+    if (!h && pw) h = pw->pw_dir;
+    snprintf(home, sizeof(home), "%s", h ? h : "");
+    if (gethostname(host, sizeof(host)) != 0) strcpy(host, "?");
+    host[sizeof(host) - 1] = '\0';
+    is_root = getuid() == 0;
+    runner = r ? r : sh_runner;
+    default_tmpl = default_template;
+    load_cwd();
+}
+
+/* Runs in flight started in the old directory: restart them. */
+void prompt_cwd_changed(void) {
+    load_cwd();
+    for (size_t i = 0; i < nsegs; ++i) { seg_stop(&segs[i]); segs[i].stale = 1; }
+}
+
+void prompt_show(void) {
+    const char *t = getenv("MYSHELL_PS1");
+    if (!t || !*t) t = default_tmpl ? default_tmpl : "\\$ ";
+    if (!tmpl || strcmp(tmpl, t) != 0) set_template(t);
+    time_t now = nsegs ? mono_secs() : 0;
+    for (size_t i = 0; i < nsegs; ++i) {
+        seg_t *s = &segs[i];
+        seg_poll(s);
+        if (s->fd < 0 && s->pid == 0 && (s->stale || now - s->done_at >= PROMPT_SEG_TTL)) seg_start(s);
+    }
+    if (dirty) render();
+    fflush(stdout);
+    size_t off = 0;
+    while (off < out_len) {
+        ssize_t w = write(STDOUT_FILENO, out + off, out_len - off);
+        if (w < 0) { if (errno == EINTR) continue; break; }
+        off += (size_t)w;
+    }
+}
+
+void prompt_free(void) {
+    segs_free();
+    free(tmpl);
+    free(out);
+    tmpl = NULL;
+    out = NULL;
+    out_len = out_cap = 0;
+    dirty = 1;
+}
@@ -0,0 +1,290 @@
+/*
+ * server.c -- pre-forked command server and its client (see server.h).
+ *
+ * A request is a req_hdr_t followed by LEN bytes of NUL-terminated
+ * strings: the cwd, ARGC argv entries, then ENVC environment entries.
+ * The client's fds 0-2 ride on the first byte as SCM_RIGHTS.  The worker
+ * answers with two int32s on the same socket: its pid once it owns the
+ * request, and the exit status, sent from an on_exit() handler so an
+ * `exit` inside the command reports too.  Children the worker forks
+ * inherit that handler, so it only sends from the worker itself.
+ *
+ * Idle workers announce that they took a connection by writing their pid
+ * to a pipe the server polls; the server forks replacements and reaps
+ * workers that have finished.
+ */
+#define _GNU_SOURCE
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SERVER_MAGIC 0x6d797368u            /* "mysh" */
+#define SERVER_MAX_REQUEST (16u << 20)
+
+typedef struct { uint32_t magic, argc, envc, len; } req_hdr_t;
+
+extern char **environ;
+
+static int make_addr(const char *path, struct sockaddr_un *sa) {
+    memset(sa, 0, sizeof(*sa));
+    if (strlen(path) >= sizeof(sa->sun_path)) { errno = ENAMETOOLONG; return -1; }
+    sa->sun_family = AF_UNIX;
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+static int write_full(int fd, const void *p, size_t n) {
+    const char *s = p;
+    while (n > 0) {
+        ssize_t w = send(fd, s, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == ENOTSOCK) w = write(fd, s, n);
+        if (w < 0) { if (errno == EINTR) continue; return -1; }
+        s += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* -1 on error or if the peer closes first. */
+static int read_full(int fd, void *p, size_t n) {
+    char *s = p;
+    while (n > 0) {
+        ssize_t r = read(fd, s, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        s += r;
+        n -= (size_t)r;
+    }
+    return 0;
+}
+
+/* --- Client --- */
+
+static volatile sig_atomic_t worker_pgid;
+
+static void forward_signal(int sig) {
+    if (worker_pgid > 0) kill(-(pid_t)worker_pgid, sig);
+}
+
+int server_client(const char *path, int argc, char **argv) {
+    struct sockaddr_un sa;
+    if (make_addr(path, &sa) < 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) { close(fd); return -1; }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "/");
+    size_t len = strlen(cwd) + 1;
+    uint32_t envc = 0;
+    for (int i = 0; i < argc; ++i) len += strlen(argv[i]) + 1;
+    for (char **e = environ; e && *e; ++e, ++envc) len += strlen(*e) + 1;
+    if (len > SERVER_MAX_REQUEST) { close(fd); return -1; }
+
+    req_hdr_t h = { SERVER_MAGIC, (uint32_t)argc, envc, (uint32_t)len };
+    char *buf = malloc(sizeof(h) + len), *w = buf + sizeof(h);
+    if (!buf) { close(fd); return -1; }
+    memcpy(buf, &h, sizeof(h));
+    w = stpcpy(w, cwd) + 1;
+    for (int i = 0; i < argc; ++i) w = stpcpy(w, argv[i]) + 1;
+    for (char **e = environ; e && *e; ++e) w = stpcpy(w, *e) + 1;
+
+    /* a closed stdio fd cannot be passed: stand in /dev/null */
+    int fds[3];
+    for (int i = 0; i < 3; ++i)
+        fds[i] = fcntl(i, F_GETFD) < 0 ? open("/dev/null", O_RDWR | O_CLOEXEC) : i;
+    struct iovec iov = { buf, sizeof(h) + len };
+    union { struct cmsghdr h; char b[CMSG_SPACE(sizeof(fds))]; } ctl;
+    struct msghdr m = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.b, .msg_controllen = sizeof(ctl.b) };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&m);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    ssize_t n;
+    while ((n = sendmsg(fd, &m, MSG_NOSIGNAL)) < 0 && errno == EINTR) ;
+    for (int i = 0; i < 3; ++i) if (fds[i] != i && fds[i] >= 0) close(fds[i]);
+    if (n < 0 || write_full(fd, buf + n, iov.iov_len - (size_t)n) < 0) { free(buf); close(fd); return -1; }
+    free(buf);
+
+    /* no pid: the request was turned down before anything ran */
+    int32_t pid, st;
+    if (read_full(fd, &pid, sizeof(pid)) < 0) { close(fd); return -1; }
+    worker_pgid = pid;
+    struct sigaction fw = { .sa_handler = forward_signal };
+    sigemptyset(&fw.sa_mask);
+    sigaction(SIGINT, &fw, NULL);
+    sigaction(SIGTERM, &fw, NULL);
+    sigaction(SIGHUP, &fw, NULL);
+    sigaction(SIGQUIT, &fw, NULL);
+    if (read_full(fd, &st, sizeof(st)) < 0) {
+        fprintf(stderr, "myshell: server: worker %d went away\n", (int)pid);
+        st = 1;
+    }
+    close(fd);
+    return st;
+}
+
+/* --- Workers --- */
+
+static int reply_fd = -1;
+static pid_t reply_pid;     /* the worker; its children must stay quiet */
+
+static void send_status(int status, void *arg) {
+    (void)arg;
+    int32_t st = status;
+    fflush(NULL);           /* output ahead of the status the client waits on */
+    if (reply_fd >= 0 && getpid() == reply_pid) write_full(reply_fd, &st, sizeof(st));
+}
+
+/* Receive one request on C, adopt its fds and cwd, and run it.  Never
+ * returns. */
+static void worker_run(int c, server_run_t run) {
+    struct ucred cr;
+    socklen_t cl = sizeof(cr);
+    if (getsockopt(c, SOL_SOCKET, SO_PEERCRED, &cr, &cl) < 0 || cr.uid != getuid()) _exit(1);
+
+    req_hdr_t h;
+    int fds[3] = { -1, -1, -1 };
+    struct iovec iov = { &h, sizeof(h) };
+    union { struct cmsghdr h; char b[CMSG_SPACE(sizeof(fds))]; } ctl;
+    struct msghdr m = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.b, .msg_controllen = sizeof(ctl.b) };
+    ssize_t n;
+    while ((n = recvmsg(c, &m, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) ;
+    if (n <= 0) _exit(1);
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS && cm->cmsg_len == CMSG_LEN(sizeof(fds)))
+            memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    if ((size_t)n < sizeof(h) && read_full(c, (char *)&h + n, sizeof(h) - (size_t)n) < 0) _exit(1);
+    if (h.magic != SERVER_MAGIC || h.len > SERVER_MAX_REQUEST || h.argc == 0 || h.argc + h.envc >= h.len || fds[2] < 0) _exit(1);
+
+    char *data = malloc(h.len + 1);
+    char **argv = calloc(h.argc + h.envc + 2, sizeof(char *));
+    if (!data || !argv || read_full(c, data, h.len) < 0) _exit(1);
+    data[h.len] = '\0';
+    char *p = data, *end = data + h.len;
+    const char *cwd = p;
+    p += strlen(p) + 1;
+    for (uint32_t i = 0; i < h.argc + h.envc; ++i) {
+        if (p >= end) _exit(1);
+        argv[i + (i >= h.argc)] = p;     /* argv, NULL, envp, NULL */
+        p += strlen(p) + 1;
+    }
+    char **envp = argv + h.argc + 1;
+
+    for (int i = 0; i < 3; ++i) { dup2(fds[i], i); close(fds[i]); }
+    setpgid(0, 0);
+    int32_t me = getpid();
+    if (write_full(c, &me, sizeof(me)) < 0) _exit(1);
+    reply_fd = c;
+    reply_pid = getpid();
+    on_exit(send_status, NULL);
+    if (chdir(cwd) < 0) {
+        fprintf(stderr, "myshell: %s: %s\n", cwd, strerror(errno));
+        exit(1);
+    }
+    exit(run((int)h.argc, argv, envp));
+}
+
+/* An idle worker: wait for a connection, report it on NOTIFY_FD, run it. */
+static void worker(int lfd, int notify_fd, server_run_t run) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    int c;
+    while ((c = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+        if (errno != EINTR && errno != ECONNABORTED) _exit(1);
+    close(lfd);
+    int32_t me = getpid();
+    write_full(notify_fd, &me, sizeof(me));
+    close(notify_fd);
+    worker_run(c, run);
+}
+
+/* --- Server --- */
+
+static volatile sig_atomic_t server_stop;
+
+static void on_stop(int sig) { (void)sig; server_stop = 1; }
+
+static void drop_pid(pid_t *v, int *n, pid_t pid) {
+    for (int i = 0; i < *n; ++i)
+        if (v[i] == pid) { v[i] = v[--*n]; return; }
+}
+
+int server_main(const char *path, int workers, server_run_t run, void (*warm)(void)) {
+    struct sockaddr_un sa;
+    if (make_addr(path, &sa) < 0) { fprintf(stderr, "myshell: server: %s: %s\n", path, strerror(errno)); return 2; }
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) { perror("myshell: server: socket"); return 1; }
+    /* a socket file nobody answers on is left over from a dead server */
+    if (connect(lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+        fprintf(stderr, "myshell: server: %s: already being served\n", path);
+        return 1;
+    }
+    close(lfd);
+    lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    mode_t old = umask(077);
+    int rc = lfd < 0 ? -1 : bind(lfd, (struct sockaddr *)&sa, sizeof(sa));
+    umask(old);
+    int np[2];
+    if (rc < 0 || listen(lfd, 128) < 0 || pipe2(np, O_CLOEXEC) < 0) {
+        fprintf(stderr, "myshell: server: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction stop = { .sa_handler = on_stop };
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t *idle = calloc((size_t)workers, sizeof(pid_t));
+    int nidle = 0;
+    if (!idle) return 1;
+    while (!server_stop) {
+        while (nidle < workers) {
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) { close(np[0]); worker(lfd, np[1], run); }
+            if (pid < 0) { perror("myshell: server: fork"); break; }
+            idle[nidle++] = pid;
+        }
+
+        struct pollfd pf = { np[0], POLLIN, 0 };
+        int n = poll(&pf, 1, 1000);
+        if (n == 0 && warm) warm();     /* off the request path: only after a quiet second */
+        if (n > 0) {
+            int32_t busy[PIPE_BUF / sizeof(int32_t)];
+            ssize_t r = read(np[0], busy, sizeof(busy));
+            for (ssize_t i = 0; i + (ssize_t)sizeof(int32_t) <= r; i += sizeof(int32_t))
+                drop_pid(idle, &nidle, busy[i / (ssize_t)sizeof(int32_t)]);
+        }
+        /* busy workers exit when their request is done; an idle one
+         * that died is replaced on the next pass */
+        pid_t w;
+        while ((w = waitpid(-1, NULL, WNOHANG)) > 0) drop_pid(idle, &nidle, w);
+    }
+
+    for (int i = 0; i < nidle; ++i) kill(idle[i], SIGTERM);
+    free(idle);
+    close(lfd);
+    close(np[0]);
+    close(np[1]);
+    unlink(path);
+    return 0;
+}
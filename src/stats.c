@@ -0,0 +1,228 @@
+/*
+ * stats.c -- counters, log2 latency histograms and the periodic dump.
+ *
+ * All state is static and fixed-size.  A sample lands in bucket
+ * floor(log2(ns)), found with one count-leading-zeros; percentiles in the
+ * report are bucket upper bounds, so they are within a factor of two.
+ * Dumps render the JSON snapshot into a memory stream and hand it to the
+ * file (written as TARGET.tmp, then renamed over TARGET) or to a
+ * non-blocking unix socket connection; a scraper that is not listening
+ * costs one failed connect().
+ */
+#define _GNU_SOURCE
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t count, sum, min, max;
+    uint64_t buckets[STATS_BUCKETS];
+} stat_hist_t;
+
+uint64_t stats_counters[STAT_NCOUNTERS];
+static stat_hist_t hists[STAT_NPHASES];
+static uint64_t started;
+
+static const char *const phase_names[STAT_NPHASES] = {
+    "read", "parse", "expand", "subst", "launch", "lookup", "wait", "history"
+};
+
+static const char *const counter_names[STAT_NCOUNTERS] = {
+    "commands", "forks", "spawns", "inproc_builtins", "path_probes",
+    "path_hits", "path_misses", "stat_hits", "stat_misses",
+    "parse_hits", "parse_misses", "arena_allocs", "arena_blocks",
+    "glob_reads", "glob_hits"
+};
+
+static char *dump_target;
+static unsigned dump_interval;
+static uint64_t dump_next;
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void stats_record(stat_phase_t phase, uint64_t ns) {
+    stat_hist_t *h = &hists[phase];
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+    if (b >= STATS_BUCKETS) b = STATS_BUCKETS - 1;
+    h->buckets[b]++;
+    if (!h->count || ns < h->min) h->min = ns;
+    if (ns > h->max) h->max = ns;
+    h->count++;
+    h->sum += ns;
+}
+
+void stats_since(stat_phase_t phase, uint64_t start) {
+    stats_record(phase, stats_now() - start);
+}
+
+void stats_reset(void) {
+    memset(stats_counters, 0, sizeof(stats_counters));
+    memset(hists, 0, sizeof(hists));
+    started = stats_now();
+}
+
+/* Upper bound (ns) of the bucket holding the P-th percentile sample. */
+static uint64_t percentile(const stat_hist_t *h, unsigned p) {
+    uint64_t want = (h->count * p + 99) / 100, seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; ++b) {
+        seen += h->buckets[b];
+        if (seen >= want && seen) {
+            uint64_t hi = (uint64_t)2 << b;
+            return hi < h->max ? hi : h->max;
+        }
+    }
+    return h->max;
+}
+
+void stats_print(FILE *out, int json) {
+    if (!started) started = stats_now();
+    double up = (double)(stats_now() - started) / 1e9;
+    if (!json) {
+        fprintf(out, "uptime %.1fs  pid %d\n\ncounters\n", up, (int)getpid());
+        for (int i = 0; i < STAT_NCOUNTERS; ++i)
+            fprintf(out, "  %-16s %12llu\n", counter_names[i], (unsigned long long)stats_counters[i]);
+        fprintf(out, "\n%-10s %10s %12s %12s %12s %12s %12s\n", "phase", "count", "mean_us",
+                "p50_us", "p99_us", "min_us", "max_us");
+        for (int i = 0; i < STAT_NPHASES; ++i) {
+            const stat_hist_t *h = &hists[i];
+            fprintf(out, "%-10s %10llu %12.3f %12.3f %12.3f %12.3f %12.3f\n", phase_names[i],
+                    (unsigned long long)h->count, h->count ? (double)h->sum / (double)h->count / 1e3 : 0.0,
+                    (double)percentile(h, 50) / 1e3, (double)percentile(h, 99) / 1e3,
+                    (double)h->min / 1e3, (double)h->max / 1e3);
+        }
+        return;
+    }
+    fprintf(out, "{\"pid\":%d,\"uptime_s\":%.3f,\"counters\":{", (int)getpid(), up);
+    for (int i = 0; i < STAT_NCOUNTERS; ++i)
+        fprintf(out, "%s\"%s\":%llu", i ? "," : "", counter_names[i], (unsigned long long)stats_counters[i]);
+    fputs("},\"phases\":{", out);
+    for (int i = 0; i < STAT_NPHASES; ++i) {
+        const stat_hist_t *h = &hists[i];
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"sum_ns\":%llu,\"min_ns\":%llu,\"max_ns\":%llu,\"log2_buckets\":[",
+                i ? "," : "", phase_names[i], (unsigned long long)h->count, (unsigned long long)h->sum,
+                (unsigned long long)h->min, (unsigned long long)h->max);
+        /* trailing empty buckets are left out */
+        int last = STATS_BUCKETS - 1;
+        while (last >= 0 && !h->buckets[last]) last--;
+        for (int b = 0; b <= last; ++b) fprintf(out, "%s%llu", b ? "," : "", (unsigned long long)h->buckets[b]);
+        fputs("]}", out);
+    }
+    fputs("}}\n", out);
+}
+
+/* --- Periodic dump --- */
+
+static int dump_socket(const char *path, const char *data, size_t len) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(sa.sun_path)) { errno = ENAMETOOLONG; return -1; }
+    strcpy(sa.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int rc = connect(fd, (struct sockaddr *)&sa, sizeof(sa));
+    /* a reader that cannot keep up loses the snapshot, the shell never waits */
+    if (rc == 0) rc = send(fd, data, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+    close(fd);
+    return rc;
+}
+
+static int dump_file(const char *path, const char *data, size_t len) {
+    size_t pl = strlen(path);
+    char *tmp = malloc(pl + 5);
+    if (!tmp) return -1;
+    memcpy(tmp, path, pl);
+    memcpy(tmp + pl, ".tmp", 5);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int rc = -1;
+    if (fd >= 0) {
+        rc = write(fd, data, len) == (ssize_t)len ? 0 : -1;
+        if (close(fd) < 0) rc = -1;
+        if (rc == 0) rc = rename(tmp, path);
+        if (rc < 0) unlink(tmp);
+    }
+    free(tmp);
+    return rc;
+}
+
+static int dump_now(void) {
+    char *data = NULL;
+    size_t len = 0;
+    FILE *m = open_memstream(&data, &len);
+    if (!m) return -1;
+    stats_print(m, 1);
+    fclose(m);
+    int rc = strncmp(dump_target, "unix:", 5) == 0 ? dump_socket(dump_target + 5, data, len)
+                                                   : dump_file(dump_target, data, len);
+    free(data);
+    return rc;
+}
+
+int stats_dump_config(const char *target, unsigned interval) {
+    free(dump_target);
+    dump_target = NULL;
+    if (!target) return 0;
+    dump_target = strdup(target);
+    if (!dump_target) return -1;
+    dump_interval = interval ? interval : 10;
+    dump_next = stats_now() + (uint64_t)dump_interval * 1000000000u;
+    /* try it once now so a bad target is reported where it was set */
+    if (strncmp(target, "unix:", 5) != 0 && dump_now() < 0) {
+        int e = errno;
+        free(dump_target);
+        dump_target = NULL;
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+int stats_dump_timeout(void) {
+    if (!dump_target) return -1;
+    uint64_t now = stats_now();
+    if (now >= dump_next) return 0;
+    uint64_t ms = (dump_next - now + 999999) / 1000000;
+    return ms > 1000000 ? 1000000 : (int)ms;
+}
+
+void stats_tick(void) {
+    if (!dump_target) return;
+    uint64_t now = stats_now();
+    if (now < dump_next) return;
+    dump_next = now + (uint64_t)dump_interval * 1000000000u;
+    dump_now();
+}
+
+/* --- Builtin --- */
+
+int stats_builtin(char **argv, FILE *out) {
+    int json = 0;
+    for (int i = 1; argv[i]; ++i) {
+        if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--json") == 0) json = 1;
+        else if (strcmp(argv[i], "-r") == 0) { stats_reset(); return 0; }
+        else if (strcmp(argv[i], "-d") == 0 && argv[i + 1]) {
+            const char *target = argv[++i];
+            unsigned interval = argv[i + 1] ? (unsigned)strtoul(argv[++i], NULL, 10) : 0;
+            if (strcmp(target, "off") == 0) target = NULL;
+            if (stats_dump_config(target, interval) < 0) {
+                fprintf(stderr, "shellstats: %s: %s\n", target, strerror(errno));
+                return 1;
+            }
+            return 0;
+        } else {
+            fprintf(stderr, "shellstats: usage: shellstats [-j] [-r] [-d target [seconds] | -d off]\n");
+            return 2;
+        }
+    }
+    stats_print(out, json);
+    return 0;
+}
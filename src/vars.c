@@ -0,0 +1,313 @@
+/*
+ * vars.c -- hashed variable store with a lazily rebuilt environment.
+ *
+ * The table is chained on FNV-1a of the name and doubles at 3/4 load.
+ * envp[] holds pointers straight into the variables' own strings; any
+ * change to an exported variable only sets env_dirty and parks the old
+ * string on the retired list, and the next vars_environ() rebuilds the
+ * array in one pass over the table and frees what was retired.
+ */
+#define _GNU_SOURCE
+#include "vars.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct var {
+    char *str;              /* "NAME=value", or just "NAME" when it has no value */
+    size_t nlen;
+    int has_value;
+    int exported;
+    uint32_t hash;
+    struct var *next;
+} var_t;
+
+static var_t **buckets;
+static size_t nbuckets, nvars;
+
+static char **envp;
+static size_t envp_cap;
+static int env_dirty = 1;
+static char **retired;
+static size_t nretired, retired_cap;
+
+extern char **environ;
+
+static uint32_t var_hash(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+    return h;
+}
+
+int vars_valid_name(const char *name, size_t len) {
+    if (len == 0 || !(name[0] == '_' || (name[0] >= 'A' && name[0] <= 'Z') || (name[0] >= 'a' && name[0] <= 'z')))
+        return 0;
+    for (size_t i = 1; i < len; ++i) {
+        char c = name[i];
+        if (!(c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))) return 0;
+    }
+    return 1;
+}
+
+static var_t *var_find(const char *name, size_t len, uint32_t h) {
+    if (!nbuckets) return NULL;
+    for (var_t *v = buckets[h & (nbuckets - 1)]; v; v = v->next)
+        if (v->hash == h && v->nlen == len && memcmp(v->str, name, len) == 0) return v;
+    return NULL;
+}
+
+static void table_grow(void) {
+    size_t nb = nbuckets ? nbuckets * 2 : 128;
+    var_t **n = calloc(nb, sizeof(*n));
+    if (!n) return;
+    for (size_t b = 0; b < nbuckets; ++b) {
+        var_t *v = buckets[b];
+        while (v) {
+            var_t *next = v->next;
+            v->next = n[v->hash & (nb - 1)];
+            n[v->hash & (nb - 1)] = v;
+            v = next;
+        }
+    }
+    free(buckets);
+    buckets = n;
+    nbuckets = nb;
+}
+
+/* Drop V's string; one that envp[] may still point at waits for the next
+ * rebuild. */
+static void retire(var_t *v) {
+    if (!v->exported || !v->has_value) { free(v->str); return; }
+    env_dirty = 1;
+    if (nretired == retired_cap) {
+        size_t nc = retired_cap ? retired_cap * 2 : 16;
+        char **n = realloc(retired, nc * sizeof(*n));
+        if (!n) { return; }         /* leak it rather than free it under envp */
+        retired = n;
+        retired_cap = nc;
+    }
+    retired[nretired++] = v->str;
+}
+
+static int var_store(const char *name, size_t len, const char *value, int flags) {
+    if (!vars_valid_name(name, len)) return -1;
+    uint32_t h = var_hash(name, len);
+    var_t *v = var_find(name, len, h);
+    size_t vl = value ? strlen(value) : 0;
+    char *s = malloc(len + vl + 2);
+    if (!s) return -1;
+    memcpy(s, name, len);
+    if (value) { s[len] = '='; memcpy(s + len + 1, value, vl + 1); }
+    else s[len] = '\0';
+    if (!v) {
+        if (nvars + 1 > nbuckets * 3 / 4) table_grow();
+        if (!nbuckets || !(v = calloc(1, sizeof(*v)))) { free(s); return -1; }
+        v->nlen = len;
+        v->hash = h;
+        v->next = buckets[h & (nbuckets - 1)];
+        buckets[h & (nbuckets - 1)] = v;
+        nvars++;
+    } else {
+        retire(v);
+    }
+    v->str = s;
+    v->has_value = value != NULL;
+    if (flags & VAR_EXPORT) v->exported = 1;
+    if (v->exported) env_dirty = 1;
+    return 0;
+}
+
+void vars_init(char **env) {
+    for (char **e = env; e && *e; ++e) {
+        const char *eq = strchr(*e, '=');
+        if (!eq) continue;
+        var_store(*e, (size_t)(eq - *e), eq + 1, VAR_EXPORT);
+    }
+}
+
+const char *vars_get(const char *name, size_t len) {
+    var_t *v = var_find(name, len, var_hash(name, len));
+    return v && v->has_value ? v->str + len + 1 : NULL;
+}
+
+int vars_set(const char *name, size_t len, const char *value, int flags) {
+    return var_store(name, len, value, flags);
+}
+
+int vars_assign(const char *a, int flags) {
+    const char *eq = strchr(a, '=');
+    if (!eq) return -1;
+    return var_store(a, (size_t)(eq - a), eq + 1, flags);
+}
+
+int vars_unset(const char *name, size_t len) {
+    if (!nbuckets) return 0;
+    uint32_t h = var_hash(name, len);
+    var_t **pp = &buckets[h & (nbuckets - 1)];
+    for (; *pp; pp = &(*pp)->next) {
+        var_t *v = *pp;
+        if (v->hash != h || v->nlen != len || memcmp(v->str, name, len) != 0) continue;
+        *pp = v->next;
+        retire(v);
+        free(v);
+        nvars--;
+        return 0;
+    }
+    return 0;
+}
+
+/* Mark NAME exported (ON) or local; an unset name is created without a
+ * value, to be exported once it gets one. */
+static int var_export(const char *name, size_t len, int on) {
+    var_t *v = var_find(name, len, var_hash(name, len));
+    if (!v) return on ? var_store(name, len, NULL, VAR_EXPORT) : 0;
+    if (v->exported == on) return 0;
+    if (v->has_value) {
+        if (!on) {
+            /* envp[] may still point at the string: hand it a copy */
+            char *copy = strdup(v->str);
+            if (!copy) return -1;
+            retire(v);
+            v->str = copy;
+        }
+        env_dirty = 1;
+    }
+    v->exported = on;
+    return 0;
+}
+
+char **vars_environ(void) {
+    if (!env_dirty) return envp;
+    size_t n = 0;
+    for (size_t b = 0; b < nbuckets; ++b)
+        for (var_t *v = buckets[b]; v; v = v->next) n += v->exported && v->has_value;
+    if (n + 1 > envp_cap) {
+        size_t nc = envp_cap ? envp_cap : 64;
+        while (nc < n + 1) nc *= 2;
+        char **ne = realloc(envp, nc * sizeof(*ne));
+        if (!ne) return envp ? envp : environ;
+        envp = ne;
+        envp_cap = nc;
+    }
+    size_t k = 0;
+    for (size_t b = 0; b < nbuckets; ++b)
+        for (var_t *v = buckets[b]; v; v = v->next)
+            if (v->exported && v->has_value) envp[k++] = v->str;
+    envp[k] = NULL;
+    environ = envp;
+    for (size_t i = 0; i < nretired; ++i) free(retired[i]);
+    nretired = 0;
+    env_dirty = 0;
+    return envp;
+}
+
+char **vars_environ_with(char *const *assigns, int n, arena_t *a) {
+    char **base = vars_environ();
+    size_t nb = 0;
+    while (base[nb]) nb++;
+    char **e = arena_alloc(a, (nb + (size_t)n + 1) * sizeof(*e));
+    memcpy(e, base, nb * sizeof(*e));
+    size_t k = nb;
+    for (int i = 0; i < n; ++i) {
+        size_t len = (size_t)(strchr(assigns[i], '=') - assigns[i]) + 1;   /* through '=' */
+        size_t j = 0;
+        while (j < k && strncmp(e[j], assigns[i], len) != 0) j++;
+        e[j] = assigns[i];
+        if (j == k) k++;
+    }
+    e[k] = NULL;
+    return e;
+}
+
+/* --- Builtins --- */
+
+static int name_cmp(const void *a, const void *b) {
+    const var_t *x = *(var_t *const *)a, *y = *(var_t *const *)b;
+    size_t n = x->nlen < y->nlen ? x->nlen : y->nlen;
+    int c = memcmp(x->str, y->str, n);
+    return c ? c : (x->nlen > y->nlen) - (x->nlen < y->nlen);
+}
+
+/* `export -p` form, in name order, values single-quoted for re-input. */
+static int print_exports(FILE *out) {
+    var_t **list = malloc((nvars ? nvars : 1) * sizeof(*list));
+    if (!list) return 1;
+    size_t n = 0;
+    for (size_t b = 0; b < nbuckets; ++b)
+        for (var_t *v = buckets[b]; v; v = v->next) if (v->exported) list[n++] = v;
+    qsort(list, n, sizeof(*list), name_cmp);
+    for (size_t i = 0; i < n; ++i) {
+        fprintf(out, "export %.*s", (int)list[i]->nlen, list[i]->str);
+        if (list[i]->has_value) {
+            fputs("='", out);
+            for (const char *p = list[i]->str + list[i]->nlen + 1; *p; ++p)
+                if (*p == '\'') fputs("'\\''", out); else fputc(*p, out);
+            fputc('\'', out);
+        }
+        fputc('\n', out);
+    }
+    free(list);
+    return 0;
+}
+
+int vars_export_builtin(char **argv, FILE *out) {
+    int i = 1, on = 1, st = 0;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        for (const char *o = argv[i] + 1; *o; ++o) {
+            if (*o == 'n') on = 0;
+            else if (*o != 'p') {
+                fprintf(stderr, "export: -%c: invalid option\nexport: usage: export [-n] [-p] [name[=value] ...]\n", *o);
+                return 2;
+            }
+        }
+    }
+    if (!argv[i]) return print_exports(out);
+    for (; argv[i]; ++i) {
+        const char *eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!vars_valid_name(argv[i], len)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", argv[i]);
+            st = 1;
+            continue;
+        }
+        if (eq) var_store(argv[i], len, eq + 1, on ? VAR_EXPORT : 0);
+        if (var_export(argv[i], len, on) < 0) st = 1;
+    }
+    return st;
+}
+
+int vars_unset_builtin(char **argv) {
+    int i = 1, st = 0;
+    if (argv[i] && (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--") == 0)) i++;
+    for (; argv[i]; ++i) {
+        size_t len = strlen(argv[i]);
+        if (!vars_valid_name(argv[i], len)) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", argv[i]);
+            st = 1;
+            continue;
+        }
+        vars_unset(argv[i], len);
+    }
+    return st;
+}
+
+void vars_free(void) {
+    for (size_t b = 0; b < nbuckets; ++b) {
+        var_t *v = buckets[b];
+        while (v) { var_t *n = v->next; free(v->str); free(v); v = n; }
+    }
+    free(buckets);
+    buckets = NULL;
+    nbuckets = nvars = 0;
+    for (size_t i = 0; i < nretired; ++i) free(retired[i]);
+    free(retired);
+    retired = NULL;
+    nretired = retired_cap = 0;
+    if (environ == envp) environ = NULL;
+    free(envp);
+    envp = NULL;
+    envp_cap = 0;
+    env_dirty = 1;
+}
@@ -0,0 +1,285 @@
+/*
+ * bench.c -- hot-path benchmarks for myshell; run with `make bench`.
+ *
+ * Usage: bench path/to/myshell
+ *
+ * Every benchmark drives the real binary: scripts go through
+ * `myshell script`, and anything that needs the interactive path (startup
+ * to the first prompt, background jobs reaped through the signalfd loop)
+ * runs on a pseudo-terminal.  Each one is repeated $BENCH_RUNS times
+ * (default 5) and reported as one JSON object per line on stdout, with
+ * min/median/mean wall time per run and a rate derived from the median,
+ * so results can be stored and diffed across releases.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READY "bench-ready> "
+
+static const char *shell;
+static char dir[64];
+static int runs = 5;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void die(const char *what) {
+    perror(what);
+    exit(1);
+}
+
+static int cmp_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* One result line.  PARAMS is a JSON fragment ("\"k\":v,...") or "". */
+static void report(const char *name, const char *params, long ops, int64_t *ns, int n) {
+    qsort(ns, (size_t)n, sizeof(*ns), cmp_i64);
+    double sum = 0;
+    for (int i = 0; i < n; ++i) sum += (double)ns[i];
+    double med = (double)ns[n / 2];
+    printf("{\"bench\":\"%s\",%s%s\"ops\":%ld,\"runs\":%d,\"min_ms\":%.3f,\"median_ms\":%.3f,"
+           "\"mean_ms\":%.3f,\"ops_per_s\":%.1f}\n",
+           name, params, *params ? "," : "", ops, n, (double)ns[0] / 1e6, med / 1e6,
+           sum / n / 1e6, med > 0 ? (double)ops * 1e9 / med : 0.0);
+    fflush(stdout);
+}
+
+/* --- Scripts --- */
+
+static FILE *open_script(const char *name, char *path, size_t n) {
+    snprintf(path, n, "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) die(path);
+    return f;
+}
+
+/* Wall time of `myshell SCRIPT`, output discarded. */
+static int64_t run_script(const char *script, const char *launcher) {
+    int64_t t0 = now_ns();
+    pid_t pid = fork();
+    if (pid < 0) die("fork");
+    if (pid == 0) {
+        int nul = open("/dev/null", O_RDWR);
+        if (nul >= 0) { dup2(nul, STDIN_FILENO); dup2(nul, STDOUT_FILENO); dup2(nul, STDERR_FILENO); }
+        if (launcher) setenv("MYSHELL_LAUNCHER", launcher, 1);
+        execl(shell, shell, script, (char *)NULL);
+        _exit(127);
+    }
+    int st;
+    while (waitpid(pid, &st, 0) < 0 && errno == EINTR) ;
+    return now_ns() - t0;
+}
+
+static void bench_script(const char *name, const char *params, const char *script, long ops, const char *launcher) {
+    int64_t ns[64];
+    for (int i = 0; i < runs; ++i) ns[i] = run_script(script, launcher);
+    report(name, params, ops, ns, runs);
+}
+
+static void bench_fork_exec(void) {
+    char path[128];
+    const long n = 1000;
+    FILE *f = open_script("fork.sh", path, sizeof(path));
+    for (long i = 0; i < n; ++i) fputs("/bin/true\n", f);
+    fclose(f);
+    bench_script("fork_exec", "\"launcher\":\"fork\"", path, n, "fork");
+    bench_script("fork_exec", "\"launcher\":\"spawn\"", path, n, "spawn");
+}
+
+/* Long distinct lines of plain, quoted and $VAR words, run by the in-shell
+ * `true`: the time is parsing and expansion, not processes. */
+static void bench_parse_expand(void) {
+    char path[128], params[64];
+    const long n = 2000;
+    long bytes = 0;
+    FILE *f = open_script("parse.sh", path, sizeof(path));
+    for (long i = 0; i < n; ++i) {
+        bytes += fprintf(f, "true");
+        for (int k = 0; k < 50; ++k)
+            bytes += fprintf(f, " w%ld_%d \"dq $HOME %d\" 'sq %d' $HOME/p%d", i, k, k, k, k);
+        bytes += fprintf(f, "\n");
+    }
+    fclose(f);
+    snprintf(params, sizeof(params), "\"bytes\":%ld", bytes);
+    bench_script("parse_expand", params, path, n, NULL);
+}
+
+static void bench_pipelines(void) {
+    static const int stages[] = { 1, 2, 4, 8 };
+    const long n = 100;
+    for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); ++s) {
+        char path[128], params[32];
+        FILE *f = open_script("pipe.sh", path, sizeof(path));
+        for (long i = 0; i < n; ++i) {
+            for (int k = 0; k < stages[s]; ++k) fputs(k ? " | /bin/true" : "/bin/true", f);
+            fputc('\n', f);
+        }
+        fclose(f);
+        snprintf(params, sizeof(params), "\"stages\":%d", stages[s]);
+        bench_script("pipeline", params, path, n, NULL);
+    }
+}
+
+/* --- Interactive, on a pty --- */
+
+typedef struct { char tail[256]; size_t len; } matcher_t;
+
+/* Feed output bytes; returns 1 once MARK has been seen. */
+static int match_feed(matcher_t *m, const char *buf, size_t n, const char *mark) {
+    char window[sizeof(m->tail) + 4096];
+    size_t ml = strlen(mark);
+    while (n > 0) {
+        size_t take = n > 4096 ? 4096 : n;
+        memcpy(window, m->tail, m->len);
+        memcpy(window + m->len, buf, take);
+        size_t wl = m->len + take;
+        if (memmem(window, wl, mark, ml)) return 1;
+        size_t keep = wl < ml ? wl : ml - 1;
+        memcpy(m->tail, window + wl - keep, keep);
+        m->len = keep;
+        buf += take;
+        n -= take;
+    }
+    return 0;
+}
+
+static pid_t start_pty(const char *home, int *master) {
+    pid_t pid = forkpty(master, NULL, NULL, NULL);
+    if (pid < 0) die("forkpty");
+    if (pid == 0) {
+        setenv("HOME", home, 1);
+        setenv("MYSHELL_PS1", READY, 1);
+        execl(shell, shell, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+/* Write INPUT (may be NULL) while reading output until MARK shows up, or
+ * with a NULL MARK until the shell closes the pty.  Returns 0, or -1 on
+ * hangup or after 30 s without it. */
+static int pty_expect(int fd, const char *input, const char *mark) {
+    matcher_t m = { .len = 0 };
+    size_t left = input ? strlen(input) : 0;
+    int64_t deadline = now_ns() + 30 * (int64_t)1000000000;
+    char buf[65536];
+    while (now_ns() < deadline) {
+        struct pollfd p = { fd, POLLIN | (left ? POLLOUT : 0), 0 };
+        if (poll(&p, 1, 100) < 0 && errno != EINTR) return -1;
+        if (p.revents & POLLIN) {
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if (r <= 0) return mark ? -1 : 0;
+            if (mark && match_feed(&m, buf, (size_t)r, mark)) return 0;
+        } else if (p.revents & (POLLHUP | POLLERR)) {
+            return mark ? -1 : 0;
+        }
+        if (left && (p.revents & POLLOUT)) {
+            ssize_t w = write(fd, input, left > 1024 ? 1024 : left);
+            if (w > 0) { input += w; left -= (size_t)w; }
+        }
+    }
+    return -1;
+}
+
+static void stop_pty(pid_t pid, int fd) {
+    pty_expect(fd, "exit\n", NULL);
+    close(fd);
+    int st;
+    while (waitpid(pid, &st, 0) < 0 && errno == EINTR) ;
+}
+
+static void write_history(const char *home, long lines) {
+    char path[160];
+    snprintf(path, sizeof(path), "%s/.myshell_history", home);
+    FILE *f = fopen(path, "w");
+    if (!f) die(path);
+    for (long i = 0; i < lines; ++i) fprintf(f, "echo history line %ld --flag=%ld\n", i, i * 7);
+    fclose(f);
+}
+
+static void bench_startup(void) {
+    static const long sizes[] = { 0, 10000, 50000 };
+    char home[96];
+    snprintf(home, sizeof(home), "%s/home", dir);
+    mkdir(home, 0700);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        int64_t ns[64];
+        for (int i = 0; i < runs; ++i) {
+            write_history(home, sizes[s]);   /* `exit` is appended each run */
+            int fd;
+            int64_t t0 = now_ns();
+            pid_t pid = start_pty(home, &fd);
+            if (pty_expect(fd, NULL, READY) < 0) { fprintf(stderr, "bench: no prompt\n"); exit(1); }
+            ns[i] = now_ns() - t0;
+            stop_pty(pid, fd);
+        }
+        char params[48];
+        snprintf(params, sizeof(params), "\"history_lines\":%ld", sizes[s]);
+        report("startup", params, 1, ns, runs);
+    }
+}
+
+/* Background jobs that finish at once, reported and reaped by the
+ * interactive loop; `wait` then a marker the typed line cannot contain. */
+static void bench_job_churn(void) {
+    const long n = 500;
+    char home[96];
+    snprintf(home, sizeof(home), "%s/home", dir);
+    write_history(home, 0);
+    size_t cap = (size_t)n * 16 + 64, len = 0;
+    char *input = malloc(cap);
+    if (!input) die("malloc");
+    for (long i = 0; i < n; ++i) len += (size_t)snprintf(input + len, cap - len, "/bin/true &\n");
+    snprintf(input + len, cap - len, "wait; printf 'churn\\x2dend\\n'\n");
+    int64_t ns[64];
+    for (int i = 0; i < runs; ++i) {
+        int fd;
+        pid_t pid = start_pty(home, &fd);
+        if (pty_expect(fd, NULL, READY) < 0) { fprintf(stderr, "bench: no prompt\n"); exit(1); }
+        int64_t t0 = now_ns();
+        if (pty_expect(fd, input, "churn-end") < 0) { fprintf(stderr, "bench: churn timed out\n"); exit(1); }
+        ns[i] = now_ns() - t0;
+        stop_pty(pid, fd);
+    }
+    free(input);
+    report("job_churn", "", n, ns, runs);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: bench path/to/myshell\n");
+        return 2;
+    }
+    shell = argv[1];
+    if (access(shell, X_OK) != 0) die(shell);
+    const char *r = getenv("BENCH_RUNS");
+    if (r && atoi(r) > 0) runs = atoi(r) > 64 ? 64 : atoi(r);
+    snprintf(dir, sizeof(dir), "/tmp/myshell-bench-XXXXXX");
+    if (!mkdtemp(dir)) die("mkdtemp");
+
+    bench_startup();
+    bench_fork_exec();
+    bench_parse_expand();
+    bench_pipelines();
+    bench_job_churn();
+
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    return system(cmd) == 0 ? 0 : 1;
+}
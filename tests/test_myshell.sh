@@ -4,6 +4,9 @@
 BOLD="\033[1m"
 RESET="\033[0m"
 
+# The shell under test, resolved before the script changes directory
+SH="$(cd "$(dirname "$0")/.." && pwd)/myshell"
+
 # Function to print description in bold with an empty line before
 print_desc() {
     echo
@@ -67,3 +70,52 @@ rm -r t new_file.txt
 # Test history
 print_desc "history:"
 history
+
+# Regression checks: run myshell itself and compare its output
+TMP=$(mktemp -d)
+failed=0
+
+# check DESC EXPECTED ACTUAL
+check() {
+    if [ "$2" = "$3" ]; then
+        echo "ok: $1"
+    else
+        echo "FAIL: $1"
+        echo "  expected: $(printf '%q' "$2")"
+        echo "  got:      $(printf '%q' "$3")"
+        failed=1
+    fi
+}
+
+print_desc "myshell: \$\$ is the shell's pid, also inside \$(...):"
+out=$("$SH" -c 'echo $$ $(echo $$)' </dev/null)
+check '$$ matches in $(...)' "yes" "$(set -- $out; [ -n "$1" ] && [ "$1" = "$2" ] && echo yes)"
+
+print_desc "myshell: prefix assignments:"
+check 'X=1 cmd exports X to cmd only' "$(printf '1\n[]')" \
+    "$("$SH" -c 'X=1 sh -c "echo \$X"; echo "[$X]"' </dev/null)"
+check 'PATH=/nonexistent ls fails' "fail" \
+    "$("$SH" -c 'PATH=/nonexistent ls || echo fail' </dev/null 2>/dev/null)"
+
+print_desc "myshell: heredoc quoting:"
+printf '%s\n' 'X=hi' 'cat <<EOF' '$X' 'EOF' "cat <<'EOF'" '$X' 'EOF' > "$TMP/heredoc.sh"
+check '<<EOF expands, <<'"'"'EOF'"'"' does not' "$(printf 'hi\n$X')" "$("$SH" "$TMP/heredoc.sh" </dev/null)"
+
+print_desc "myshell: glob with no match stays literal:"
+check 'no-match glob' "$TMP/*.none" "$("$SH" -c "echo $TMP/*.none" </dev/null)"
+
+print_desc "myshell: &&, || and ; status:"
+check 'list status' "$(printf 'b\n0\n1')" \
+    "$("$SH" -c 'false && echo a; false || echo b; true; echo $?; false; echo $?' </dev/null)"
+
+print_desc "myshell: server mode returns the request's exit status:"
+"$SH" --server "$TMP/s.sock" </dev/null >/dev/null 2>&1 &
+server=$!
+for _ in $(seq 50); do [ -S "$TMP/s.sock" ] && break; sleep 0.1; done
+MYSHELL_SERVER="$TMP/s.sock" "$SH" -c 'exit 5 | cat; exit 7' </dev/null
+check 'exit status through the server' "7" "$?"
+kill "$server" 2>/dev/null
+wait "$server" 2>/dev/null
+
+rm -rf "$TMP"
+exit $failed